@@ -0,0 +1,7 @@
+#include "Arena.h"
+
+std::pmr::memory_resource *Arena::threadPool() {
+    // Unsynchronized since only its own thread uses it, the blocks it keeps are reused by the next arenas
+    thread_local std::pmr::unsynchronized_pool_resource pool;
+    return &pool;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Utils.h"
+#include <array>
+#include <cstddef>
+#include <memory_resource>
+#include <string>
+
+/**
+ * A monotonic arena for the short-lived strings of a single operation (queries, Redis keys, log messages)
+ *
+ * @details Strings are carved out of a buffer on the stack, then out of blocks taken from a pool owned by the thread.
+ * Nothing is freed one string at a time: everything goes back to the pool when the arena is destroyed,
+ * so a model method allocates its transient strings without calling malloc once the pool is warm.
+ * An arena belongs to the thread that created it: do not keep it across a coroutine suspension or hand it to another thread.
+ *
+ * Example:
+ * @code
+ * Arena arena;
+ * auto query = arena.format("SELECT * FROM orders WHERE id = {};", orderId);
+ * @endcode
+ */
+class Arena {
+public:
+    Arena() : monotonic(buffer.data(), buffer.size(), threadPool()) {}
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    /**
+     * @return the memory resource of the arena, for pmr containers
+     */
+    std::pmr::memory_resource *resource() { return &monotonic; }
+
+    /**
+     * Format a string in the arena.
+     * @param fmt the format string
+     * @param args the arguments
+     * @return the formatted string, valid as long as the arena
+     */
+    template<typename... Args>
+    std::pmr::string format(std::format_string<Args...> fmt, Args &&...args) {
+        std::pmr::string out(&monotonic);
+        std::format_to(std::back_inserter(out), fmt, std::forward<Args>(args)...);
+        return out;
+    }
+
+private:
+    static constexpr size_t inlineSize = 2048; ///< Enough for the queries and messages of most operations.
+
+    /**
+     * @return the pool of the calling thread, the upstream of its arenas
+     */
+    static std::pmr::memory_resource *threadPool();
+
+    alignas(std::max_align_t) std::array<std::byte, inlineSize> buffer;
+    std::pmr::monotonic_buffer_resource monotonic;
+};
@@ -2,35 +2,37 @@
 
 bool Utils::logToConsole = false;
 
-void Utils::log(Utils::LogLevel level, std::ostream &ostream, const std::string &message) {
-    std::string logPrefix;
-    std::string coloredLogPrefix;
+void Utils::log(Utils::LogLevel level, std::ostream &ostream, std::string_view message) {
+    std::string_view logPrefix;
+    Color prefixColor{};
     bool isOfstream = typeid(ostream) == typeid(std::ofstream); // If the given ostream is an ofstream, do not color the log message
 
+    // The prefixes are written piece by piece, a log line does not allocate
     switch (level) {
         using enum Utils::LogLevel;
         using enum Utils::Color;
         case DEBUG:
             logPrefix = "[DEBUG] ";
-            coloredLogPrefix = std::format("{}[DEBUG] {}", color(YLW), color(RST));
+            prefixColor = YLW;
             break;
         case TRACE:
             logPrefix = "[TRACE] ";
-            coloredLogPrefix = std::format("{}[TRACE] {}", color(GRN), color(RST));
+            prefixColor = GRN;
             break;
         case ALERT:
             logPrefix = "[ALERT] ";
-            coloredLogPrefix = std::format("{}[ALERT] {}", color(MAG), color(RST));
+            prefixColor = MAG;
             break;
         case ERROR:
             logPrefix = "[ERROR] ";
-            coloredLogPrefix = std::format("{}[ERROR] {}", color(RED), color(RST));
+            prefixColor = RED;
             break;
     }
 
-    ostream << (isOfstream ? logPrefix : coloredLogPrefix) << message << std::endl;
+    if (isOfstream) ostream << logPrefix << message << std::endl;
+    else ostream << color(prefixColor) << logPrefix << color(Color::RST) << message << std::endl;
 
     if (isOfstream && logToConsole) {
-        std::cout << coloredLogPrefix << message << std::endl;
+        std::cout << color(prefixColor) << logPrefix << color(Color::RST) << message << std::endl;
     }
 }
@@ -3,6 +3,7 @@
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <string_view>
 #include <typeinfo>
 #include <utility>
 
@@ -56,5 +57,5 @@ public:
      * @param ostream the output stream
      * @param message the message to print, `std::format` for readability
      */
-    static void log(Utils::LogLevel level, std::ostream &ostream, const std::string &message);
+    static void log(Utils::LogLevel level, std::ostream &ostream, std::string_view message);
 };
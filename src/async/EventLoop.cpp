@@ -0,0 +1,122 @@
+#include "EventLoop.h"
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+EventLoop &EventLoop::getInstance() {
+    static EventLoop instance;
+    return instance;
+}
+
+EventLoop::EventLoop() {
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd < 0 || wakeFd < 0) throw std::runtime_error("Failed to create the event loop file descriptors");
+
+    epoll_event event{.events = EPOLLIN, .data = {.fd = wakeFd}};
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+
+    thread = std::thread(&EventLoop::run, this);
+    for (unsigned i = 0; i < workerCount; ++i) workers.emplace_back(&EventLoop::runWorker, this);
+}
+
+EventLoop::~EventLoop() {
+    {
+        std::lock_guard<std::mutex> lock(workMutex);
+        stopping = true;
+    }
+    workReady.notify_all();
+    for (auto &worker: workers) worker.join();
+
+    running = false;
+    uint64_t one = 1;
+    [[maybe_unused]] auto written = write(wakeFd, &one, sizeof(one));
+    if (thread.joinable()) thread.join();
+    close(wakeFd);
+    close(epollFd);
+}
+
+void EventLoop::post(std::move_only_function<void()> fn) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(std::move(fn));
+    }
+    uint64_t one = 1;
+    [[maybe_unused]] auto written = write(wakeFd, &one, sizeof(one));
+}
+
+void EventLoop::submit(std::move_only_function<void()> fn) {
+    {
+        std::lock_guard<std::mutex> lock(workMutex);
+        offloaded.push_back(std::move(fn));
+    }
+    workReady.notify_one();
+}
+
+void EventLoop::runWorker() {
+    while (true) {
+        std::move_only_function<void()> fn;
+        {
+            std::unique_lock<std::mutex> lock(workMutex);
+            workReady.wait(lock, [this] { return stopping || !offloaded.empty(); });
+            if (stopping && offloaded.empty()) return;
+            fn = std::move(offloaded.front());
+            offloaded.pop_front();
+        }
+        fn();
+    }
+}
+
+void EventLoop::watch(int fd, uint32_t events, std::function<void(uint32_t)> callback) {
+    epoll_event event{.events = events, .data = {.fd = fd}};
+    bool known = handlers.contains(fd);
+    handlers[fd] = std::move(callback);
+    if (epoll_ctl(epollFd, known ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event) < 0) {
+        handlers.erase(fd);
+        throw std::runtime_error(std::format("Failed to watch file descriptor {}", fd));
+    }
+}
+
+void EventLoop::unwatch(int fd) {
+    if (handlers.erase(fd)) epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+void EventLoop::run() {
+    std::array<epoll_event, 64> events{};
+    std::vector<std::move_only_function<void()>> ready;
+
+    while (running) {
+        int count = epoll_wait(epollFd, events.data(), static_cast<int>(events.size()), -1);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Event loop failed: {}", std::strerror(errno)));
+            return;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == wakeFd) {
+                uint64_t value;
+                [[maybe_unused]] auto received = read(wakeFd, &value, sizeof(value));
+                continue;
+            }
+
+            // Copy the handler, it may unwatch (and so destroy) itself while running
+            auto it = handlers.find(fd);
+            if (it == handlers.end()) continue;
+            auto handler = it->second;
+            handler(events[i].events);
+        }
+
+        // Run the functions posted from other threads, outside the lock so they can post again
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ready.swap(pending);
+        }
+        for (auto &fn: ready) fn();
+        ready.clear();
+    }
+}
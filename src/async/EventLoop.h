@@ -0,0 +1,169 @@
+#pragma once
+
+#include "../Utils.h"
+#include "Task.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * A singleton epoll-based event loop running on its own thread.
+ *
+ * @details Sockets are registered with `watch` and their callbacks are invoked on the loop thread.
+ * Work coming from other threads is handed over with `post`, which wakes the loop through an eventfd.
+ * Coroutines driven by the loop (see AsyncPostgres) are always resumed on the loop thread,
+ * so their state never needs locking. Blocking calls are moved off the loop thread with `offload`,
+ * onto a fixed pool of `workerCount` threads owned by the loop.
+ */
+class EventLoop {
+public:
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    ~EventLoop();
+
+    /**
+     * Get the singleton instance of the EventLoop class, starting its thread on first use
+     * @return The singleton instance of the EventLoop class
+     */
+    static EventLoop &getInstance();
+
+    /**
+     * Schedule a function to run on the loop thread. Thread-safe.
+     * @param fn the function to run
+     */
+    void post(std::move_only_function<void()> fn);
+
+    /**
+     * Schedule a blocking function to run on a worker thread. Thread-safe.
+     * @param fn the function to run
+     */
+    void submit(std::move_only_function<void()> fn);
+
+    /**
+     * Register or update the interest of the loop in a file descriptor. Must be called on the loop thread.
+     * @param fd the file descriptor to watch
+     * @param events the epoll events to wait for (EPOLLIN, EPOLLOUT, ...)
+     * @param callback the function to call with the ready events
+     */
+    void watch(int fd, uint32_t events, std::function<void(uint32_t)> callback);
+
+    /**
+     * Stop watching a file descriptor. Must be called on the loop thread.
+     * @param fd the file descriptor to forget
+     */
+    void unwatch(int fd);
+
+    /**
+     * @return whether the caller is running on the loop thread
+     */
+    [[nodiscard]] bool isLoopThread() const { return std::this_thread::get_id() == thread.get_id(); }
+
+    /**
+     * Awaitable running a blocking function on a worker thread, resuming the awaiting coroutine on the loop thread.
+     * Used to overlap blocking client calls (e.g. Redis) with the I/O driven by the loop.
+     */
+    template<typename Fn>
+    class Offload {
+    public:
+        using Result = std::invoke_result_t<Fn>;
+
+        Offload(EventLoop &loop, Fn fn) : loop(loop), fn(std::move(fn)) {}
+
+        bool await_ready() const noexcept { return false; }
+
+        void await_suspend(std::coroutine_handle<> handle) {
+            loop.submit([this, handle] {
+                try {
+                    if constexpr (std::is_void_v<Result>) fn();
+                    else result.emplace(fn());
+                } catch (...) {
+                    error = std::current_exception();
+                }
+                loop.post([handle] { handle.resume(); });
+            });
+        }
+
+        Result await_resume() {
+            if (error) std::rethrow_exception(error);
+            if constexpr (!std::is_void_v<Result>) return std::move(*result);
+        }
+
+    private:
+        EventLoop &loop;
+        Fn fn;
+        std::conditional_t<std::is_void_v<Result>, bool, std::optional<Result>> result{};
+        std::exception_ptr error;
+    };
+
+    /**
+     * Run a blocking function on a worker thread. When every worker is busy, it waits for one in submission order.
+     * @param fn the function to run
+     * @return an awaitable producing the result of the function
+     */
+    template<typename Fn>
+    Offload<Fn> offload(Fn fn) { return Offload<Fn>(*this, std::move(fn)); }
+
+    /**
+     * Run a Task on the loop thread and block the calling thread until it completes.
+     * This is the bridge between the synchronous model methods and the coroutine API.
+     * @param task the task to run
+     * @return the result of the task
+     * @throws any exception thrown by the task
+     */
+    template<typename T>
+    T runSync(Task<T> task) {
+        std::promise<T> promise;
+        auto future = promise.get_future();
+        post([task = std::move(task), promise = std::move(promise)]() mutable { drive(std::move(task), std::move(promise)); });
+        return future.get();
+    }
+
+private:
+    EventLoop();
+
+    /**
+     * Body of the loop thread.
+     */
+    void run();
+
+    /**
+     * Body of the worker threads.
+     */
+    void runWorker();
+
+    template<typename T>
+    static DetachedTask drive(Task<T> task, std::promise<T> promise) {
+        try {
+            if constexpr (std::is_void_v<T>) {
+                co_await task;
+                promise.set_value();
+            } else promise.set_value(co_await task);
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+        }
+    }
+
+    int epollFd = -1;
+    int wakeFd = -1;
+    std::atomic<bool> running = true;
+    std::thread thread;
+
+    std::mutex mutex;
+    std::vector<std::move_only_function<void()>> pending; ///< Functions posted from other threads, guarded by `mutex`.
+
+    std::unordered_map<int, std::function<void(uint32_t)>> handlers; ///< Touched only on the loop thread.
+
+    static constexpr unsigned workerCount = 4; ///< Offloaded calls are short client round trips, a few threads keep them overlapped.
+    std::mutex workMutex;
+    std::condition_variable workReady;
+    std::deque<std::move_only_function<void()>> offloaded; ///< Functions submitted to the workers, guarded by `workMutex`.
+    bool stopping = false;                             ///< Guarded by `workMutex`.
+    std::vector<std::thread> workers;
+};
@@ -0,0 +1,28 @@
+#include "PeriodicTask.h"
+
+PeriodicTask::PeriodicTask(std::string name, std::chrono::milliseconds interval, std::function<void()> fn)
+    : name(std::move(name)), interval(interval), fn(std::move(fn)) {
+    thread = std::thread(&PeriodicTask::run, this);
+}
+
+void PeriodicTask::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    if (thread.joinable()) thread.join();
+}
+
+void PeriodicTask::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!wakeUp.wait_for(lock, interval, [this] { return stopping; })) {
+        lock.unlock();
+        try {
+            fn();
+        } catch (const std::exception &e) {
+            Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Periodic task `{}` failed: {}", name, e.what()));
+        }
+        lock.lock();
+    }
+}
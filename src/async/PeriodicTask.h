@@ -0,0 +1,46 @@
+#pragma once
+
+#include "../Utils.h"
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/**
+ * A function run at a fixed interval on its own thread, until the task is stopped or destroyed.
+ *
+ * @details Used for background maintenance (heartbeats, flushes, decay...). Exceptions thrown by the function
+ * are logged and do not stop the task. Stopping wakes the thread immediately instead of waiting for the next run.
+ */
+class PeriodicTask {
+public:
+    /**
+     * Start the task. The function first runs one interval after the start.
+     * @param name the name of the task, used in the logs
+     * @param interval the delay between two runs
+     * @param fn the function to run
+     */
+    PeriodicTask(std::string name, std::chrono::milliseconds interval, std::function<void()> fn);
+
+    PeriodicTask(const PeriodicTask &) = delete;
+    PeriodicTask &operator=(const PeriodicTask &) = delete;
+
+    ~PeriodicTask() { stop(); }
+
+    /**
+     * Stop the task, waiting for the current run to finish if there is one.
+     */
+    void stop();
+
+private:
+    void run();
+
+    std::string name;
+    std::chrono::milliseconds interval;
+    std::function<void()> fn;
+
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    bool stopping = false; ///< Guarded by `mutex`.
+    std::thread thread;
+};
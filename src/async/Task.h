@@ -0,0 +1,128 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+template<typename T>
+class Task;
+
+/**
+ * State shared by the promise types of every Task, independent of the value type.
+ */
+struct TaskPromiseBase {
+    std::coroutine_handle<> continuation; ///< Coroutine to resume once this one finishes.
+    std::exception_ptr error;             ///< Exception thrown by the coroutine body, rethrown on `co_await`.
+    bool started = false;                 ///< Whether the coroutine body has been resumed at least once.
+
+    /**
+     * Awaiter run at the end of the coroutine, transfers control back to the awaiting coroutine if any.
+     */
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+            auto continuation = handle.promise().continuation;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+};
+
+template<typename T>
+struct TaskPromise : TaskPromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+    void return_value(T result) { value = std::move(result); }
+};
+
+template<>
+struct TaskPromise<void> : TaskPromiseBase {
+    Task<void> get_return_object();
+    void return_void() {}
+};
+
+/**
+ * A lazily started coroutine producing a value of type T.
+ *
+ * @details The body does not run until the Task is either `co_await`-ed or explicitly started with `start()`.
+ * Starting a Task early and awaiting it later is how independent I/O is overlapped (see `Customer::fetchCheckoutState`).
+ * A started Task must be awaited before it is destroyed: its pending I/O refers to the coroutine frame.
+ * Tasks are not thread-safe: a Task must be resumed and awaited on a single thread, usually the EventLoop one.
+ */
+template<typename T = void>
+class Task {
+public:
+    using promise_type = TaskPromise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    explicit Task(handle_type handle) : handle(handle) {}
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    Task(Task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+    Task &operator=(Task &&other) noexcept {
+        if (this != &other) {
+            if (handle) handle.destroy();
+            handle = std::exchange(other.handle, {});
+        }
+        return *this;
+    }
+
+    ~Task() {
+        if (handle) handle.destroy();
+    }
+
+    /**
+     * Run the coroutine body until its first suspension point, without waiting for it to complete.
+     */
+    void start() {
+        if (!handle.promise().started) {
+            handle.promise().started = true;
+            handle.resume();
+        }
+    }
+
+    bool await_ready() const noexcept { return handle.done(); }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation = awaiting;
+        if (handle.promise().started) return std::noop_coroutine(); // Already running, it will resume us when done
+        handle.promise().started = true;
+        return handle;
+    }
+
+    T await_resume() {
+        if (handle.promise().error) std::rethrow_exception(handle.promise().error);
+        if constexpr (!std::is_void_v<T>) return std::move(*handle.promise().value);
+    }
+
+private:
+    handle_type handle;
+};
+
+template<typename T>
+Task<T> TaskPromise<T>::get_return_object() { return Task<T>{std::coroutine_handle<TaskPromise<T>>::from_promise(*this)}; }
+
+inline Task<void> TaskPromise<void>::get_return_object() { return Task<void>{std::coroutine_handle<TaskPromise<void>>::from_promise(*this)}; }
+
+/**
+ * A fire-and-forget coroutine, started eagerly and destroyed automatically once it finishes.
+ * Used to bridge Tasks to non-coroutine code (see `EventLoop::runSync`).
+ */
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
@@ -0,0 +1,203 @@
+#include "AsyncPostgres.h"
+#include <sys/epoll.h>
+
+AsyncPostgres &AsyncPostgres::getInstance(const std::string &dbname, const std::string &user, const std::string &password) {
+    static std::unordered_map<std::string, std::unique_ptr<AsyncPostgres>> instances;
+    static std::mutex mutex;
+
+    // Use a lock to ensure thread-safe access to the instance map
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Check if the instance already exists
+    std::string connInfo = PostgresConnectionPool::getInstance().getConnectionInfo(dbname, user, password);
+    auto it = instances.find(connInfo);
+    if (it != instances.end()) return *it->second;
+
+    // Create a new instance if it doesn't exist in the map
+    constexpr size_t connectionCount = 4;
+    auto instance = std::unique_ptr<AsyncPostgres>(new AsyncPostgres(connInfo, connectionCount));
+    Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("Opened {} async connections to Postgres database '{}' as user '{}'.", connectionCount, dbname, user));
+    return *(instances[connInfo] = std::move(instance));
+}
+
+AsyncPostgres::AsyncPostgres(const std::string &connInfo, size_t connectionCount) : loop(EventLoop::getInstance()), connInfo(connInfo) {
+    for (size_t i = 0; i < connectionCount; ++i) {
+        auto connection = std::make_unique<Connection>();
+        connection->conn = PQconnectdb(connInfo.c_str());
+        if (PQstatus(connection->conn) != CONNECTION_OK || PQsetnonblocking(connection->conn, 1) != 0) {
+            std::string error = PQerrorMessage(connection->conn);
+            PQfinish(connection->conn);
+            throw std::runtime_error(std::format("Failed to open async Postgres connection: {}", error));
+        }
+        connections.push_back(std::move(connection));
+    }
+}
+
+AsyncPostgres::~AsyncPostgres() {
+    for (auto &connection: connections) PQfinish(connection->conn);
+}
+
+void AsyncPostgres::submit(Operation *operation) {
+    if (loop.isLoopThread()) dispatch(operation);
+    else loop.post([this, operation] { dispatch(operation); });
+}
+
+void AsyncPostgres::dispatch(Operation *operation) {
+    for (auto &connection: connections) {
+        if (!connection->operation && !connection->resetting) {
+            start(*connection, operation);
+            return;
+        }
+    }
+    waiting.push_back(operation);
+}
+
+void AsyncPostgres::start(Connection &connection, Operation *operation) {
+    connection.operation = operation;
+    connection.pipelined = operation->statements.size() > 1;
+
+    if (connection.pipelined && !PQenterPipelineMode(connection.conn)) {
+        fail(connection, PQerrorMessage(connection.conn));
+        return;
+    }
+
+    for (const auto &statement: operation->statements) {
+        std::vector<const char *> values;
+        values.reserve(statement.params.size());
+        for (const auto &param: statement.params) values.push_back(param ? param->c_str() : nullptr);
+
+        if (!PQsendQueryParams(connection.conn, statement.sql.c_str(), static_cast<int>(values.size()), nullptr, values.data(), nullptr, nullptr, static_cast<int>(statement.resultFormat))) {
+            fail(connection, PQerrorMessage(connection.conn));
+            return;
+        }
+    }
+    if (connection.pipelined && !PQpipelineSync(connection.conn)) {
+        fail(connection, PQerrorMessage(connection.conn));
+        return;
+    }
+
+    // Flush what fits in the socket buffer now, wait for writability if some output is left
+    int flushed = PQflush(connection.conn);
+    if (flushed < 0) {
+        fail(connection, PQerrorMessage(connection.conn));
+        return;
+    }
+    uint32_t events = EPOLLIN;
+    if (flushed) events |= EPOLLOUT;
+    connection.fd = PQsocket(connection.conn);
+    loop.watch(connection.fd, events, [this, &connection](uint32_t ready) { onReady(connection, ready); });
+}
+
+void AsyncPostgres::onReady(Connection &connection, uint32_t events) {
+    if (events & EPOLLOUT) {
+        int flushed = PQflush(connection.conn);
+        if (flushed < 0) {
+            fail(connection, PQerrorMessage(connection.conn));
+            return;
+        }
+        // Everything was sent, only wait for the replies from now on
+        if (!flushed) loop.watch(connection.fd, EPOLLIN, [this, &connection](uint32_t ready) { onReady(connection, ready); });
+    }
+
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        if (!PQconsumeInput(connection.conn)) {
+            fail(connection, PQerrorMessage(connection.conn));
+            return;
+        }
+        collect(connection);
+    }
+}
+
+void AsyncPostgres::collect(Connection &connection) {
+    Operation *operation = connection.operation;
+
+    while (!PQisBusy(connection.conn)) {
+        PGresult *result = PQgetResult(connection.conn);
+
+        if (!result) {
+            // Outside pipeline mode a null result marks the end of the single statement.
+            // In pipeline mode it separates the results of two statements, the end is marked by the sync.
+            if (!connection.pipelined) {
+                finish(connection);
+                return;
+            }
+            continue;
+        }
+
+        switch (PQresultStatus(result)) {
+            case PGRES_PIPELINE_SYNC:
+                PQclear(result);
+                finish(connection);
+                return;
+            case PGRES_FATAL_ERROR:
+                if (operation->error.empty()) operation->error = PQresultErrorMessage(result);
+                PQclear(result);
+                break;
+            case PGRES_PIPELINE_ABORTED:
+                if (operation->error.empty()) operation->error = "Statement skipped, a previous statement in the pipeline failed";
+                PQclear(result);
+                break;
+            default: operation->results.emplace_back(result); break;
+        }
+    }
+}
+
+void AsyncPostgres::finish(Connection &connection, bool broken) {
+    Operation *operation = std::exchange(connection.operation, nullptr);
+    unwatch(connection);
+    if (connection.pipelined) PQexitPipelineMode(connection.conn);
+
+    // Replace the connection if the server went away, so the next operation does not fail as well.
+    // It takes no operation until the reset is over, the coroutine can still run its next query on another one.
+    if (broken || PQstatus(connection.conn) != CONNECTION_OK) reset(connection);
+
+    // The connection is idle again before resuming, so the coroutine can immediately send its next query
+    operation->handle.resume();
+
+    startNext(connection);
+}
+
+void AsyncPostgres::fail(Connection &connection, const std::string &error) {
+    Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Async Postgres operation failed: {}", error));
+    connection.operation->error = error;
+    connection.operation->results.clear();
+
+    // The connection state is unknown after a send/receive failure, start from a clean one
+    connection.pipelined = false;
+    finish(connection, true);
+}
+
+void AsyncPostgres::unwatch(Connection &connection) {
+    if (connection.fd < 0) return;
+    loop.unwatch(connection.fd);
+    connection.fd = -1;
+}
+
+void AsyncPostgres::reset(Connection &connection) {
+    connection.resetting = true;
+    pollReset(connection, PQresetStart(connection.conn) ? PGRES_POLLING_WRITING : PGRES_POLLING_FAILED);
+}
+
+void AsyncPostgres::pollReset(Connection &connection, PostgresPollingStatusType status) {
+    // The socket may change on each step
+    unwatch(connection);
+    int fd = PQsocket(connection.conn);
+    if (status == PGRES_POLLING_OK || status == PGRES_POLLING_FAILED || fd < 0) {
+        connection.resetting = false;
+        if (status == PGRES_POLLING_OK) PQsetnonblocking(connection.conn, 1);
+        else Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to reset async Postgres connection: {}", PQerrorMessage(connection.conn)));
+        // A connection that failed to reset takes the next operation anyway: it fails fast and retries the reset
+        loop.post([this, &connection] { startNext(connection); });
+        return;
+    }
+
+    connection.fd = fd;
+    loop.watch(fd, status == PGRES_POLLING_READING ? EPOLLIN : EPOLLOUT, [this, &connection](uint32_t) { pollReset(connection, PQresetPoll(connection.conn)); });
+}
+
+void AsyncPostgres::startNext(Connection &connection) {
+    if (connection.operation || connection.resetting || waiting.empty()) return;
+    Operation *next = waiting.front();
+    waiting.pop_front();
+    start(connection, next);
+}
@@ -0,0 +1,345 @@
+#pragma once
+
+#include "../Utils.h"
+#include "../async/EventLoop.h"
+#include "../async/Task.h"
+#include "PostgresConnectionPool.h"
+#include "Rows.h"
+#include <bit>
+#include <charconv>
+#include <cstring>
+#include <deque>
+#include <libpq-fe.h>
+#include <memory>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+/**
+ * Deleter releasing a libpq result.
+ */
+struct PgResultDeleter {
+    void operator()(PGresult *result) const { PQclear(result); }
+};
+
+using PgResult = std::unique_ptr<PGresult, PgResultDeleter>;
+
+/**
+ * Asynchronous Postgres client built on libpq's non-blocking API.
+ *
+ * @details Each instance owns a few non-blocking connections to one database as one user.
+ * Queries are sent with `PQsendQueryParams` and their sockets are watched by the EventLoop,
+ * so any number of coroutines can have queries in flight while sharing the loop thread.
+ * Multiple statements can be sent at once in pipeline mode, costing a single round trip.
+ * Results come in text format, or in binary format on request: integers are then read as they are sent,
+ * without formatting them on the server and parsing them here.
+ *
+ * Example:
+ * @code
+ * auto &db = AsyncPostgres::getInstance("ecommerce", "customer", "customer");
+ * uint32_t balance = co_await db.queryValue<uint32_t>("SELECT get_balance($1, $2);", "customer", id);
+ * @endcode
+ */
+class AsyncPostgres {
+public:
+    AsyncPostgres(const AsyncPostgres &) = delete;
+    AsyncPostgres &operator=(const AsyncPostgres &) = delete;
+
+    ~AsyncPostgres();
+
+    /**
+     * Get the instance connected to the given database as the given user, creating it on first use
+     * @param dbname The name of the database
+     * @param user The username to use for the connection
+     * @param password The password to use for the connection
+     * @return The instance connected to the Postgres database
+     * @throws std::runtime_error if the connection fails
+     */
+    static AsyncPostgres &getInstance(const std::string &dbname, const std::string &user, const std::string &password);
+
+    /**
+     * The format of the results of a statement, as given to libpq.
+     */
+    enum class ResultFormat {
+        TEXT = 0,
+        BINARY = 1 ///< Only for integer, boolean and text-like columns, cast the others to TEXT in the query.
+    };
+
+    /**
+     * A statement and its parameters in text format, std::nullopt being SQL NULL.
+     */
+    struct Statement {
+        std::string sql;
+        std::vector<std::optional<std::string>> params;
+        ResultFormat resultFormat = ResultFormat::TEXT;
+    };
+
+    /**
+     * Build a statement, converting each argument to its text representation.
+     * @param sql the SQL text, with `$1`, `$2`, ... placeholders
+     * @param args the parameters
+     * @return the statement
+     */
+    template<typename... Args>
+    static Statement statement(std::string sql, const Args &...args) {
+        return Statement{std::move(sql), {toParam(args)...}};
+    }
+
+    /**
+     * Awaitable sending a batch of statements and producing one result per statement.
+     */
+    class QueryAwaitable {
+    public:
+        QueryAwaitable(AsyncPostgres &db, std::vector<Statement> statements) : db(db) { operation.statements = std::move(statements); }
+
+        bool await_ready() const noexcept { return false; }
+
+        void await_suspend(std::coroutine_handle<> handle) {
+            operation.handle = handle;
+            db.submit(&operation);
+        }
+
+        std::vector<PgResult> await_resume() {
+            if (!operation.error.empty()) throw std::runtime_error(operation.error);
+            return std::move(operation.results);
+        }
+
+    private:
+        friend class AsyncPostgres;
+
+        struct Operation {
+            std::vector<Statement> statements;
+            std::vector<PgResult> results;
+            std::string error;
+            std::coroutine_handle<> handle;
+        };
+
+        AsyncPostgres &db;
+        Operation operation;
+    };
+
+    /**
+     * Send a single statement.
+     * @param sql the SQL text
+     * @param args the parameters
+     * @return an awaitable producing the result of the statement
+     */
+    template<typename... Args>
+    QueryAwaitable exec(std::string sql, const Args &...args) {
+        std::vector<Statement> statements;
+        statements.push_back(statement(std::move(sql), args...));
+        return QueryAwaitable(*this, std::move(statements));
+    }
+
+    /**
+     * Send multiple statements in pipeline mode and wait for all of them, paying a single round trip.
+     * Statements run in order in implicit transactions; if one fails, the following ones are skipped.
+     * @param statements the statements to send
+     * @return an awaitable producing one result per statement
+     */
+    QueryAwaitable pipeline(std::vector<Statement> statements) { return QueryAwaitable(*this, std::move(statements)); }
+
+    /**
+     * Run a query and decode all of its rows.
+     * @param sql the SQL text
+     * @param args the parameters
+     * @return the rows, each decoded into a tuple of the given types
+     */
+    template<typename... Ts, typename... Args>
+    Task<std::vector<std::tuple<Ts...>>> query(std::string sql, Args... args) {
+        auto results = co_await exec(std::move(sql), args...);
+        co_return decodeRows<Ts...>(results.front().get());
+    }
+
+    /**
+     * Run a query returning exactly one row with one column.
+     * @param sql the SQL text
+     * @param args the parameters
+     * @return the decoded value
+     * @throws std::runtime_error if the query fails or does not return exactly one value
+     */
+    template<typename T, typename... Args>
+    Task<T> queryValue(std::string sql, Args... args) {
+        return queryValue<T>(ResultFormat::TEXT, std::move(sql), std::move(args)...);
+    }
+
+    /**
+     * Run a query returning exactly one row with one column, in the given result format.
+     * @param format the format of the result
+     * @param sql the SQL text
+     * @param args the parameters
+     * @return the decoded value
+     * @throws std::runtime_error if the query fails or does not return exactly one value
+     */
+    template<typename T, typename... Args>
+    Task<T> queryValue(ResultFormat format, std::string sql, Args... args) {
+        std::vector<Statement> statements;
+        statements.push_back(statement(std::move(sql), args...));
+        statements.back().resultFormat = format;
+        auto results = co_await QueryAwaitable(*this, std::move(statements));
+        PGresult *result = results.front().get();
+        if (PQntuples(result) != 1 || PQnfields(result) != 1)
+            throw std::runtime_error(std::format("Expected a single value, got {} rows of {} columns", PQntuples(result), PQnfields(result)));
+        co_return decodeValue<T>(result, 0, 0);
+    }
+
+    /**
+     * Decode every row of a result.
+     * @param result the result to decode
+     * @return the rows, each decoded into a tuple of the given types
+     * @throws std::runtime_error if the number of columns does not match
+     */
+    template<typename... Ts>
+    static std::vector<std::tuple<Ts...>> decodeRows(const PGresult *result) {
+        if (PQnfields(result) != static_cast<int>(sizeof...(Ts))) throw std::runtime_error(std::format("Expected {} columns, got {}", sizeof...(Ts), PQnfields(result)));
+
+        std::vector<std::tuple<Ts...>> rows;
+        rows.reserve(PQntuples(result));
+        for (int row = 0; row < PQntuples(result); ++row) {
+            rows.push_back([&]<size_t... I>(std::index_sequence<I...>) { return std::tuple<Ts...>{decodeValue<Ts>(result, row, I)...}; }(std::index_sequence_for<Ts...>{}));
+        }
+        return rows;
+    }
+
+    /**
+     * Decode a single field from its text or binary representation.
+     * @param result the result holding the field
+     * @param row the row index
+     * @param column the column index
+     * @return the decoded value
+     * @throws std::runtime_error if the field is NULL and T is not an optional, or if it cannot be parsed
+     */
+    template<typename T>
+    static T decodeValue(const PGresult *result, int row, int column) {
+        if constexpr (isOptional<T>) {
+            if (PQgetisnull(result, row, column)) return std::nullopt;
+            return decodeValue<typename T::value_type>(result, row, column);
+        } else {
+            if (PQgetisnull(result, row, column)) throw std::runtime_error(std::format("Unexpected NULL in column {}", PQfname(result, column)));
+            const char *value = PQgetvalue(result, row, column);
+            int length = PQgetlength(result, row, column);
+
+            // Text-like columns are sent the same way in both formats
+            if constexpr (std::is_same_v<T, std::string>) return std::string(value, length);
+            else if constexpr (std::is_same_v<T, bool>) return PQfformat(result, column) ? value[0] != 0 : value[0] == 't';
+            else if constexpr (std::is_integral_v<T>) {
+                if (PQfformat(result, column)) return decodeBinaryInteger<T>(value, length, PQfname(result, column));
+                T parsed{};
+                auto [end, ec] = std::from_chars(value, value + length, parsed);
+                if (ec != std::errc() || end != value + length) throw std::runtime_error(std::format("Failed to parse `{}` in column {}", std::string_view(value, length), PQfname(result, column)));
+                return parsed;
+            } else if constexpr (std::is_arithmetic_v<T>) {
+                if (PQfformat(result, column)) throw std::runtime_error(std::format("Binary format not supported for column {}", PQfname(result, column)));
+                T parsed{};
+                auto [end, ec] = std::from_chars(value, value + length, parsed);
+                if (ec != std::errc() || end != value + length) throw std::runtime_error(std::format("Failed to parse `{}` in column {}", std::string_view(value, length), PQfname(result, column)));
+                return parsed;
+            } else static_assert(sizeof(T) == 0, "Unsupported column type");
+        }
+    }
+
+private:
+    using Operation = QueryAwaitable::Operation;
+
+    /**
+     * Decode a SMALLINT, INT or BIGINT sent in binary format, in network byte order.
+     */
+    template<typename T>
+    static T decodeBinaryInteger(const char *value, int length, const char *column) {
+        auto read = [value]<typename I>(I) {
+            I raw;
+            std::memcpy(&raw, value, sizeof(I));
+            return std::endian::native == std::endian::little ? std::byteswap(raw) : raw;
+        };
+        switch (length) {
+            case 2: return static_cast<T>(read(int16_t{}));
+            case 4: return static_cast<T>(read(int32_t{}));
+            case 8: return static_cast<T>(read(int64_t{}));
+            default: throw std::runtime_error(std::format("Unexpected {}-byte integer in column {}", length, column));
+        }
+    }
+
+    /**
+     * A non-blocking connection and the operation it is currently running, if any.
+     */
+    struct Connection {
+        PGconn *conn = nullptr;
+        int fd = -1;                      ///< Socket watched by the loop while an operation or a reset is running, -1 otherwise.
+        Operation *operation = nullptr;   ///< Operation in flight, nullptr if the connection is idle.
+        bool pipelined = false;           ///< Whether the operation was sent in pipeline mode.
+        bool resetting = false;           ///< Whether the connection is being re-established, it takes no operation meanwhile.
+    };
+
+    AsyncPostgres(const std::string &connInfo, size_t connectionCount);
+
+    /**
+     * Queue an operation, running it as soon as a connection is idle. Thread-safe.
+     */
+    void submit(Operation *operation);
+
+    /**
+     * Run an operation on an idle connection, or queue it if all connections are busy. Loop thread only.
+     */
+    void dispatch(Operation *operation);
+
+    /**
+     * Send the statements of an operation on the given connection. Loop thread only.
+     */
+    void start(Connection &connection, Operation *operation);
+
+    /**
+     * Handle readiness of the connection socket: flush pending output, read input and collect results.
+     */
+    void onReady(Connection &connection, uint32_t events);
+
+    /**
+     * Consume every result available without blocking, finishing the operation once all have arrived.
+     */
+    void collect(Connection &connection);
+
+    /**
+     * Complete the operation running on the connection, resume its coroutine and start the next queued one.
+     * @param broken whether to re-establish the connection even if libpq still considers it open
+     */
+    void finish(Connection &connection, bool broken = false);
+
+    /**
+     * Abort the operation running on the connection with the given error, resetting the connection.
+     */
+    void fail(Connection &connection, const std::string &error);
+
+    /**
+     * Stop watching the socket of the connection, if it is watched.
+     */
+    void unwatch(Connection &connection);
+
+    /**
+     * Re-establish the connection without blocking the loop, with `PQresetStart` then `PQresetPoll` on each readiness of its socket.
+     */
+    void reset(Connection &connection);
+
+    /**
+     * Handle a step of a reset: wait for the socket as libpq asks, or end the reset.
+     * @param status the result of the last `PQresetStart` or `PQresetPoll`
+     */
+    void pollReset(Connection &connection, PostgresPollingStatusType status);
+
+    /**
+     * Start the next queued operation on the connection, if it is idle. Posted, so that failing operations do not recurse.
+     */
+    void startNext(Connection &connection);
+
+    template<typename T>
+    static std::optional<std::string> toParam(const T &value) {
+        if constexpr (isOptional<T>) return value ? toParam(*value) : std::nullopt;
+        else if constexpr (std::is_same_v<T, bool>) return value ? "t" : "f";
+        else if constexpr (std::is_arithmetic_v<T>) return std::to_string(value);
+        else return std::string(value);
+    }
+
+    EventLoop &loop;
+    std::string connInfo;
+    std::vector<std::unique_ptr<Connection>> connections; ///< Stable addresses, captured by the loop callbacks.
+    std::deque<Operation *> waiting;                      ///< Operations waiting for an idle connection.
+};
@@ -0,0 +1,43 @@
+#include "BalanceLedger.h"
+
+BalanceLedger &BalanceLedger::getInstance() {
+    static BalanceLedger instance;
+    return instance;
+}
+
+BalanceLedger::~BalanceLedger() {
+    aggregateTask.reset();
+    aggregate(); // Leave the ledger empty on a clean shutdown
+}
+
+void BalanceLedger::start() {
+    aggregate();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!aggregateTask) aggregateTask.emplace("balance ledger", aggregateInterval, [this] { aggregate(); });
+}
+
+void BalanceLedger::aggregate() {
+    try {
+        // Connect to the 'ecommerce' database as the 'ecommerce' user, the owner of the ledger
+        auto conn = conn2Postgres("ecommerce", "ecommerce", "ecommerce");
+
+        // Take the ledger and apply it in the same statement, readers see the payments either in the ledger or in the balance
+        pqxx::work tx(*conn);
+        pqxx::result R = tx.exec(R"(
+            WITH moved AS (
+                DELETE FROM supplier_balance_ledger RETURNING supplier_id, amount
+            ), totals AS (
+                SELECT supplier_id, SUM(amount) AS amount FROM moved GROUP BY supplier_id
+            )
+            UPDATE suppliers s SET balance = s.balance + t.amount
+            FROM totals t
+            WHERE s.id = t.supplier_id;
+        )");
+        tx.commit();
+
+        if (R.affected_rows() > 0) Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("Ledger applied to the balance of {} suppliers.", R.affected_rows()));
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to apply the balance ledger: {}", e.what()));
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "../Utils.h"
+#include "../async/PeriodicTask.h"
+#include "dbutils.h"
+#include <optional>
+
+/**
+ * A singleton class that folds the supplier balance ledger into the `suppliers` table
+ *
+ * @details Orders pay their suppliers by appending to `supplier_balance_ledger` (see `pay_supplier`) instead of
+ * updating the supplier rows, so that checkouts buying from the same supplier do not queue on its row lock.
+ * The balance functions add the ledger to the `balance` column, so balances are exact at any time;
+ * the aggregator only keeps the ledger short by moving it into the column, one update per supplier per run.
+ */
+class BalanceLedger {
+public:
+    BalanceLedger() = default;
+    BalanceLedger(const BalanceLedger &) = delete;
+    BalanceLedger &operator=(const BalanceLedger &) = delete;
+
+    ~BalanceLedger();
+
+    /**
+     * Get the singleton instance of the BalanceLedger class
+     * @return The singleton instance of the BalanceLedger class
+     */
+    static BalanceLedger &getInstance();
+
+    /**
+     * Move the ledger into the supplier balances, then keep doing it in the background.
+     */
+    void start();
+
+    /**
+     * Move the ledger into the supplier balances.
+     */
+    void aggregate();
+
+private:
+    static constexpr std::chrono::milliseconds aggregateInterval{5000};
+
+    std::mutex mutex;
+    std::optional<PeriodicTask> aggregateTask; ///< Started by `start`, guarded by `mutex`.
+};
@@ -0,0 +1,208 @@
+#include "ColumnarFile.h"
+#include <unordered_map>
+
+/**
+ * Read a big-endian signed integer, as sent by a binary COPY
+ */
+static int64_t readBigEndian(const char *data, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i) value = value << 8 | static_cast<uint8_t>(data[i]);
+    int shift = 64 - 8 * bytes; // Sign-extend
+    return static_cast<int64_t>(value << shift) >> shift;
+}
+
+ColumnarFile::ColumnarFile(std::filesystem::path path, std::vector<Column> columns)
+    : path(std::move(path)), columns(std::move(columns)), buffers(this->columns.size()) {
+    for (const auto &column: this->columns) {
+        bool numeric = column.type != Type::TEXT;
+        bool numericEncoding = column.encoding == Encoding::DELTA || column.encoding == Encoding::VARINT;
+        if (numeric != numericEncoding) throw std::invalid_argument(std::format("Encoding not supported for the type of column `{}`", column.name));
+    }
+
+    partialPath = this->path;
+    partialPath += ".partial";
+    file.open(partialPath, std::ios::binary | std::ios::trunc);
+    if (!file) throw std::runtime_error(std::format("Cannot open `{}`", partialPath.string()));
+
+    std::string header("ORDC\1");
+    putVarint(header, this->columns.size());
+    for (const auto &column: this->columns) {
+        putVarint(header, column.name.size());
+        header += column.name;
+        header.push_back(static_cast<char>(column.type));
+        header.push_back(static_cast<char>(column.encoding));
+        header.push_back(static_cast<char>(column.nullable));
+    }
+    file.write(header.data(), static_cast<std::streamsize>(header.size()));
+}
+
+ColumnarFile::~ColumnarFile() {
+    if (closed) return;
+    file.close();
+    std::error_code ec;
+    std::filesystem::remove(partialPath, ec);
+}
+
+void ColumnarFile::putVarint(std::string &out, uint64_t value) {
+    // LEB128, like the cart lines: 7 bits per byte, least significant group first
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+void ColumnarFile::append(std::string_view data) {
+    if (trailerRead) throw std::runtime_error("Data after the end of the COPY");
+    pending.append(data);
+    parse();
+}
+
+void ColumnarFile::parse() {
+    size_t pos = 0;
+
+    // Header: signature, flags (int32), header extension length (int32) and extension
+    if (!headerRead) {
+        if (pending.size() < copySignature.size() + 8) return;
+        if (std::string_view(pending).substr(0, copySignature.size()) != copySignature) throw std::runtime_error("Not a binary COPY");
+        auto extensionLength = static_cast<size_t>(readBigEndian(pending.data() + copySignature.size() + 4, 4));
+        if (pending.size() < copySignature.size() + 8 + extensionLength) return;
+        pos = copySignature.size() + 8 + extensionLength;
+        headerRead = true;
+    }
+
+    // Tuples: field count (int16, -1 for the trailer), then the length (int32, -1 for NULL) and bytes of each field
+    while (pending.size() - pos >= 2) {
+        auto fieldCount = readBigEndian(pending.data() + pos, 2);
+        if (fieldCount == -1) {
+            trailerRead = true;
+            pos += 2;
+            break;
+        }
+        if (fieldCount != static_cast<int64_t>(columns.size())) throw std::runtime_error(std::format("Expected {} columns, got {}", columns.size(), fieldCount));
+
+        // Only decode the tuple once all of it was received
+        size_t cursor = pos + 2;
+        bool complete = true;
+        for (size_t i = 0; i < columns.size() && complete; ++i) {
+            if (pending.size() - cursor < 4) complete = false;
+            else {
+                auto length = readBigEndian(pending.data() + cursor, 4);
+                cursor += 4 + static_cast<size_t>(std::max<int64_t>(length, 0));
+                complete = cursor <= pending.size();
+            }
+        }
+        if (!complete) break;
+
+        cursor = pos + 2;
+        for (size_t i = 0; i < columns.size(); ++i) {
+            const Column &column = columns[i];
+            Buffer &buffer = buffers[i];
+            auto length = readBigEndian(pending.data() + cursor, 4);
+            const char *value = pending.data() + cursor + 4;
+            cursor += 4 + static_cast<size_t>(std::max<int64_t>(length, 0));
+
+            buffer.nulls.push_back(length == -1);
+            if (length == -1) {
+                if (!column.nullable) throw std::runtime_error(std::format("Unexpected NULL in column `{}`", column.name));
+                continue;
+            }
+            switch (column.type) {
+                case Type::INT32:
+                    if (length != 4) throw std::runtime_error(std::format("Column `{}` is not an INT", column.name));
+                    buffer.numbers.push_back(readBigEndian(value, 4));
+                    break;
+                case Type::TIMESTAMP:
+                    if (length != 8) throw std::runtime_error(std::format("Column `{}` is not a TIMESTAMP", column.name));
+                    buffer.numbers.push_back(readBigEndian(value, 8) + postgresEpochOffset);
+                    break;
+                case Type::TEXT:
+                    buffer.texts.emplace_back(value, static_cast<size_t>(length));
+                    break;
+            }
+        }
+        pos = cursor;
+        ++totalRows;
+        if (++chunkSize == chunkRows) flushChunk();
+    }
+    pending.erase(0, pos);
+}
+
+std::string ColumnarFile::encode(const Column &column, const Buffer &buffer) const {
+    std::string payload;
+    if (column.nullable) {
+        std::string bitmap((chunkSize + 7) / 8, '\0');
+        for (size_t row = 0; row < chunkSize; ++row) {
+            if (buffer.nulls[row]) bitmap[row / 8] = static_cast<char>(bitmap[row / 8] | (1 << (row % 8)));
+        }
+        payload += bitmap;
+    }
+
+    switch (column.encoding) {
+        case Encoding::DELTA: {
+            int64_t previous = 0;
+            for (auto value: buffer.numbers) {
+                putSigned(payload, value - previous);
+                previous = value;
+            }
+            break;
+        }
+        case Encoding::VARINT:
+            for (auto value: buffer.numbers) putSigned(payload, value);
+            break;
+        case Encoding::DICTIONARY: {
+            std::vector<std::string_view> entries;
+            std::unordered_map<std::string_view, uint64_t> indexes;
+            std::vector<uint64_t> codes;
+            codes.reserve(buffer.texts.size());
+            for (const auto &text: buffer.texts) {
+                auto [it, inserted] = indexes.try_emplace(text, entries.size());
+                if (inserted) entries.push_back(text);
+                codes.push_back(it->second);
+            }
+            putVarint(payload, entries.size());
+            for (auto entry: entries) {
+                putVarint(payload, entry.size());
+                payload += entry;
+            }
+            for (auto code: codes) putVarint(payload, code);
+            break;
+        }
+        case Encoding::STRING:
+            for (const auto &text: buffer.texts) {
+                putVarint(payload, text.size());
+                payload += text;
+            }
+            break;
+    }
+    return payload;
+}
+
+void ColumnarFile::flushChunk() {
+    if (chunkSize == 0) return;
+
+    std::string chunk;
+    putVarint(chunk, chunkSize);
+    for (size_t i = 0; i < columns.size(); ++i) {
+        std::string payload = encode(columns[i], buffers[i]);
+        chunk.push_back(static_cast<char>(columns[i].encoding));
+        putVarint(chunk, payload.size());
+        chunk += payload;
+        buffers[i] = Buffer{};
+    }
+    file.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+    if (!file) throw std::runtime_error(std::format("Failed to write `{}`", partialPath.string()));
+    chunkSize = 0;
+}
+
+void ColumnarFile::close() {
+    if (!trailerRead) throw std::runtime_error("Incomplete COPY");
+
+    flushChunk();
+    file.put('\0'); // A chunk of no rows
+    file.close();
+    if (!file) throw std::runtime_error(std::format("Failed to write `{}`", partialPath.string()));
+
+    std::filesystem::rename(partialPath, path);
+    closed = true;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "../Utils.h"
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * A writer of compact columnar files, filled from the output of `COPY ... TO STDOUT (FORMAT binary)`
+ *
+ * @details Rows are buffered and written in chunks of `chunkRows` rows, each column of a chunk stored contiguously
+ * with its own encoding, so that a reader only decodes the columns it needs.
+ *
+ * File layout (integers are unsigned LEB128 varints unless stated otherwise, signed values are zigzag-encoded):
+ * @code
+ * "ORDC" u8:version
+ * columnCount { nameLength name u8:type u8:encoding u8:nullable }
+ * chunk* { rowCount { u8:encoding payloadLength payload } per column }
+ * 0 (a chunk of no rows ends the file)
+ * @endcode
+ * In the payload of a nullable column, a bitmap of ceil(rowCount / 8) bytes (bit set = NULL) precedes the values
+ * of the other rows. Payloads by encoding:
+ *  - DELTA: the difference of each value with the previous one in the chunk (the first with 0), for ids and timestamps
+ *  - VARINT: each value
+ *  - DICTIONARY: entryCount { length bytes }, then the index of each value, for low-cardinality text
+ *  - STRING: length bytes for each value
+ * Timestamps are microseconds since the Unix epoch.
+ *
+ * An order export (see `exportOrders`) holds each order once, so values that change afterwards, such as the `status`
+ * of an order, are a snapshot taken at export time.
+ *
+ * The file is written as `{path}.partial` and only renamed to `path` by `close`, so an interrupted export leaves no file behind.
+ */
+class ColumnarFile {
+public:
+    /**
+     * The Postgres type of a column, as sent by a binary COPY.
+     */
+    enum class Type : uint8_t {
+        INT32 = 1,
+        TIMESTAMP = 2, ///< `TIMESTAMP` (without time zone).
+        TEXT = 3       ///< Any type sent as text, e.g. `VARCHAR` and enums.
+    };
+
+    enum class Encoding : uint8_t {
+        DELTA = 1,
+        VARINT = 2,
+        DICTIONARY = 3,
+        STRING = 4
+    };
+
+    struct Column {
+        std::string name;
+        Type type;
+        Encoding encoding;
+        bool nullable = false;
+    };
+
+    /**
+     * Create the file and write its header.
+     * @param path the path of the file
+     * @param columns the columns, in the order of the COPY
+     * @throws std::runtime_error if the file cannot be created
+     */
+    ColumnarFile(std::filesystem::path path, std::vector<Column> columns);
+
+    ColumnarFile(const ColumnarFile &) = delete;
+    ColumnarFile &operator=(const ColumnarFile &) = delete;
+
+    /**
+     * Remove the partial file, if `close` was not called.
+     */
+    ~ColumnarFile();
+
+    /**
+     * Append the data of a binary COPY, in pieces of any size (e.g. each buffer returned by PQgetCopyData).
+     * @param data the next bytes of the COPY
+     * @throws std::runtime_error if the data is not a binary COPY of the columns
+     */
+    void append(std::string_view data);
+
+    /**
+     * Write the last chunk and the end of the file, and give the file its final name.
+     * @throws std::runtime_error if the COPY was incomplete or the file cannot be written
+     */
+    void close();
+
+    /**
+     * @return the number of rows appended so far
+     */
+    [[nodiscard]] uint64_t rows() const { return totalRows; }
+
+private:
+    static constexpr size_t chunkRows = 65536;
+    static constexpr std::string_view copySignature{"PGCOPY\n\377\r\n\0", 11};
+    static constexpr int64_t postgresEpochOffset = 946684800000000; ///< Microseconds from the Unix epoch to 2000-01-01, the Postgres epoch.
+
+    /**
+     * The values of a column in the current chunk.
+     */
+    struct Buffer {
+        std::vector<int64_t> numbers;
+        std::vector<std::string> texts;
+        std::vector<bool> nulls;
+    };
+
+    static void putVarint(std::string &out, uint64_t value);
+    static void putSigned(std::string &out, int64_t value) { putVarint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63)); }
+
+    /**
+     * Parse the complete tuples at the start of `pending`, keeping the incomplete rest.
+     */
+    void parse();
+
+    /**
+     * Encode and write the buffered rows as a chunk.
+     */
+    void flushChunk();
+
+    /**
+     * Encode the values of a column in the current chunk.
+     */
+    std::string encode(const Column &column, const Buffer &buffer) const;
+
+    std::filesystem::path path, partialPath;
+    std::vector<Column> columns;
+    std::ofstream file;
+    std::string pending;      ///< Bytes of the COPY not parsed yet.
+    bool headerRead = false;  ///< The COPY signature and header extension were skipped.
+    bool trailerRead = false; ///< The end of the COPY was reached.
+    bool closed = false;
+    std::vector<Buffer> buffers; ///< One per column.
+    size_t chunkSize = 0;        ///< Rows buffered in the current chunk.
+    uint64_t totalRows = 0;
+};
@@ -1,27 +1,214 @@
 #include "PostgresConnectionPool.h"
+#include <future>
+#include <poll.h>
+#include <random>
 
 PostgresConnectionPool &PostgresConnectionPool::getInstance() {
     static PostgresConnectionPool instance;
     return instance;
 }
 
+void PostgresConnectionPool::setEndpoints(const std::string &primary, const std::vector<std::string> &replicas) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->primary = primary;
+    this->replicas = replicas;
+}
+
+void PostgresConnectionPool::setReadYourWritesWindow(std::chrono::milliseconds window) {
+    std::lock_guard<std::mutex> lock(mutex);
+    readYourWritesWindow = window;
+}
+
+void PostgresConnectionPool::setPreparedStatements(const std::string &user, std::vector<PreparedStatement> statements) {
+    std::lock_guard<std::mutex> lock(mutex);
+    preparedStatements[user] = std::move(statements);
+}
+
+void PostgresConnectionPool::warmUp(const std::string &dbname, const std::vector<std::pair<std::string, std::string>> &credentials) {
+    std::vector<std::string> endpoints;
+    std::unordered_map<std::string, std::vector<PreparedStatement>> statements;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        endpoints = replicas;
+        endpoints.insert(endpoints.begin(), primary);
+        statements = preparedStatements;
+    }
+
+    // Connect and authenticate outside of the lock, all connections at once
+    std::vector<std::future<void>> pending;
+    for (const auto &endpoint: endpoints) {
+        for (const auto &[user, password]: credentials) {
+            auto userStatements = statements.contains(user) ? statements.at(user) : std::vector<PreparedStatement>{};
+            pending.push_back(std::async(std::launch::async, [this, &dbname, endpoint, user, password, userStatements] {
+                auto conn = open(endpoint, dbname, user, password, userStatements);
+                std::lock_guard<std::mutex> lock(mutex);
+                auto &slot = connections[connectionInfo(endpoint, dbname, user, password)];
+                if (!slot.conn && !slot.connecting) slot = {std::move(conn)};
+            }));
+        }
+    }
+
+    size_t opened = 0;
+    for (auto &connection: pending) {
+        try {
+            connection.get();
+            ++opened;
+        } catch (const std::runtime_error &) {
+            // Already logged by `open`, the connection is opened again on its first checkout
+        }
+    }
+    Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("{} of {} Postgres connections warmed up.", opened, pending.size()));
+}
+
+std::string PostgresConnectionPool::connectionInfo(const std::string &endpoint, const std::string &dbname, const std::string &user, const std::string &password) {
+    // Translate `host[:port]` into connection parameters, nothing means the local default server
+    std::string hostInfo;
+    if (!endpoint.empty()) {
+        auto colon = endpoint.rfind(':');
+        hostInfo = colon == std::string::npos ? std::format("host={} ", endpoint) : std::format("host={} port={} ", endpoint.substr(0, colon), endpoint.substr(colon + 1));
+    }
+    return std::format("{}dbname={} user={} password={} connect_timeout={}", hostInfo, dbname, user, password, connectTimeout.count());
+}
+
+std::string PostgresConnectionPool::getConnectionInfo(const std::string &dbname, const std::string &user, const std::string &password) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return connectionInfo(primary, dbname, user, password);
+}
+
+std::string PostgresConnectionPool::getReadConnectionInfo(const std::string &dbname, const std::string &user, const std::string &password) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (replicas.empty()) return connectionInfo(primary, dbname, user, password);
+    return connectionInfo(replicas[nextReplica++ % replicas.size()], dbname, user, password);
+}
+
 std::shared_ptr<pqxx::connection> PostgresConnectionPool::getConnection(const std::string &dbname, const std::string &user, const std::string &password) {
     // Use a lock to ensure thread-safe access to the connection map
+    std::unique_lock<std::mutex> lock(mutex);
+    return connect(lock, primary, dbname, user, password);
+}
+
+std::shared_ptr<pqxx::connection> PostgresConnectionPool::getReadConnection(const std::string &dbname, const std::string &user, const std::string &password, const std::string &session) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (replicas.empty()) return connect(lock, primary, dbname, user, password);
+
+    // Sessions that wrote recently keep reading from the primary
+    auto pin = pinnedUntil.find(session);
+    if (pin != pinnedUntil.end()) {
+        if (std::chrono::steady_clock::now() < pin->second) return connect(lock, primary, dbname, user, password);
+        pinnedUntil.erase(pin);
+    }
+
+    // Copied, the replicas may be changed while the lock is released
+    std::string replica = replicas[nextReplica++ % replicas.size()];
+    try {
+        return connect(lock, replica, dbname, user, password, false); // The primary serves the reads while a replica is connecting
+    } catch (const std::runtime_error &e) {
+        Utils::log(Utils::LogLevel::ALERT, std::cerr, std::format("Replica `{}` unavailable, reading from the primary: {}", replica, e.what()));
+        return connect(lock, primary, dbname, user, password);
+    }
+}
+
+void PostgresConnectionPool::markWrite(const std::string &session) {
     std::lock_guard<std::mutex> lock(mutex);
+    if (replicas.empty() || readYourWritesWindow == std::chrono::milliseconds::zero()) return;
+    auto now = std::chrono::steady_clock::now();
+    pinnedUntil[session] = now + readYourWritesWindow;
 
-    // Check if the connection already exists
-    std::string connInfo = std::format("dbname={} user={} password={}", dbname, user, password);
-    auto it = connections.find(connInfo);
-    if (it != connections.end()) return it->second;
+    // Sessions that stopped reading are never looked up again, erase the expired pins once the map doubled since the last sweep
+    if (pinnedUntil.size() >= pinnedSweepSize) {
+        std::erase_if(pinnedUntil, [now](const auto &pin) { return pin.second <= now; });
+        pinnedSweepSize = std::max(minPinnedSweepSize, 2 * pinnedUntil.size());
+    }
+}
 
-    // Create a new connection if it doesn't exist in the map, otherwise return the existing connection
+std::shared_ptr<pqxx::connection> PostgresConnectionPool::open(const std::string &endpoint,
+                                                                const std::string &dbname,
+                                                                const std::string &user,
+                                                                const std::string &password,
+                                                                const std::vector<PreparedStatement> &statements) {
+    std::string server = endpoint.empty() ? "local" : endpoint;
+    std::shared_ptr<pqxx::connection> conn;
     try {
-        auto conn = std::make_shared<pqxx::connection>(connInfo);
-        Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("Connected to Postgres database '{}' as user '{}'.", dbname, user));
-        connections[connInfo] = conn;
-        return conn;
+        conn = std::make_shared<pqxx::connection>(connectionInfo(endpoint, dbname, user, password));
+        Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("Connected to Postgres database '{}' on `{}` as user '{}'.", dbname, server, user));
     } catch (const pqxx::broken_connection &e) {
-        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to connect to Postgres database '{}' as user '{}': {}", dbname, user, e.what()));
-        throw std::runtime_error(std::format("Failed to connect to Postgres database '{}' as user '{}': {}", dbname, user, e.what()));
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to connect to Postgres database '{}' on `{}` as user '{}': {}", dbname, server, user, e.what()));
+        throw std::runtime_error(std::format("Failed to connect to Postgres database '{}' on `{}` as user '{}': {}", dbname, server, user, e.what()));
+    }
+
+    // A statement that cannot be prepared (e.g. its function does not exist yet) only fails when it is executed
+    for (const auto &[name, sql]: statements) {
+        try {
+            conn->prepare(name, sql);
+        } catch (const std::exception &e) {
+            Utils::log(Utils::LogLevel::ALERT, std::cerr, std::format("Failed to prepare statement `{}` for user '{}': {}", name, user, e.what()));
+        }
+    }
+    return conn;
+}
+
+bool PostgresConnectionPool::isHealthy(const pqxx::connection &conn) {
+    if (!conn.is_open()) return false;
+
+    // An idle connection has nothing to read, unless the server closed it or sent a termination notice.
+    // If another thread is running a query on it, this only costs an unneeded reconnection.
+    pollfd fd{conn.sock(), POLLIN, 0};
+    return poll(&fd, 1, 0) == 0;
+}
+
+std::chrono::milliseconds PostgresConnectionPool::backoff(uint32_t failures) {
+    // Exponential delay with half of it randomized, so that clients do not all retry at the same time
+    thread_local std::mt19937 gen(std::random_device{}());
+    auto delay = std::min(backoffCap, backoffBase * (1 << std::min(failures - 1, 16u)));
+    return delay / 2 + std::chrono::milliseconds(std::uniform_int_distribution<int64_t>(0, delay.count() / 2)(gen));
+}
+
+std::shared_ptr<pqxx::connection> PostgresConnectionPool::connect(std::unique_lock<std::mutex> &lock,
+                                                                   const std::string &endpoint,
+                                                                   const std::string &dbname,
+                                                                   const std::string &user,
+                                                                   const std::string &password,
+                                                                   bool wait) {
+    std::string server = endpoint.empty() ? "local" : endpoint;
+    std::string connInfo = connectionInfo(endpoint, dbname, user, password);
+    auto &slot = connections[connInfo];
+
+    // Another thread is opening this connection: share its outcome instead of opening a second one
+    if (slot.connecting && !wait) throw std::runtime_error(std::format("Postgres database '{}' on `{}` is being connected to", dbname, server));
+    connected.wait(lock, [&slot] { return !slot.connecting; });
+
+    // Return the cached connection if it is still usable
+    if (slot.conn) {
+        if (isHealthy(*slot.conn)) return slot.conn;
+        Utils::log(Utils::LogLevel::ALERT, std::cerr, std::format("Connection to Postgres database '{}' on `{}` as user '{}' lost, reconnecting.", dbname, server, user));
+        slot.conn.reset(); // Users of the broken connection keep it until they are done with it
+    }
+
+    // Fail fast while the server is backing off, instead of piling up connection attempts
+    auto now = std::chrono::steady_clock::now();
+    if (now < slot.retryAt) {
+        throw std::runtime_error(std::format("Postgres database '{}' on `{}` unavailable, retrying in {}ms", dbname, server,
+                                             std::chrono::duration_cast<std::chrono::milliseconds>(slot.retryAt - now).count()));
+    }
+
+    // Connect outside of the lock, the other callers of the pool do not wait for this server
+    slot.connecting = true;
+    std::vector<PreparedStatement> statements = preparedStatements[user];
+    lock.unlock();
+    std::shared_ptr<pqxx::connection> conn;
+    try {
+        conn = open(endpoint, dbname, user, password, statements);
+    } catch (...) {
+        lock.lock();
+        slot.connecting = false;
+        slot.retryAt = std::chrono::steady_clock::now() + backoff(++slot.failures);
+        connected.notify_all();
+        throw;
     }
+    lock.lock();
+    slot.connecting = false;
+    slot.conn = conn;
+    slot.failures = 0;
+    connected.notify_all();
+    return conn;
 }
@@ -1,11 +1,22 @@
 #pragma once
 
 #include "../Utils.h"
+#include <chrono>
+#include <condition_variable>
 #include <memory>
 #include <pqxx/pqxx>
+#include <unordered_map>
+#include <vector>
 
 /**
  * A singleton class that manages a pool of connections to Postgres databases
+ *
+ * @details Connections go to the primary server, unless read-only work asks for a replica with `getReadConnection`.
+ * Reads are spread over the replicas in round-robin; a session that wrote recently can be pinned to the primary
+ * for a short window (see `setReadYourWritesWindow`) so it does not read stale data while replicas catch up.
+ * Cached connections are checked on every checkout and reopened once broken (e.g. after a server restart);
+ * failed reconnections are retried with a jittered exponential backoff, failing fast in between.
+ * Connections are opened outside of the pool lock, so a slow or dead server only delays the callers that need it.
  */
 class PostgresConnectionPool {
 public:
@@ -15,6 +26,11 @@ public:
 
     ~PostgresConnectionPool() { Utils::log(Utils::LogLevel::TRACE, std::cout, std::format("Closing {} Postgres connections...", connections.size())); }
 
+    /**
+     * A statement to prepare on every connection of a user, as its name and its SQL.
+     */
+    using PreparedStatement = std::pair<std::string, std::string>;
+
     /**
      * Get the singleton instance of the PostgresConnectionPool class
      * @return The singleton instance of the PostgresConnectionPool class
@@ -22,7 +38,34 @@ public:
     static PostgresConnectionPool &getInstance();
 
     /**
-     * Get a connection to a Postgres database
+     * Set the servers to connect to. Must be called before any connection is requested.
+     * @param primary The `host[:port]` of the primary server, empty for the local default
+     * @param replicas The `host[:port]` of each read replica
+     */
+    void setEndpoints(const std::string &primary, const std::vector<std::string> &replicas);
+
+    /**
+     * Set for how long a session keeps reading from the primary after a write. Zero disables the pinning.
+     * @param window The duration of the pinning
+     */
+    void setReadYourWritesWindow(std::chrono::milliseconds window);
+
+    /**
+     * Set the statements prepared on each new connection of a user. Connections already open are not affected.
+     * @param user The username of the connections
+     * @param statements The statements to prepare
+     */
+    void setPreparedStatements(const std::string &user, std::vector<PreparedStatement> statements);
+
+    /**
+     * Open the connections of several users to every server in parallel, so that the first requests do not pay for them
+     * @param dbname The name of the database
+     * @param credentials The username and password of each user
+     */
+    void warmUp(const std::string &dbname, const std::vector<std::pair<std::string, std::string>> &credentials);
+
+    /**
+     * Get a connection to a Postgres database on the primary server
      * @param dbname The name of the database
      * @param user The username to use for the connection
      * @param password The password to use for the connection
@@ -31,7 +74,105 @@ public:
      */
     std::shared_ptr<pqxx::connection> getConnection(const std::string &dbname, const std::string &user, const std::string &password);
 
+    /**
+     * Get the libpq connection string of the primary server, for clients that open their own connections
+     * @param dbname The name of the database
+     * @param user The username to use for the connection
+     * @param password The password to use for the connection
+     * @return The connection string
+     */
+    std::string getConnectionInfo(const std::string &dbname, const std::string &user, const std::string &password);
+
+    /**
+     * Get the libpq connection string of the next replica, or of the primary if there is none, for read-only clients that open their own connections
+     * @param dbname The name of the database
+     * @param user The username to use for the connection
+     * @param password The password to use for the connection
+     * @return The connection string
+     */
+    std::string getReadConnectionInfo(const std::string &dbname, const std::string &user, const std::string &password);
+
+    /**
+     * Get a connection for read-only work, to a replica if there is one and the session is not pinned to the primary
+     * @param dbname The name of the database
+     * @param user The username to use for the connection
+     * @param password The password to use for the connection
+     * @param session The session doing the reads, as passed to `markWrite`
+     * @return The connection to the Postgres database
+     * @throws std::runtime_error if neither the replica nor the primary can be reached
+     */
+    std::shared_ptr<pqxx::connection> getReadConnection(const std::string &dbname, const std::string &user, const std::string &password, const std::string &session);
+
+    /**
+     * Record that a session just committed a write, pinning its reads to the primary for the read-your-writes window
+     * @param session The session that wrote
+     */
+    void markWrite(const std::string &session);
+
 private:
-    std::unordered_map<std::string, std::shared_ptr<pqxx::connection>> connections;
+    /**
+     * A cached connection and the state of its reconnection.
+     */
+    struct Slot {
+        std::shared_ptr<pqxx::connection> conn; ///< Null while the server is unreachable.
+        uint32_t failures = 0;                  ///< Consecutive failed attempts to open the connection.
+        std::chrono::steady_clock::time_point retryAt{};
+        bool connecting = false; ///< A thread is opening the connection, outside of the lock.
+    };
+
+    static constexpr std::chrono::milliseconds backoffBase{100};
+    static constexpr std::chrono::milliseconds backoffCap{10000};
+    static constexpr size_t minPinnedSweepSize = 1024;
+    static constexpr std::chrono::seconds connectTimeout{5}; ///< An unreachable server fails fast and is retried with backoff.
+
+    /**
+     * Build the libpq connection string for an endpoint.
+     */
+    static std::string connectionInfo(const std::string &endpoint, const std::string &dbname, const std::string &user, const std::string &password);
+
+    /**
+     * Open a new connection to an endpoint and prepare its statements, without touching the cache.
+     * @throws std::runtime_error if the connection fails
+     */
+    static std::shared_ptr<pqxx::connection> open(const std::string &endpoint,
+                                                  const std::string &dbname,
+                                                  const std::string &user,
+                                                  const std::string &password,
+                                                  const std::vector<PreparedStatement> &statements);
+
+    /**
+     * Check that a cached connection is still usable: open, and without a pending error or EOF from the server.
+     */
+    static bool isHealthy(const pqxx::connection &conn);
+
+    /**
+     * Get the delay before the next attempt to open a connection, after some consecutive failures.
+     */
+    static std::chrono::milliseconds backoff(uint32_t failures);
+
+    /**
+     * Get the cached connection to an endpoint, opening it if needed. The lock is released while the connection is opened.
+     * @param lock the lock held on `mutex`
+     * @param wait whether to wait for another thread already opening the connection, or to fail immediately
+     * @throws std::runtime_error if the connection fails, is backing off, or is being opened and `wait` is false
+     */
+    std::shared_ptr<pqxx::connection> connect(std::unique_lock<std::mutex> &lock,
+                                              const std::string &endpoint,
+                                              const std::string &dbname,
+                                              const std::string &user,
+                                              const std::string &password,
+                                              bool wait = true);
+
+    std::unordered_map<std::string, Slot> connections; ///< Node-based, references to the slots stay valid while the lock is released.
+    std::unordered_map<std::string, std::vector<PreparedStatement>> preparedStatements; ///< Statements prepared on new connections, by user.
     std::mutex mutex;
+    std::condition_variable connected; ///< Notified when a slot is done connecting.
+
+    std::string primary;               ///< `host[:port]` of the primary, empty for the local default.
+    std::vector<std::string> replicas; ///< `host[:port]` of the read replicas.
+    size_t nextReplica = 0;            ///< Round-robin cursor over `replicas`.
+
+    std::chrono::milliseconds readYourWritesWindow{0};
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> pinnedUntil; ///< Sessions reading from the primary, until when.
+    size_t pinnedSweepSize = minPinnedSweepSize; ///< Size of `pinnedUntil` at which its expired entries are erased.
 };
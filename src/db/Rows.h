@@ -0,0 +1,138 @@
+#pragma once
+
+#include "../Utils.h"
+#include <charconv>
+#include <optional>
+#include <pqxx/pqxx>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+template<typename T>
+inline constexpr bool isOptional = false;
+template<typename T>
+inline constexpr bool isOptional<std::optional<T>> = true;
+
+/**
+ * A column of a row struct: the member it is decoded into and the expression selecting it.
+ * @tparam Member pointer to the member of the row struct
+ */
+template<auto Member>
+struct Column {
+    std::string_view expression;
+};
+
+/**
+ * A row of the `products` table.
+ */
+struct ProductRow {
+    uint32_t id;
+    std::string_view name; ///< Points into the result it was decoded from.
+    uint32_t supplierId;
+    uint32_t price;
+    int32_t amount; ///< -1 once the product is removed.
+    std::string_view description;
+
+    static constexpr auto columns = std::tuple{Column<&ProductRow::id>{"id"}, Column<&ProductRow::name>{"name"},
+                                               Column<&ProductRow::supplierId>{"supplier_id"}, Column<&ProductRow::price>{"price"},
+                                               Column<&ProductRow::amount>{"amount"}, Column<&ProductRow::description>{"description"}};
+};
+
+/**
+ * A row of the `orders` table.
+ */
+struct OrderRow {
+    uint32_t id;
+    uint32_t customerId;
+    uint32_t totalPrice;
+    std::optional<uint32_t> transporterId; ///< std::nullopt while the order waits in the transporter pool.
+    std::string_view status; ///< Points into the result it was decoded from, like the other text columns.
+    std::string_view address;
+    std::string_view timestamp;
+
+    static constexpr auto columns = std::tuple{Column<&OrderRow::id>{"id"}, Column<&OrderRow::customerId>{"customer_id"},
+                                               Column<&OrderRow::totalPrice>{"total_price"}, Column<&OrderRow::transporterId>{"transporter_id"},
+                                               Column<&OrderRow::status>{"status"}, Column<&OrderRow::address>{"address"},
+                                               Column<&OrderRow::timestamp>{"timestamp::TEXT"}};
+};
+
+/**
+ * Get the select list of a row struct, its columns in the order they are decoded.
+ * @tparam Row the row struct
+ * @return the comma-separated expressions of the columns
+ */
+template<typename Row>
+const std::string &columnList() {
+    static const std::string list = std::apply([](auto... columns) {
+        std::string joined;
+        ((joined += (joined.empty() ? "" : ", ") + std::string(columns.expression)), ...);
+        return joined;
+    }, Row::columns);
+    return list;
+}
+
+/**
+ * Decode a field in place from the text held by the result, without copying it.
+ * @param field the field to decode
+ * @param value the value to decode into, text types other than std::string point into the result
+ * @throws std::runtime_error if the field is NULL and the value is not an optional, or if it cannot be parsed
+ */
+template<typename T>
+void decodeField(const pqxx::field &field, T &value) {
+    if constexpr (isOptional<T>) {
+        if (field.is_null()) value = std::nullopt;
+        else decodeField(field, value.emplace());
+    } else {
+        if (field.is_null()) throw std::runtime_error(std::format("Unexpected NULL in column {}", field.name()));
+        std::string_view text = field.view();
+
+        if constexpr (std::is_same_v<T, std::string_view>) value = text;
+        else if constexpr (std::is_same_v<T, std::string>) value.assign(text);
+        else if constexpr (std::is_same_v<T, bool>) value = text == "t";
+        else if constexpr (std::is_arithmetic_v<T>) {
+            auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+            if (ec != std::errc() || end != text.data() + text.size()) throw std::runtime_error(std::format("Failed to parse `{}` in column {}", text, field.name()));
+        } else static_assert(sizeof(T) == 0, "Unsupported column type");
+    }
+}
+
+/**
+ * Decode a field into the member of a row struct named by its column.
+ */
+template<typename Row, auto Member>
+void decodeColumn(const pqxx::field &field, Row &row, Column<Member>) {
+    decodeField(field, row.*Member);
+}
+
+/**
+ * Decode a row into a row struct, the columns being selected with `columnList<Row>()`.
+ * @param row the row to decode
+ * @return the decoded row, valid as long as the result it comes from
+ * @throws std::runtime_error if the number of columns does not match, or if a field cannot be decoded
+ */
+template<typename Row>
+Row decodeRow(const pqxx::row &row) {
+    constexpr size_t columnCount = std::tuple_size_v<decltype(Row::columns)>;
+    if (row.size() != static_cast<int>(columnCount)) throw std::runtime_error(std::format("Expected {} columns, got {}", columnCount, row.size()));
+
+    Row decoded{};
+    [&]<size_t... I>(std::index_sequence<I...>) {
+        (decodeColumn(row[static_cast<int>(I)], decoded, std::get<I>(Row::columns)), ...);
+    }(std::make_index_sequence<columnCount>{});
+    return decoded;
+}
+
+/**
+ * Decode every row of a result into row structs.
+ * @param result the result to decode
+ * @return the decoded rows, valid as long as the result
+ * @throws std::runtime_error if a row cannot be decoded
+ */
+template<typename Row>
+std::vector<Row> decodeRows(const pqxx::result &result) {
+    std::vector<Row> rows;
+    rows.reserve(result.size());
+    for (const auto &row: result) rows.push_back(decodeRow<Row>(row));
+    return rows;
+}
@@ -0,0 +1,13 @@
+#include "StatementBatch.h"
+
+size_t StatementBatch::add(std::string_view query) {
+    queries.push_back(pipeline.insert(query));
+    return queries.size() - 1;
+}
+
+void StatementBatch::flush() {
+    // Send everything that is still held back and wait for the server to process it
+    pipeline.complete();
+}
+
+pqxx::result StatementBatch::get(size_t index) { return pipeline.retrieve(queries.at(index)); }
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <pqxx/pqxx>
+#include <string>
+#include <vector>
+
+/**
+ * Queue of independent statements sent to Postgres together through a `pqxx::pipeline`.
+ *
+ * @details Statements are held back until `flush`, which sends all of them at once and waits for the results,
+ * so a batch of N statements costs about one round trip instead of N.
+ * Only queue statements whose text does not depend on the results of the others in the same batch.
+ * The batch must be destroyed before the owning transaction is committed.
+ *
+ * Example:
+ * @code
+ * pqxx::work tx(*conn);
+ * StatementBatch batch(tx);
+ * auto first = batch.add("SELECT 1;");
+ * auto second = batch.add("SELECT 2;");
+ * batch.flush();
+ * auto one = batch.get(first).one_field().as<int>();
+ * @endcode
+ */
+class StatementBatch {
+public:
+    explicit StatementBatch(pqxx::transaction_base &tx) : pipeline(tx) {
+        pipeline.retain(maxRetained); // Do not send anything before `flush`
+    }
+
+    StatementBatch(const StatementBatch &) = delete;
+    StatementBatch &operator=(const StatementBatch &) = delete;
+
+    /**
+     * Queue a statement.
+     * @param query the statement to queue
+     * @return the index to pass to `get` to retrieve the result of the statement
+     */
+    size_t add(std::string_view query);
+
+    /**
+     * Send every queued statement and wait for the server to process all of them.
+     */
+    void flush();
+
+    /**
+     * Get the result of a statement, after `flush`.
+     * @param index the index returned by `add`
+     * @return the result of the statement
+     * @throws pqxx::sql_error if the statement failed, or if it was skipped because an earlier one failed
+     */
+    pqxx::result get(size_t index);
+
+    /**
+     * @return the number of statements added to the batch
+     */
+    [[nodiscard]] size_t size() const { return queries.size(); }
+
+private:
+    static constexpr int maxRetained = 1 << 16;
+
+    pqxx::pipeline pipeline;
+    std::vector<pqxx::pipeline::query_id> queries; ///< Pipeline ids of the queued statements, by index.
+};
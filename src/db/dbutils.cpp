@@ -1,4 +1,8 @@
 #include "dbutils.h"
+#include "../async/PeriodicTask.h"
+#include <filesystem>
+#include <libpq-fe.h>
+#include <zlib.h>
 
 /*
  * // PostgreSQL setup
@@ -16,6 +20,12 @@ std::shared_ptr<pqxx::connection> conn2Postgres(const std::string &dbname, const
     return PostgresConnectionPool::getInstance().getConnection(dbname, user, password);
 }
 
+std::shared_ptr<pqxx::connection> conn2PostgresReadOnly(const std::string &dbname, const std::string &user, const std::string &password, const std::string &session) {
+    return PostgresConnectionPool::getInstance().getReadConnection(dbname, user, password, session);
+}
+
+void markPostgresWrite(const std::string &session) { PostgresConnectionPool::getInstance().markWrite(session); }
+
 bool doesDatabaseExist(std::shared_ptr<pqxx::connection> &conn, const std::string &databaseName) {
     std::string query = std::format("SELECT 1 FROM pg_database WHERE datname = '{}'", databaseName);
     try {
@@ -114,12 +124,12 @@ bool doesTableExist(std::shared_ptr<pqxx::connection> &conn, const std::string &
     }
 }
 
-void createTable(std::shared_ptr<pqxx::connection> &conn, const std::string &tableName, const std::string &columns) {
+void createTable(std::shared_ptr<pqxx::connection> &conn, const std::string &tableName, const std::string &columns, const std::string &options) {
     if (doesTableExist(conn, tableName)) Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("Table `{}` already exists.", tableName));
     else {
         try {
             pqxx::work tx(*conn);
-            tx.exec(std::format("CREATE TABLE {} ({})", tableName, columns));
+            tx.exec(std::format("CREATE TABLE {} ({}) {}", tableName, columns, options));
             tx.commit();
             Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("Table `{}` created", tableName));
         } catch (const std::exception &e) {
@@ -128,21 +138,34 @@ void createTable(std::shared_ptr<pqxx::connection> &conn, const std::string &tab
     }
 }
 
-bool doesFunctionExist(std::shared_ptr<pqxx::connection> &conn, const std::string &functionName, const std::vector<std::string> &argTypes) {
-    std::string query = "SELECT to_regprocedure($1)";
-    std::string functionSignature = functionName + "(";
-
+/**
+ * Get the signature of a function, as accepted by `to_regprocedure`
+ */
+static std::string functionSignature(const std::string &functionName, const std::vector<std::string> &argTypes) {
+    std::string signature = functionName + "(";
     for (size_t i = 0; i < argTypes.size(); ++i) {
-        functionSignature += argTypes[i];
-        if (i < argTypes.size() - 1) functionSignature += ", ";
+        signature += argTypes[i];
+        if (i < argTypes.size() - 1) signature += ", ";
     }
-    functionSignature += ")";
+    return signature + ")";
+}
+
+/**
+ * Get the source of a function
+ * @return the body of the function as stored by Postgres, or std::nullopt if it does not exist
+ * @throws pqxx::failure if the query fails
+ */
+static std::optional<std::string> functionSource(std::shared_ptr<pqxx::connection> &conn, const std::string &signature) {
+    pqxx::work tx(*conn);
+    pqxx::result R = tx.exec_params("SELECT prosrc FROM pg_proc WHERE oid = to_regprocedure($1)", signature);
+    tx.commit();
+    if (R.empty()) return std::nullopt;
+    return R[0][0].as<std::string>();
+}
 
+bool doesFunctionExist(std::shared_ptr<pqxx::connection> &conn, const std::string &functionName, const std::vector<std::string> &argTypes) {
     try {
-        pqxx::work tx(*conn);
-        pqxx::result R = tx.exec_params(query, functionSignature);
-        tx.commit();
-        return !R[0][0].is_null();
+        return functionSource(conn, functionSignature(functionName, argTypes)).has_value();
     } catch (const std::exception &e) {
         Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to check if function exists: {}", e.what()));
         return false;
@@ -157,15 +180,10 @@ void createFunction(std::shared_ptr<pqxx::connection> &conn,
     // Get the argument types as a vector
     std::vector<std::string> argTypes(args.size());
     std::transform(args.begin(), args.end(), argTypes.begin(), [](const auto &arg) { return arg.second; });
-
-    // Check if the function already exists
-    if (doesFunctionExist(conn, functionName, argTypes)) {
-        Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("Function `{}` already exists.", functionName));
-        return;
-    }
+    std::string signature = functionSignature(functionName, argTypes);
 
     // Build the query
-    std::string query = std::format("CREATE OR REPLACE FUNCTION {}(", functionName);
+    std::string query = std::format("CREATE FUNCTION {}(", functionName);
     for (size_t i = 0; i < args.size(); ++i) {
         query += std::format("{} {}", args[i].first, args[i].second);
         if (i < args.size() - 1) query += ", ";
@@ -174,10 +192,20 @@ void createFunction(std::shared_ptr<pqxx::connection> &conn,
 
     // Execute the query
     try {
+        // Skip the function if it is up to date, replace it if its body changed since it was created
+        std::optional<std::string> source = functionSource(conn, signature);
+        if (source == body + "\n") {
+            Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("Function `{}` already exists.", functionName));
+            return;
+        }
+
+        // Dropped rather than replaced, CREATE OR REPLACE cannot change the return type or the argument names.
+        // The grants of `initFunctions` are given again right after.
         pqxx::work tx(*conn);
+        if (source) tx.exec(std::format("DROP FUNCTION {};", signature));
         tx.exec(query);
         tx.commit();
-        Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("Function `{}` created.", functionName));
+        Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("Function `{}` {}.", functionName, source ? "updated" : "created"));
     } catch (const std::exception &e) {
         Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to create function: {}", e.what()));
     }
@@ -278,11 +306,282 @@ void initDatabase() {
     initFunctions(conn);
 }
 
+void warmUpPostgres() {
+    auto &pool = PostgresConnectionPool::getInstance();
+    for (const std::string role: {"customer", "supplier", "transporter"}) {
+        pool.setPreparedStatements(role, {{"get_balance", std::format("SELECT get_balance_{}($1);", role)},
+                                          {"set_balance", std::format("SELECT set_balance_{}($1, $2);", role)}});
+    }
+    pool.warmUp("ecommerce", {{"customer", "customer"}, {"supplier", "supplier"}, {"transporter", "transporter"}});
+}
+
 void initTypes(std::shared_ptr<pqxx::connection> &conn) {
     createType(conn, "user_role", "ENUM ('customer', 'supplier', 'transporter')");
     createType(conn, "order_status", "ENUM ('shipped', 'delivered', 'cancelled')");
 }
 
+// Columns of the partitioned tables, shared by their creation and by the conversion of unpartitioned ones.
+// The partition key must be part of the primary key, so the foreign keys to an order (see `addOrderForeignKeys`)
+// use both its id and its timestamp.
+static const std::string ordersColumns = R"(
+            id INT NOT NULL DEFAULT nextval('orders_id_seq'),
+            customer_id INT NOT NULL,
+            total_price INT NOT NULL,
+            transporter_id INT, -- NULL while the order waits in the transporter pool, see `claim_orders`
+            status order_status NOT NULL,
+            address VARCHAR(255) NOT NULL,
+            timestamp TIMESTAMP NOT NULL,
+            PRIMARY KEY (id, timestamp),
+            FOREIGN KEY (customer_id) REFERENCES customers(id),
+            FOREIGN KEY (transporter_id) REFERENCES transporters(id)
+    )";
+static const std::string orderItemsColumns = R"(
+            id INT NOT NULL DEFAULT nextval('order_items_id_seq'),
+            order_id INT NOT NULL,
+            product_id INT NOT NULL,
+            quantity INT NOT NULL,
+            price INT NOT NULL,
+            supplier_id INT NOT NULL,
+            order_timestamp TIMESTAMP NOT NULL DEFAULT NOW(),
+            PRIMARY KEY (id, order_timestamp),
+            FOREIGN KEY (product_id) REFERENCES products(id),
+            FOREIGN KEY (supplier_id) REFERENCES suppliers(id)
+    )"; ///< `order_timestamp` defaults to the start of the transaction, like the `timestamp` set by `make_order`
+
+// Sales of each supplier per product and day recomputed from the orders, to fill `supplier_sales_daily`.
+// Split around the end of its WHERE clause, so that callers can add their own conditions.
+static const std::string salesFromOrders = R"(
+            SELECT oi.supplier_id, oi.product_id, o.timestamp::date, SUM(oi.quantity), SUM(oi.quantity * oi.price)
+            FROM order_items oi
+            JOIN orders o ON o.id = oi.order_id AND o.timestamp = oi.order_timestamp
+            WHERE o.status != 'cancelled')";
+static const std::string salesFromOrdersGrouping = "GROUP BY oi.supplier_id, oi.product_id, o.timestamp::date";
+
+static constexpr int orderPartitionsAhead = 3; ///< Months after the current one whose order partitions exist in advance.
+
+/**
+ * Create the monthly partitions of `orders` and `order_items` between two months if they do not exist, and their default partitions
+ * @param tx the transaction to create them in
+ * @param since an SQL expression of the first timestamp to cover
+ * @param monthsAhead how many months after the current one to create in advance
+ */
+static void createOrderPartitionsSince(pqxx::transaction_base &tx, const std::string &since, int monthsAhead) {
+    // The default partitions take the rows outside of every month, so that an order is never rejected.
+    // A month whose rows already went to them cannot get its partition, it is reported and left in the default partitions.
+    tx.exec(std::format(R"(
+    DO $$
+    DECLARE
+        month DATE;
+    BEGIN
+        CREATE TABLE IF NOT EXISTS orders_default PARTITION OF orders DEFAULT;
+        CREATE TABLE IF NOT EXISTS order_items_default PARTITION OF order_items DEFAULT;
+        FOR month IN SELECT generate_series(date_trunc('month', COALESCE({}, NOW())), date_trunc('month', NOW()) + interval '{} months', interval '1 month')::date LOOP
+            BEGIN
+                EXECUTE format('CREATE TABLE IF NOT EXISTS %I PARTITION OF orders FOR VALUES FROM (%L) TO (%L)',
+                               'orders_p' || to_char(month, 'YYYYMM'), month, month + interval '1 month');
+                EXECUTE format('CREATE TABLE IF NOT EXISTS %I PARTITION OF order_items FOR VALUES FROM (%L) TO (%L)',
+                               'order_items_p' || to_char(month, 'YYYYMM'), month, month + interval '1 month');
+            EXCEPTION WHEN check_violation THEN
+                RAISE WARNING 'Orders of % are in the default partitions, their monthly partitions cannot be created', to_char(month, 'YYYY-MM');
+            END;
+        END LOOP;
+    END $$;)", since, monthsAhead));
+}
+
+void createOrderPartitions(std::shared_ptr<pqxx::connection> &conn, int monthsAhead) {
+    try {
+        pqxx::work tx(*conn);
+        createOrderPartitionsSince(tx, "NOW()", monthsAhead);
+        tx.commit();
+        Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("Order partitions created up to {} months ahead.", monthsAhead));
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to create order partitions: {}", e.what()));
+    }
+}
+
+void startOrderPartitionMaintenance() {
+    // Daily, so that the partitions of the coming months exist long before their first order
+    static PeriodicTask task("order partitions", std::chrono::hours(24), [] {
+        auto conn = conn2Postgres("ecommerce", "ecommerce", "ecommerce");
+        createOrderPartitions(conn, orderPartitionsAhead);
+    });
+}
+
+/**
+ * Add the foreign keys of `order_items` and `supplier_orders` to `orders`, if they do not exist
+ * @param tx the transaction to add them in
+ */
+static void addOrderForeignKeys(pqxx::transaction_base &tx) {
+    tx.exec(R"(
+    DO $$
+    BEGIN
+        IF NOT EXISTS (SELECT 1 FROM pg_constraint WHERE conname = 'order_items_order_fkey' AND conrelid = 'order_items'::regclass) THEN
+            ALTER TABLE order_items ADD CONSTRAINT order_items_order_fkey FOREIGN KEY (order_id, order_timestamp) REFERENCES orders (id, timestamp);
+        END IF;
+        IF to_regclass('supplier_orders') IS NOT NULL THEN -- Not created yet while converting an older database
+            IF NOT EXISTS (SELECT 1 FROM pg_constraint WHERE conname = 'supplier_orders_order_fkey' AND conrelid = 'supplier_orders'::regclass) THEN
+                ALTER TABLE supplier_orders ADD CONSTRAINT supplier_orders_order_fkey FOREIGN KEY (order_id, timestamp) REFERENCES orders (id, timestamp);
+            END IF;
+        END IF;
+    END $$;)");
+}
+
+void partitionOrderTables(std::shared_ptr<pqxx::connection> &conn) {
+    try {
+        pqxx::work tx(*conn);
+
+        // Nothing to do on a new database, or if the tables are already partitioned
+        auto kind = tx.query01<std::string>("SELECT relkind::text FROM pg_class WHERE oid = to_regclass('orders');");
+        if (!kind || std::get<0>(kind.value()) != "r") return;
+
+        Utils::log(Utils::LogLevel::DEBUG, std::cout, "Converting `orders` and `order_items` to partitioned tables...");
+
+        // Keep the id sequences, the copied rows keep their ids
+        tx.exec("ALTER TABLE orders RENAME TO orders_unpartitioned;");
+        tx.exec("ALTER TABLE order_items RENAME TO order_items_unpartitioned;");
+        tx.exec("ALTER TABLE orders_unpartitioned RENAME CONSTRAINT orders_pkey TO orders_unpartitioned_pkey;"); // Index names are schema-wide
+        tx.exec("ALTER TABLE order_items_unpartitioned RENAME CONSTRAINT order_items_pkey TO order_items_unpartitioned_pkey;");
+        tx.exec("ALTER SEQUENCE orders_id_seq OWNED BY NONE;");
+        tx.exec("ALTER SEQUENCE order_items_id_seq OWNED BY NONE;");
+
+        tx.exec(std::format("CREATE TABLE orders ({}) PARTITION BY RANGE (timestamp);", ordersColumns));
+        tx.exec(std::format("CREATE TABLE order_items ({}) PARTITION BY RANGE (order_timestamp);", orderItemsColumns));
+        createOrderPartitionsSince(tx, "(SELECT MIN(timestamp) FROM orders_unpartitioned)", orderPartitionsAhead);
+
+        // Every item must keep its order, the conversion stops rather than dropping any
+        auto [orphans] = tx.query1<long long>(R"(
+            SELECT COUNT(*) FROM order_items_unpartitioned oi
+            WHERE NOT EXISTS (SELECT 1 FROM orders_unpartitioned o WHERE o.id = oi.order_id);)");
+        if (orphans > 0) throw std::runtime_error(std::format("{} order items refer to no order", orphans));
+
+        tx.exec(R"(
+            INSERT INTO orders (id, customer_id, total_price, transporter_id, status, address, timestamp)
+            SELECT id, customer_id, total_price, transporter_id, status, address, timestamp FROM orders_unpartitioned;)");
+        tx.exec(R"(
+            INSERT INTO order_items (id, order_id, product_id, quantity, price, supplier_id, order_timestamp)
+            SELECT oi.id, oi.order_id, oi.product_id, oi.quantity, oi.price, oi.supplier_id, o.timestamp
+            FROM order_items_unpartitioned oi
+            JOIN orders_unpartitioned o ON o.id = oi.order_id;)");
+
+        // The foreign key of `supplier_orders` moves to the new table, any other dependency on the old tables makes the drop fail
+        tx.exec("ALTER TABLE IF EXISTS supplier_orders DROP CONSTRAINT IF EXISTS supplier_orders_order_id_fkey;");
+        tx.exec("DROP TABLE order_items_unpartitioned, orders_unpartitioned;");
+        addOrderForeignKeys(tx);
+        tx.commit();
+
+        Utils::log(Utils::LogLevel::DEBUG, std::cout, "`orders` and `order_items` converted to partitioned tables.");
+    } catch (const std::exception &e) {
+        // Running on half-converted tables would lose orders, nothing was changed
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to partition the order tables, the database is left unchanged: {}", e.what()));
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Export a table as a gzip-compressed CSV file, with a header line
+ * @param table the name of the table to export
+ * @param path the path of the file to write, replaced only once the export is complete
+ * @throws std::runtime_error if the export fails
+ */
+static void exportTableToGzip(const std::string &table, const std::filesystem::path &path) {
+    // COPY streams the table without materializing it, neither in the server nor here
+    std::unique_ptr<PGconn, decltype(&PQfinish)> raw(PQconnectdb(PostgresConnectionPool::getInstance().getConnectionInfo("ecommerce", "ecommerce", "ecommerce").c_str()), &PQfinish);
+    if (PQstatus(raw.get()) != CONNECTION_OK) throw std::runtime_error(PQerrorMessage(raw.get()));
+
+    std::unique_ptr<PGresult, decltype(&PQclear)> start(PQexec(raw.get(), std::format("COPY {} TO STDOUT (FORMAT csv, HEADER)", table).c_str()), &PQclear);
+    if (PQresultStatus(start.get()) != PGRES_COPY_OUT) throw std::runtime_error(PQerrorMessage(raw.get()));
+
+    std::filesystem::path partialPath = path;
+    partialPath += ".partial";
+    gzFile file = gzopen(partialPath.c_str(), "wb6");
+    if (!file) throw std::runtime_error(std::format("Cannot open `{}`", partialPath.string()));
+
+    char *buffer = nullptr;
+    int length;
+    bool written = true;
+    while ((length = PQgetCopyData(raw.get(), &buffer, 0)) > 0) {
+        written = written && gzwrite(file, buffer, static_cast<unsigned>(length)) == length;
+        PQfreemem(buffer);
+    }
+    written = gzclose(file) == Z_OK && written;
+
+    std::unique_ptr<PGresult, decltype(&PQclear)> end(PQgetResult(raw.get()), &PQclear);
+    if (length == -2 || PQresultStatus(end.get()) != PGRES_COMMAND_OK || !written) {
+        std::filesystem::remove(partialPath);
+        throw std::runtime_error(std::format("Failed to export `{}`: {}", table, written ? PQerrorMessage(raw.get()) : "write error"));
+    }
+    std::filesystem::rename(partialPath, path);
+}
+
+void archiveOrderPartitions(uint32_t keepMonths, const std::string &directory) {
+    try {
+        auto conn = conn2Postgres("ecommerce", "ecommerce", "ecommerce");
+        std::filesystem::create_directories(directory);
+
+        // Step 1: detach the partitions of the months that ended more than `keepMonths` ago, one month per transaction
+        std::vector<std::string> months;
+        {
+            pqxx::work tx(*conn);
+            for (auto [month]: tx.query<std::string>(std::format(R"(
+                    SELECT substring(c.relname FROM 'orders_p(\d{{6}})')
+                    FROM pg_inherits i
+                    JOIN pg_class c ON c.oid = i.inhrelid
+                    WHERE i.inhparent = 'orders'::regclass
+                      AND to_date(substring(c.relname FROM 'orders_p(\d{{6}})'), 'YYYYMM') < date_trunc('month', NOW()) - interval '{} months'
+                    ORDER BY 1;
+            )", keepMonths))) {
+                months.push_back(std::move(month));
+            }
+            tx.commit();
+        }
+        for (const auto &month: months) {
+            // The supplier view of the archived orders goes with them, then the items are detached before their orders,
+            // without their foreign key, so that nothing refers to the orders partition any more
+            pqxx::work tx(*conn);
+            tx.exec(std::format("DELETE FROM supplier_orders WHERE timestamp >= to_date('{0}', 'YYYYMM') AND timestamp < to_date('{0}', 'YYYYMM') + interval '1 month';", month));
+            tx.exec(std::format("ALTER TABLE order_items DETACH PARTITION order_items_p{};", month));
+            tx.exec(std::format(R"(
+                DO $$
+                DECLARE
+                    fkey TEXT;
+                BEGIN
+                    FOR fkey IN SELECT conname FROM pg_constraint WHERE conrelid = 'order_items_p{}'::regclass AND contype = 'f' AND confrelid = 'orders'::regclass LOOP
+                        EXECUTE format('ALTER TABLE order_items_p{} DROP CONSTRAINT %I', fkey);
+                    END LOOP;
+                END $$;)", month, month));
+            tx.exec(std::format("ALTER TABLE orders DETACH PARTITION orders_p{};", month));
+            tx.commit();
+        }
+
+        // Step 2: export and drop every detached partition, including those left over by an earlier failed run
+        std::vector<std::string> detached;
+        {
+            pqxx::work tx(*conn);
+            for (auto [table]: tx.query<std::string>(R"(
+                    SELECT relname FROM pg_class
+                    WHERE relkind = 'r' AND NOT relispartition AND relname ~ '^(orders|order_items)_p\d{6}$'
+                    ORDER BY 1;
+            )")) {
+                detached.push_back(std::move(table));
+            }
+            tx.commit();
+        }
+
+        for (const auto &table: detached) {
+            try {
+                exportTableToGzip(table, std::filesystem::path(directory) / std::format("{}.csv.gz", table));
+                execCommand(conn, std::format("DROP TABLE {};", table));
+                Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("Partition `{}` archived.", table));
+            } catch (const std::exception &e) {
+                // The partition stays detached, it is exported on the next run
+                Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to archive partition `{}`: {}", table, e.what()));
+            }
+        }
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to archive order partitions: {}", e.what()));
+    }
+}
+
 void initTables(std::shared_ptr<pqxx::connection> &conn) {
     // Seen only by the admins
     createTable(conn, "customers", "id SERIAL PRIMARY KEY, username VARCHAR(255) UNIQUE NOT NULL, balance INT NOT NULL, logged_in BOOL NOT NULL DEFAULT FALSE");
@@ -300,136 +599,215 @@ void initTables(std::shared_ptr<pqxx::connection> &conn) {
             description VARCHAR(255) NOT NULL,
             FOREIGN KEY (supplier_id) REFERENCES suppliers(id)
     )"); ///< Products offered by suppliers
-    createTable(conn, "orders", R"(
-            id SERIAL PRIMARY KEY,
-            customer_id INT NOT NULL,
-            total_price INT NOT NULL,
-            transporter_id INT NOT NULL,
+    // Orders and their items are partitioned by month (see `createOrderPartitions`), existing tables are converted first
+    partitionOrderTables(conn);
+    execCommand(conn, "CREATE SEQUENCE IF NOT EXISTS orders_id_seq");
+    execCommand(conn, "CREATE SEQUENCE IF NOT EXISTS order_items_id_seq");
+    createTable(conn, "orders", ordersColumns, "PARTITION BY RANGE (timestamp)"); ///< Orders placed by customers
+    createTable(conn, "order_items", orderItemsColumns, "PARTITION BY RANGE (order_timestamp)"); ///< Products listed in an order
+    createOrderPartitions(conn, orderPartitionsAhead);
+    execCommand(conn, "ALTER TABLE orders ALTER COLUMN transporter_id DROP NOT NULL"); ///< Older databases assigned every order at creation
+
+    createTable(conn, "supplier_orders", R"(
+            supplier_id INT NOT NULL,
+            order_id INT NOT NULL,
             status order_status NOT NULL,
-            address VARCHAR(255) NOT NULL,
+            total_price INT NOT NULL,
             timestamp TIMESTAMP NOT NULL,
-            FOREIGN KEY (customer_id) REFERENCES customers(id),
-            FOREIGN KEY (transporter_id) REFERENCES transporters(id)
-    )"); ///< Orders placed by customers
-    createTable(conn, "order_items", R"(
-            id SERIAL PRIMARY KEY,
+            PRIMARY KEY (supplier_id, order_id),
+            FOREIGN KEY (supplier_id) REFERENCES suppliers(id)
+    )"); ///< Orders as seen by each supplier, maintained by `add_order_item` and `set_order_status`
+    try {
+        pqxx::work tx(*conn);
+        addOrderForeignKeys(tx);
+        tx.commit();
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to add the foreign keys to `orders`: {}", e.what()));
+    }
+
+    createTable(conn, "inventory_reservations", R"(
+            id BIGSERIAL PRIMARY KEY,
             order_id INT NOT NULL,
             product_id INT NOT NULL,
-            quantity INT NOT NULL,
-            price INT NOT NULL,
+            quantity INT NOT NULL
+    )"); ///< Stock of hot products taken by committed orders, applied to `products` in batches by InventoryReservations
+
+    createTable(conn, "supplier_balance_ledger", R"(
+            id BIGSERIAL PRIMARY KEY,
             supplier_id INT NOT NULL,
-            FOREIGN KEY (order_id) REFERENCES orders(id),
-            FOREIGN KEY (product_id) REFERENCES products(id),
+            amount INT NOT NULL,
+            timestamp TIMESTAMP NOT NULL DEFAULT NOW(),
             FOREIGN KEY (supplier_id) REFERENCES suppliers(id)
-    )"); ///< Products listed in an order
+    )"); ///< Payments to suppliers not yet added to their `balance`, applied in batches by BalanceLedger
+
+    createTable(conn, "supplier_sales_daily", R"(
+            supplier_id INT NOT NULL,
+            product_id INT NOT NULL,
+            day DATE NOT NULL,
+            quantity BIGINT NOT NULL,
+            revenue BIGINT NOT NULL,
+            PRIMARY KEY (supplier_id, day, product_id)
+    )"); ///< Sales of each product per day, maintained by `add_order_item` and `set_order_status` for `Supplier::getSalesReport`
+
+    // Backfill the supplier read model from existing orders, only runs while it is still empty
+    execCommand(conn, R"(
+            INSERT INTO supplier_orders (supplier_id, order_id, status, total_price, timestamp)
+            SELECT oi.supplier_id, o.id, o.status, SUM(oi.quantity * oi.price), o.timestamp
+            FROM orders o
+            JOIN order_items oi ON o.id = oi.order_id AND o.timestamp = oi.order_timestamp
+            WHERE NOT EXISTS (SELECT 1 FROM supplier_orders)
+            GROUP BY oi.supplier_id, o.id, o.timestamp, o.status
+    )");
+    execCommand(conn, std::format("INSERT INTO supplier_sales_daily {} AND NOT EXISTS (SELECT 1 FROM supplier_sales_daily) {}", salesFromOrders, salesFromOrdersGrouping));
+
+    // Indexes
+    execCommand(conn, "CREATE INDEX IF NOT EXISTS orders_shipped_transporter_idx ON orders (transporter_id) WHERE status = 'shipped'"); ///< Backlog of each transporter
+    execCommand(conn, "CREATE INDEX IF NOT EXISTS orders_pending_idx ON orders (timestamp) WHERE status = 'shipped' AND transporter_id IS NULL"); ///< Orders waiting to be claimed, oldest first
+    execCommand(conn, "CREATE INDEX IF NOT EXISTS supplier_orders_order_idx ON supplier_orders (order_id)"); ///< Status propagation from `set_order_status`
+    execCommand(conn, "CREATE INDEX IF NOT EXISTS orders_customer_idx ON orders (customer_id, timestamp)"); ///< Customer history, in every partition
+    execCommand(conn, "CREATE INDEX IF NOT EXISTS order_items_order_idx ON order_items (order_id)"); ///< Items of an order, in every partition
+    execCommand(conn, "CREATE INDEX IF NOT EXISTS supplier_balance_ledger_supplier_idx ON supplier_balance_ledger (supplier_id)"); ///< Pending payments of a supplier
 
     // Grant permissions
     execCommand(conn, "GRANT SELECT ON products TO customer, supplier");
     execCommand(conn, "GRANT SELECT ON orders TO customer, supplier, transporter");
     execCommand(conn, "GRANT SELECT ON order_items TO supplier, transporter");
+    execCommand(conn, "GRANT SELECT ON supplier_orders TO supplier");
+    execCommand(conn, "GRANT SELECT ON supplier_sales_daily TO supplier");
 }
 
 void initFunctions(std::shared_ptr<pqxx::connection> &conn) {
-    createFunction(conn, "get_target_table", {{"user_type", "user_role"}}, "VARCHAR(255)", R"(
-    DECLARE
-        target_table VARCHAR(255);
-    BEGIN
-        -- Determine the target table based on user type
-        CASE user_type
-            WHEN 'customer' THEN
-                target_table := 'customers';
-            WHEN 'supplier' THEN
-                target_table := 'suppliers';
-            WHEN 'transporter' THEN
-                target_table := 'transporters';
-            ELSE
-                RAISE EXCEPTION 'Invalid user type';
-        END CASE;
+    static const std::vector<std::pair<std::string, std::string>> userRoleTables{{"customer", "customers"}, {"supplier", "suppliers"}, {"transporter", "transporters"}};
 
-        RETURN target_table;
-    END;)"); ///< Determine the target table based on user type
-    createFunction(conn, "check_user", {{"user_type", "user_role"}, {"username", "VARCHAR"}}, "TABLE(id INT, balance INT, logged_in BOOL)", R"(
+    // Static variants of the user functions for each role, so that PL/pgSQL plans their queries once per session
+    // instead of re-planning a dynamic `EXECUTE format(...)` on every call
+    for (const auto &[role, table]: userRoleTables) {
+        // The balance of a supplier is its `balance` column plus the payments still in the ledger
+        std::string balance = role == "supplier" ? "u.balance + COALESCE((SELECT SUM(l.amount) FROM supplier_balance_ledger l WHERE l.supplier_id = u.id), 0)" : "u.balance";
+
+        createFunction(conn, std::format("check_user_{}", role), {{"username", "VARCHAR"}}, "TABLE(id INT, balance INT, logged_in BOOL)", std::format(R"(
     BEGIN
-        -- Check if the user exists
-        RETURN QUERY EXECUTE format('SELECT id, balance, logged_in FROM %I WHERE username = $1', get_target_table(user_type))
-        USING username;
-    END;)"); ///< Check if the user exists
-    createFunction(conn, "insert_user", {{"user_type", "user_role"}, {"username", "VARCHAR"}}, "INT", R"(
+        -- Check if the user exists, columns are qualified since they share their names with the output columns
+        RETURN QUERY SELECT u.id, ({1})::INT, u.logged_in FROM {0} u WHERE u.username = $1;
+    END;)", table, balance)); ///< Check if the user exists
+        createFunction(conn, std::format("insert_user_{}", role), {{"username", "VARCHAR"}}, "INT", std::format(R"(
     DECLARE
         new_id INT;
     BEGIN
-        -- Insert a new user into the appropriate table
-        EXECUTE format('INSERT INTO %I (username, balance, logged_in) VALUES ($1, 0, true) RETURNING id', get_target_table(user_type))
-        INTO new_id
-        USING username;
-
+        -- Insert a new user, sessions are kept in Redis so logged_in keeps its default
+        INSERT INTO {} (username, balance) VALUES ($1, 0) RETURNING id INTO new_id;
         RETURN new_id;
-    END;)"); ///< Insert a new user into the appropriate table
-    createFunction(conn, "set_logged_in", {{"user_type", "user_role"}, {"user_id", "INT"}, {"is_logged_in", "BOOL"}}, "VOID", R"(
+    END;)", table)); ///< Insert a new user
+        createFunction(conn, std::format("get_balance_{}", role), {{"user_id", "INT"}}, "INT", std::format(R"(
     BEGIN
-        -- Update the logged_in field in the appropriate table
-        EXECUTE format('UPDATE %I SET logged_in = $1 WHERE id = $2', get_target_table(user_type))
-        USING is_logged_in, user_id;
-    END;)"); ///< Update the logged_in field in the appropriate table
-    createFunction(conn, "get_balance", {{"user_type", "user_role"}, {"user_id", "INT"}}, "INT", R"(
-    DECLARE
-        balance INT;
-    BEGIN
-        -- Retrieve the balance from the appropriate table
-        EXECUTE format('SELECT balance FROM %I WHERE id = $1', get_target_table(user_type))
-        INTO balance
-        USING user_id;
-
-        RETURN balance;
-    END;)"); ///< Retrieve the balance from the appropriate table
-    createFunction(conn, "set_balance", {{"user_type", "user_role"}, {"user_id", "INT"}, {"amount", "INT"}}, "INT", R"(
+        RETURN (SELECT {1} FROM {0} u WHERE u.id = $1);
+    END;)", table, balance)); ///< Retrieve the balance of a user
+        // A supplier row is locked before its ledger is read. In a single statement, a row just updated by `BalanceLedger`
+        // would be rechecked with the moved payments in its balance while the ledger is still read from the statement
+        // snapshot, counting them twice. Each statement of the function takes a new snapshot, so once the row is locked,
+        // the next one sees the ledger as left by the last aggregation.
+        std::string setBalance = role == "supplier" ? std::format(R"(
     DECLARE
         new_balance INT;
-        operation CHAR;
     BEGIN
-        -- Determine the operation based on the sign of the amount
-        IF amount > 0 THEN
-            operation := '+';
-        ELSIF amount < 0 THEN
-            operation := '-';
-        ELSE
-            -- If amount is zero, return the current balance
-            EXECUTE format('SELECT balance FROM %I WHERE id = $2', get_target_table(user_type))
-            INTO new_balance
-            USING user_id;
-            RETURN new_balance;
+        PERFORM 1 FROM {0} u WHERE u.id = $1 FOR UPDATE;
+        IF NOT FOUND THEN
+            RAISE EXCEPTION 'User % does not exist', $1;
         END IF;
 
-        -- Calculate the new balance
-        EXECUTE format('SELECT balance %s $1 FROM %I WHERE id = $2', operation, get_target_table(user_type))
-        INTO new_balance
-        USING ABS(amount), user_id;  -- Use the absolute value of amount
-
-        -- Check if the new balance would be negative
+        SELECT {1} + $2 INTO new_balance FROM {0} u WHERE u.id = $1;
         IF new_balance < 0 THEN
             RAISE EXCEPTION 'New balance would be negative';
         END IF;
 
-        -- Update the balance in the appropriate table and retrieve the new balance
-        EXECUTE format('UPDATE %I SET balance = balance %s $1 WHERE id = $2 RETURNING balance', get_target_table(user_type), operation)
-        INTO new_balance
-        USING ABS(amount), user_id;  -- Use the absolute value of amount
+        UPDATE {0} u SET balance = u.balance + $2 WHERE u.id = $1;
+        RETURN new_balance;
+    END;)", table, balance) : std::format(R"(
+    DECLARE
+        new_balance INT;
+    BEGIN
+        -- Check and update the balance in a single statement, the row is only locked once
+        UPDATE {0} u SET balance = u.balance + $2 WHERE u.id = $1 AND {1} + $2 >= 0 RETURNING {1} INTO new_balance;
+
+        IF NOT FOUND THEN
+            IF NOT EXISTS (SELECT 1 FROM {0} u WHERE u.id = $1) THEN
+                RAISE EXCEPTION 'User % does not exist', $1;
+            END IF;
+            RAISE EXCEPTION 'New balance would be negative';
+        END IF;
 
         RETURN new_balance;
+    END;)", table, balance);
+        createFunction(conn, std::format("set_balance_{}", role), {{"user_id", "INT"}, {"amount", "INT"}}, "INT", setBalance); ///< Update the balance of a user and retrieve the new balance
+    }
+
+    // Role-generic versions, dispatching to the static variants. The application calls the variants directly.
+    createFunction(conn, "check_user", {{"user_type", "user_role"}, {"username", "VARCHAR"}}, "TABLE(id INT, balance INT, logged_in BOOL)", R"(
+    BEGIN
+        CASE user_type
+            WHEN 'customer' THEN RETURN QUERY SELECT * FROM check_user_customer($2);
+            WHEN 'supplier' THEN RETURN QUERY SELECT * FROM check_user_supplier($2);
+            WHEN 'transporter' THEN RETURN QUERY SELECT * FROM check_user_transporter($2);
+        END CASE;
+    END;)"); ///< Check if the user exists
+    createFunction(conn, "insert_user", {{"user_type", "user_role"}, {"username", "VARCHAR"}}, "INT", R"(
+    BEGIN
+        CASE user_type
+            WHEN 'customer' THEN RETURN insert_user_customer($2);
+            WHEN 'supplier' THEN RETURN insert_user_supplier($2);
+            WHEN 'transporter' THEN RETURN insert_user_transporter($2);
+        END CASE;
+    END;)"); ///< Insert a new user into the appropriate table
+    createFunction(conn, "set_logged_in", {{"user_type", "user_role"}, {"user_id", "INT"}, {"is_logged_in", "BOOL"}}, "VOID", R"(
+    BEGIN
+        -- Update the logged_in field in the appropriate table. Not used by the application anymore, sessions live in Redis.
+        CASE user_type
+            WHEN 'customer' THEN UPDATE customers SET logged_in = $3 WHERE id = $2;
+            WHEN 'supplier' THEN UPDATE suppliers SET logged_in = $3 WHERE id = $2;
+            WHEN 'transporter' THEN UPDATE transporters SET logged_in = $3 WHERE id = $2;
+        END CASE;
+    END;)"); ///< Update the logged_in field in the appropriate table
+    createFunction(conn, "get_balance", {{"user_type", "user_role"}, {"user_id", "INT"}}, "INT", R"(
+    BEGIN
+        CASE user_type
+            WHEN 'customer' THEN RETURN get_balance_customer($2);
+            WHEN 'supplier' THEN RETURN get_balance_supplier($2);
+            WHEN 'transporter' THEN RETURN get_balance_transporter($2);
+        END CASE;
+    END;)"); ///< Retrieve the balance from the appropriate table
+    createFunction(conn, "set_balance", {{"user_type", "user_role"}, {"user_id", "INT"}, {"amount", "INT"}}, "INT", R"(
+    BEGIN
+        CASE user_type
+            WHEN 'customer' THEN RETURN set_balance_customer($2, $3);
+            WHEN 'supplier' THEN RETURN set_balance_supplier($2, $3);
+            WHEN 'transporter' THEN RETURN set_balance_transporter($2, $3);
+        END CASE;
     END;)"); ///< Update the balance in the appropriate table and retrieve the new balance
 
     // Customers
-    createFunction(conn, "make_order", {{"customer_id", "INT"}, {"total_price", "INT"}, {"address", "VARCHAR(255)"}}, "INT", R"(
+    execCommand(conn, "DROP FUNCTION IF EXISTS make_order(INT, INT, VARCHAR);"); ///< Replaced by the overload taking the transporter chosen by the dispatcher
+    createFunction(conn, "make_order", {{"customer_id", "INT"}, {"total_price", "INT"}, {"address", "VARCHAR(255)"}, {"transporter_id", "INT"}}, "INT", R"(
     DECLARE
         new_order_id INT;
     BEGIN
-        -- Insert a new order into the orders table and return its id
+        -- Insert a new order into the orders table and return its id, the transporter is chosen by the dispatcher
         INSERT INTO orders (customer_id, total_price, transporter_id, status, address, timestamp)
-        VALUES ($1, $2, (SELECT id FROM transporters ORDER BY RANDOM() LIMIT 1), 'shipped', $3, NOW())
+        VALUES ($1, $2, $4, 'shipped', $3, NOW())
         RETURNING id INTO new_order_id;
 
         RETURN new_order_id;
     END;)"); ///< Make an order from the products in the cart
+    createFunction(conn, "make_pooled_order", {{"customer_id", "INT"}, {"total_price", "INT"}, {"address", "VARCHAR(255)"}}, "INT", R"(
+    DECLARE
+        new_order_id INT;
+    BEGIN
+        -- Insert a new order without a transporter, one of them claims it later with `claim_orders`
+        INSERT INTO orders (customer_id, total_price, transporter_id, status, address, timestamp)
+        VALUES ($1, $2, NULL, 'shipped', $3, NOW())
+        RETURNING id INTO new_order_id;
+
+        RETURN new_order_id;
+    END;)"); ///< Make an order left in the transporter pool
     createFunction(conn, "add_order_item", {{"order_id", "INT"}, {"product_id", "INT"}, {"quantity", "INT"}, {"price", "INT"}, {"supplier_id", "INT"}}, "VOID", R"(
     BEGIN
         -- Insert a new product into the order_items table
@@ -440,7 +818,46 @@ void initFunctions(std::shared_ptr<pqxx::connection> &conn) {
         UPDATE products
         SET amount = amount - $3
         WHERE id = $2;
+
+        -- Add the item to the supplier's view of the order
+        INSERT INTO supplier_orders (supplier_id, order_id, status, total_price, timestamp)
+        SELECT $5, o.id, o.status, $3 * $4, o.timestamp FROM orders o WHERE o.id = $1
+        ON CONFLICT ON CONSTRAINT supplier_orders_pkey
+        DO UPDATE SET total_price = supplier_orders.total_price + EXCLUDED.total_price;
+
+        -- Add the item to the sales of the supplier on the day of the order
+        INSERT INTO supplier_sales_daily (supplier_id, product_id, day, quantity, revenue)
+        VALUES ($5, $2, NOW()::date, $3, $3 * $4)
+        ON CONFLICT ON CONSTRAINT supplier_sales_daily_pkey
+        DO UPDATE SET quantity = supplier_sales_daily.quantity + EXCLUDED.quantity, revenue = supplier_sales_daily.revenue + EXCLUDED.revenue;
     END;)"); ///< Add a product to the order_items table
+    createFunction(conn, "add_reserved_order_item", {{"order_id", "INT"}, {"product_id", "INT"}, {"quantity", "INT"}, {"price", "INT"}, {"supplier_id", "INT"}}, "VOID", R"(
+    BEGIN
+        -- Insert a new product into the order_items table
+        INSERT INTO order_items (order_id, product_id, quantity, price, supplier_id)
+        VALUES ($1, $2, $3, $4, $5);
+
+        -- The stock was already reserved in Redis, log it instead of locking the product row
+        INSERT INTO inventory_reservations (order_id, product_id, quantity)
+        VALUES ($1, $2, $3);
+
+        -- Add the item to the supplier's view of the order
+        INSERT INTO supplier_orders (supplier_id, order_id, status, total_price, timestamp)
+        SELECT $5, o.id, o.status, $3 * $4, o.timestamp FROM orders o WHERE o.id = $1
+        ON CONFLICT ON CONSTRAINT supplier_orders_pkey
+        DO UPDATE SET total_price = supplier_orders.total_price + EXCLUDED.total_price;
+
+        -- Add the item to the sales of the supplier on the day of the order
+        INSERT INTO supplier_sales_daily (supplier_id, product_id, day, quantity, revenue)
+        VALUES ($5, $2, NOW()::date, $3, $3 * $4)
+        ON CONFLICT ON CONSTRAINT supplier_sales_daily_pkey
+        DO UPDATE SET quantity = supplier_sales_daily.quantity + EXCLUDED.quantity, revenue = supplier_sales_daily.revenue + EXCLUDED.revenue;
+    END;)"); ///< Add a hot product, whose stock is reserved in Redis, to the order_items table
+    createFunction(conn, "pay_supplier", {{"supplier_id", "INT"}, {"amount", "INT"}}, "VOID", R"(
+    BEGIN
+        -- Append to the ledger instead of updating the supplier row, so that concurrent orders do not wait on each other
+        INSERT INTO supplier_balance_ledger (supplier_id, amount) VALUES ($1, $2);
+    END;)"); ///< Pay a supplier for the items of an order
 
 
     // Suppliers
@@ -474,16 +891,16 @@ void initFunctions(std::shared_ptr<pqxx::connection> &conn) {
         RETURN removed_id;
     END;)"); ///< Remove a product from the supplier's catalog
     createFunction(conn, "edit_product", {{"product_id", "INT"}, {"new_name", "VARCHAR(255)"}, {"new_price", "INT"}, {"new_amount", "INT"}, {"new_description", "VARCHAR(255)"}},
-                   "INT", R"(
-    DECLARE
-        edited_id INT;
+                   "TABLE(edited_id INT, previous_amount INT)", R"(
     BEGIN
-        -- Check if the product exists
-        SELECT id INTO edited_id FROM products WHERE id = $1;
+        -- Lock the product, its previous amount tells how much the stock of a hot product changed (see `InventoryReservations::adjust`)
+        SELECT p.amount INTO previous_amount FROM products p WHERE p.id = $1 FOR UPDATE;
 
         -- If the product does not exist, return 0
-        IF edited_id IS NULL THEN
-            RETURN 0;
+        IF NOT FOUND THEN
+            edited_id := 0;
+            RETURN NEXT;
+            RETURN;
         END IF;
 
         -- Update the product in the products table and return its id
@@ -492,10 +909,10 @@ void initFunctions(std::shared_ptr<pqxx::connection> &conn) {
             price = COALESCE(new_price, products.price),
             amount = COALESCE(new_amount, products.amount),
             description = COALESCE(new_description, products.description)
-        WHERE id = product_id
-        RETURNING id INTO edited_id;
+        WHERE id = $1;
 
-        RETURN edited_id;
+        edited_id := $1;
+        RETURN NEXT;
     END;)"); ///< Edit a product from the supplier's catalog
 
     // Transporters
@@ -507,15 +924,38 @@ void initFunctions(std::shared_ptr<pqxx::connection> &conn) {
         JOIN customers c ON o.customer_id = c.id
         WHERE o.transporter_id = $1 AND o.status = 'shipped';
     END;)"); ///< Get the ongoing orders
+    createFunction(conn, "claim_orders", {{"transporter_id", "INT"}, {"max_orders", "INT"}}, "TABLE(order_id INT, customer_username VARCHAR(255), address VARCHAR(255))", R"(
+    BEGIN
+        -- Lock the oldest unassigned orders, skipping those another transporter is claiming instead of waiting for them.
+        -- A skipped order is left for the next claim, so no order is ever given to two transporters.
+        RETURN QUERY
+        WITH pending AS (
+            SELECT p.id, p.timestamp FROM orders p
+            WHERE p.status = 'shipped' AND p.transporter_id IS NULL
+            ORDER BY p.timestamp
+            LIMIT max_orders
+            FOR UPDATE SKIP LOCKED
+        ), claimed AS (
+            UPDATE orders o SET transporter_id = $1
+            FROM pending p
+            WHERE o.id = p.id AND o.timestamp = p.timestamp
+            RETURNING o.id, o.customer_id, o.address
+        )
+        SELECT c.id, cu.username, c.address
+        FROM claimed c
+        JOIN customers cu ON cu.id = c.customer_id
+        ORDER BY c.id;
+    END;)"); ///< Claim orders from the transporter pool
     createFunction(conn, "set_order_status", {{"user_type", "user_role"}, {"user_id", "INT"}, {"order_id", "INT"}, {"new_status", "order_status"}}, "VOID", R"(
     DECLARE
         current_status order_status;
     BEGIN
-        -- Check if the order exists and is handled by the given transporter
+        -- Check if the order exists and is handled by the given transporter. The row stays locked until the end of the
+        -- transaction, so a concurrent change waits and then sees the new status instead of applying on top of it.
         IF user_type = 'transporter' THEN
-            SELECT o.status INTO current_status FROM orders o WHERE o.id = order_id AND o.transporter_id = user_id;
+            SELECT o.status INTO current_status FROM orders o WHERE o.id = order_id AND o.transporter_id = user_id FOR UPDATE;
         ELSE
-            SELECT o.status INTO current_status FROM orders o WHERE o.id = order_id AND o.customer_id = user_id;
+            SELECT o.status INTO current_status FROM orders o WHERE o.id = order_id AND o.customer_id = user_id FOR UPDATE;
         END IF;
 
         IF NOT FOUND THEN
@@ -527,9 +967,62 @@ void initFunctions(std::shared_ptr<pqxx::connection> &conn) {
             RAISE EXCEPTION 'Cannot change status from %', current_status;
         END IF;
 
-        -- Update the order status
+        -- Update the order status, in the orders table and in the suppliers' view of the order
         UPDATE orders SET status = new_status WHERE id = order_id;
+        UPDATE supplier_orders so SET status = new_status WHERE so.order_id = $3;
+
+        -- A cancelled order no longer counts in the sales of its suppliers
+        IF new_status = 'cancelled' THEN
+            UPDATE supplier_sales_daily s SET quantity = s.quantity - i.quantity, revenue = s.revenue - i.revenue
+            FROM (
+                SELECT oi.supplier_id, oi.product_id, oi.order_timestamp::date AS day, SUM(oi.quantity) AS quantity, SUM(oi.quantity * oi.price) AS revenue
+                FROM order_items oi
+                WHERE oi.order_id = $3
+                GROUP BY oi.supplier_id, oi.product_id, oi.order_timestamp::date
+            ) i
+            WHERE s.supplier_id = i.supplier_id AND s.product_id = i.product_id AND s.day = i.day;
+        END IF;
     END;)"); ///< Set the status of an order
+    createFunction(conn, "set_order_statuses", {{"user_type", "user_role"}, {"user_id", "INT"}, {"order_ids", "INT[]"}, {"new_status", "order_status"}}, "TABLE(order_id INT, updated BOOL, failure TEXT)", R"(
+    BEGIN
+        -- Same rules as `set_order_status`, applied to every order at once; an order that fails does not abort the others
+        RETURN QUERY
+        WITH requested AS (
+            SELECT DISTINCT r.id FROM unnest(order_ids) AS r(id)
+        ), owned AS (
+            SELECT o.id, o.status FROM orders o
+            JOIN requested r ON o.id = r.id
+            WHERE CASE WHEN user_type = 'transporter' THEN o.transporter_id ELSE o.customer_id END = user_id
+        ), changed AS (
+            UPDATE orders o SET status = new_status
+            FROM owned w
+            WHERE o.id = w.id AND o.status NOT IN ('delivered', 'cancelled') -- Rechecked on the latest version of a row changed meanwhile
+            RETURNING o.id
+        ), propagated AS (
+            UPDATE supplier_orders so SET status = new_status
+            FROM changed c
+            WHERE so.order_id = c.id
+        ), uncounted AS (
+            UPDATE supplier_sales_daily s SET quantity = s.quantity - i.quantity, revenue = s.revenue - i.revenue
+            FROM (
+                SELECT oi.supplier_id, oi.product_id, oi.order_timestamp::date AS day, SUM(oi.quantity) AS quantity, SUM(oi.quantity * oi.price) AS revenue
+                FROM order_items oi
+                JOIN changed c ON oi.order_id = c.id
+                WHERE new_status = 'cancelled'
+                GROUP BY oi.supplier_id, oi.product_id, oi.order_timestamp::date
+            ) i
+            WHERE s.supplier_id = i.supplier_id AND s.product_id = i.product_id AND s.day = i.day
+        )
+        SELECT r.id, c.id IS NOT NULL,
+               CASE
+                   WHEN c.id IS NOT NULL THEN NULL
+                   WHEN w.id IS NULL THEN 'Order does not exist or is not handled by this user.'
+                   ELSE format('Cannot change status from %s', w.status)
+               END
+        FROM requested r
+        LEFT JOIN owned w ON w.id = r.id
+        LEFT JOIN changed c ON c.id = r.id;
+    END;)"); ///< Set the status of a batch of orders in one statement, reporting the outcome of each
 
     // Grant the EXECUTE permission to the respective users
     execCommand(conn, "GRANT EXECUTE ON FUNCTION check_user(user_role, VARCHAR) TO customer, supplier, transporter;");
@@ -537,16 +1030,164 @@ void initFunctions(std::shared_ptr<pqxx::connection> &conn) {
     execCommand(conn, "GRANT EXECUTE ON FUNCTION set_logged_in(user_role, INT, BOOL) TO customer, supplier, transporter;");
     execCommand(conn, "GRANT EXECUTE ON FUNCTION get_balance(user_role, INT) TO customer, supplier, transporter;");
     execCommand(conn, "GRANT EXECUTE ON FUNCTION set_balance(user_role, INT, INT) TO customer, supplier, transporter;");
+    for (const auto &[role, table]: userRoleTables) {
+        execCommand(conn, std::format("GRANT EXECUTE ON FUNCTION check_user_{0}(VARCHAR), insert_user_{0}(VARCHAR), get_balance_{0}(INT), set_balance_{0}(INT, INT) TO {0};", role));
+    }
+    execCommand(conn, "GRANT EXECUTE ON FUNCTION pay_supplier(INT, INT) TO customer;"); ///< Suppliers are paid by `makeOrder`
 
-    execCommand(conn, "GRANT EXECUTE ON FUNCTION make_order(INT, INT, VARCHAR(255)) TO customer;");
+    execCommand(conn, "GRANT EXECUTE ON FUNCTION make_order(INT, INT, VARCHAR(255), INT) TO customer;");
+    execCommand(conn, "GRANT EXECUTE ON FUNCTION make_pooled_order(INT, INT, VARCHAR(255)) TO customer;");
     execCommand(conn, "GRANT EXECUTE ON FUNCTION add_order_item(INT, INT, INT, INT, INT) TO customer;");
+    execCommand(conn, "GRANT EXECUTE ON FUNCTION add_reserved_order_item(INT, INT, INT, INT, INT) TO customer;");
 
     execCommand(conn, "GRANT EXECUTE ON FUNCTION add_product(VARCHAR(255), INT, INT, INT, VARCHAR(255)) TO supplier;");
     execCommand(conn, "GRANT EXECUTE ON FUNCTION remove_product(INT) TO supplier;");
     execCommand(conn, "GRANT EXECUTE ON FUNCTION edit_product(INT, VARCHAR(255), INT, INT, VARCHAR(255)) TO supplier;");
 
     execCommand(conn, "GRANT EXECUTE ON FUNCTION get_ongoing_orders(INT) TO transporter;");
+    execCommand(conn, "GRANT EXECUTE ON FUNCTION claim_orders(INT, INT) TO transporter;");
     execCommand(conn, "GRANT EXECUTE ON FUNCTION set_order_status(user_role, INT, INT, order_status) TO customer, transporter;");
+    execCommand(conn, "GRANT EXECUTE ON FUNCTION set_order_statuses(user_role, INT, INT[], order_status) TO transporter;"); ///< Only `Transporter::setOrderStatuses` changes orders in batches
+}
+
+/**
+ * Run a binary COPY and write its rows to a columnar file
+ * @param raw the connection to run the COPY on
+ * @param query the query to copy, selecting the columns in order
+ * @param path the path of the file
+ * @param columns the columns of the file
+ * @return the number of rows written
+ * @throws std::runtime_error if the COPY or the file fails
+ */
+static uint64_t copyToColumnarFile(PGconn *raw, const std::string &query, const std::filesystem::path &path, std::vector<ColumnarFile::Column> columns) {
+    std::unique_ptr<PGresult, decltype(&PQclear)> start(PQexec(raw, std::format("COPY ({}) TO STDOUT (FORMAT binary)", query).c_str()), &PQclear);
+    if (PQresultStatus(start.get()) != PGRES_COPY_OUT) throw std::runtime_error(PQerrorMessage(raw));
+
+    ColumnarFile file(path, std::move(columns));
+    char *buffer = nullptr;
+    int length;
+    while ((length = PQgetCopyData(raw, &buffer, 0)) > 0) {
+        try {
+            file.append(std::string_view(buffer, static_cast<size_t>(length)));
+        } catch (...) {
+            PQfreemem(buffer);
+            throw;
+        }
+        PQfreemem(buffer);
+    }
+
+    std::unique_ptr<PGresult, decltype(&PQclear)> end(PQgetResult(raw), &PQclear);
+    if (length == -2 || PQresultStatus(end.get()) != PGRES_COMMAND_OK) throw std::runtime_error(PQerrorMessage(raw));
+    file.close();
+    return file.rows();
+}
+
+void exportOrders(const std::string &directory) {
+    // Orders committed out of id order are settled after this long, see the bound below
+    static constexpr const char *settleMargin = "1 minute";
+    using Encoding = ColumnarFile::Encoding;
+    using Type = ColumnarFile::Type;
+
+    try {
+        std::filesystem::create_directories(directory);
+        std::filesystem::path watermarkPath = std::filesystem::path(directory) / "watermark";
+        uint32_t since = 0;
+        if (std::ifstream watermark(watermarkPath); watermark) watermark >> since;
+
+        std::unique_ptr<PGconn, decltype(&PQfinish)> raw(PQconnectdb(PostgresConnectionPool::getInstance().getReadConnectionInfo("ecommerce", "ecommerce", "ecommerce").c_str()), &PQfinish);
+        if (PQstatus(raw.get()) != CONNECTION_OK) throw std::runtime_error(PQerrorMessage(raw.get()));
+        auto exec = [&](const std::string &query, ExecStatusType expected) {
+            std::unique_ptr<PGresult, decltype(&PQclear)> result(PQexec(raw.get(), query.c_str()), &PQclear);
+            if (PQresultStatus(result.get()) != expected) throw std::runtime_error(PQerrorMessage(raw.get()));
+            return result;
+        };
+
+        // Both tables are exported from the same snapshot.
+        // Ids are taken before the commit, so a lower id may still commit after a higher one: only orders older than
+        // the margin are exported, and on a replica only once the replay caught up with them, so none is skipped for good.
+        exec("BEGIN ISOLATION LEVEL REPEATABLE READ READ ONLY;", PGRES_COMMAND_OK);
+        auto bound = exec(std::format(R"(
+            SELECT COALESCE(MAX(id), {0}) FROM orders
+            WHERE id > {0} AND timestamp < (CASE WHEN pg_is_in_recovery() THEN pg_last_xact_replay_timestamp() ELSE NOW() END)::TIMESTAMP - interval '{1}';
+        )", since, settleMargin), PGRES_TUPLES_OK);
+        auto until = static_cast<uint32_t>(std::stoul(PQgetvalue(bound.get(), 0, 0)));
+        if (until == since) {
+            exec("COMMIT;", PGRES_COMMAND_OK);
+            Utils::log(Utils::LogLevel::DEBUG, std::cout, "No new orders to export.");
+            return;
+        }
+
+        auto orders = copyToColumnarFile(raw.get(),
+                std::format("SELECT id, customer_id, total_price, transporter_id, status, address, timestamp FROM orders WHERE id > {} AND id <= {} ORDER BY id", since, until),
+                std::filesystem::path(directory) / std::format("orders-{}-{}.ordc", since + 1, until),
+                {{"id", Type::INT32, Encoding::DELTA},
+                 {"customer_id", Type::INT32, Encoding::VARINT},
+                 {"total_price", Type::INT32, Encoding::VARINT},
+                 {"transporter_id", Type::INT32, Encoding::VARINT, true},
+                 {"status", Type::TEXT, Encoding::DICTIONARY},
+                 {"address", Type::TEXT, Encoding::STRING},
+                 {"timestamp", Type::TIMESTAMP, Encoding::DELTA}});
+        auto items = copyToColumnarFile(raw.get(),
+                std::format("SELECT id, order_id, product_id, quantity, price, supplier_id, order_timestamp FROM order_items WHERE order_id > {} AND order_id <= {} ORDER BY order_id, id", since, until),
+                std::filesystem::path(directory) / std::format("order_items-{}-{}.ordc", since + 1, until),
+                {{"id", Type::INT32, Encoding::DELTA},
+                 {"order_id", Type::INT32, Encoding::DELTA},
+                 {"product_id", Type::INT32, Encoding::VARINT},
+                 {"quantity", Type::INT32, Encoding::VARINT},
+                 {"price", Type::INT32, Encoding::VARINT},
+                 {"supplier_id", Type::INT32, Encoding::VARINT},
+                 {"order_timestamp", Type::TIMESTAMP, Encoding::DELTA}});
+        exec("COMMIT;", PGRES_COMMAND_OK);
+
+        // Move the watermark only once both files are complete, replacing it at once
+        std::filesystem::path partialWatermark = watermarkPath;
+        partialWatermark += ".partial";
+        {
+            std::ofstream watermark(partialWatermark, std::ios::trunc);
+            watermark << until << '\n';
+            if (!watermark) throw std::runtime_error(std::format("Failed to write `{}`", partialWatermark.string()));
+        }
+        std::filesystem::rename(partialWatermark, watermarkPath);
+
+        Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("Orders {} to {} exported: {} orders, {} items.", since + 1, until, orders, items));
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to export orders: {}", e.what()));
+    }
+}
+
+void backfillSalesRollups() {
+    try {
+        // Connect to the 'ecommerce' database as the 'ecommerce' user, the owner of the rollups
+        auto conn = conn2Postgres("ecommerce", "ecommerce", "ecommerce");
+
+        std::vector<std::string> days;
+        {
+            pqxx::work tx(*conn);
+            for (auto [day]: tx.query<std::string>("SELECT d::date::text FROM generate_series((SELECT MIN(timestamp)::date FROM orders), (SELECT MAX(timestamp)::date FROM orders), '1 day') d;")) days.push_back(std::move(day));
+            tx.commit();
+        }
+
+        // One transaction per day: orders keep being placed and cancelled meanwhile, and their rollup updates must neither
+        // be lost nor counted twice, so they are blocked while a day is recomputed, but only for the time of that day
+        size_t rows = 0;
+        for (const auto &day: days) {
+            pqxx::work tx(*conn);
+            tx.exec("LOCK TABLE supplier_sales_daily IN EXCLUSIVE MODE;");
+            tx.exec_params("DELETE FROM supplier_sales_daily WHERE day = $1::date;", day);
+            rows += tx.exec_params(std::format("INSERT INTO supplier_sales_daily {} AND o.timestamp >= $1::date AND o.timestamp < $1::date + 1 {};", salesFromOrders, salesFromOrdersGrouping), day).affected_rows();
+            tx.commit();
+        }
+
+        // Rollups of days without any order left, e.g. archived ones
+        pqxx::work tx(*conn);
+        if (days.empty()) tx.exec("DELETE FROM supplier_sales_daily;");
+        else tx.exec_params("DELETE FROM supplier_sales_daily WHERE day < $1::date OR day > $2::date;", days.front(), days.back());
+        tx.commit();
+
+        Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("Sales rollups rebuilt for {} days, {} rows.", days.size(), rows));
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to backfill the sales rollups: {}", e.what()));
+    }
 }
 
 void dropDatabase() {
@@ -568,3 +1209,58 @@ void dropDatabase() {
     execCommand(conn, "DROP USER IF EXISTS supplier");
     execCommand(conn, "DROP USER IF EXISTS transporter");
 }
+
+/**
+ * Get the name of the database holding a snapshot
+ * @param name the name of the snapshot
+ * @return the name of the database
+ * @throws std::invalid_argument if the name is not a valid snapshot name
+ */
+static std::string snapshotDatabaseName(const std::string &name) {
+    bool valid = !name.empty() && std::ranges::all_of(name, [](char c) { return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_'; });
+    if (!valid) throw std::invalid_argument(std::format("Invalid snapshot name `{}`, use lowercase letters, digits and underscores", name));
+    return std::format("ecommerce_snapshot_{}", name);
+}
+
+bool snapshotDatabase(const std::string &name) {
+    try {
+        std::string snapshot = snapshotDatabaseName(name);
+
+        // Connect to the default 'postgres' database as the 'postgres' user, only a superuser can close the sessions of every role
+        auto conn = conn2Postgres("postgres", "postgres", "");
+        pqxx::nontransaction ntx(*conn);
+
+        // Copying is a file-level copy of the database, which must have no other session meanwhile
+        ntx.exec("SELECT pg_terminate_backend(pid) FROM pg_stat_activity WHERE datname = 'ecommerce' AND pid != pg_backend_pid();");
+        ntx.exec(std::format("DROP DATABASE IF EXISTS {};", snapshot));
+        ntx.exec(std::format("CREATE DATABASE {} TEMPLATE ecommerce OWNER ecommerce;", snapshot));
+        ntx.exec(std::format("ALTER DATABASE {} ALLOW_CONNECTIONS false;", snapshot)); // A session on the snapshot would block its restore
+
+        Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("Database snapshot `{}` taken.", name));
+        return true;
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to take database snapshot `{}`: {}", name, e.what()));
+        return false;
+    }
+}
+
+bool restoreDatabase(const std::string &name) {
+    try {
+        std::string snapshot = snapshotDatabaseName(name);
+
+        // Connect to the default 'postgres' database as the 'postgres' user
+        auto conn = conn2Postgres("postgres", "postgres", "");
+        if (!doesDatabaseExist(conn, snapshot)) throw std::runtime_error("No such snapshot"); // Before `ntx`, it opens its own transaction
+        pqxx::nontransaction ntx(*conn);
+
+        // The roles are kept, only the database is replaced
+        ntx.exec("DROP DATABASE IF EXISTS ecommerce WITH (FORCE);");
+        ntx.exec(std::format("CREATE DATABASE ecommerce TEMPLATE {} OWNER ecommerce;", snapshot));
+
+        Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("Database restored from snapshot `{}`.", name));
+        return true;
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to restore database snapshot `{}`: {}", name, e.what()));
+        return false;
+    }
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../Utils.h"
+#include "ColumnarFile.h"
 #include "PostgresConnectionPool.h"
 #include <pqxx/pqxx>
 #include <vector>
@@ -14,6 +15,22 @@
  */
 std::shared_ptr<pqxx::connection> conn2Postgres(const std::string &dbname, const std::string &user, const std::string &password);
 
+/**
+ * Connect to a PostgreSQL database for read-only work, on a replica when one is configured
+ * @param dbname the name of the database to connect to
+ * @param user the username to use
+ * @param password the password to use
+ * @param session the session doing the reads, sessions that wrote recently read from the primary
+ * @return a pointer to the connection object
+ */
+std::shared_ptr<pqxx::connection> conn2PostgresReadOnly(const std::string &dbname, const std::string &user, const std::string &password, const std::string &session);
+
+/**
+ * Record that a session committed a write, so that its next reads see it
+ * @param session the session that wrote
+ */
+void markPostgresWrite(const std::string &session);
+
 /**
  * Check if a database exists in PostgreSQL
  * @param conn a pointer to the connection object
@@ -74,8 +91,9 @@ bool doesTableExist(std::shared_ptr<pqxx::connection> &conn, const std::string &
  * @param conn a pointer to the connection object
  * @param tableName the name of the table to create
  * @param columns the columns to use
+ * @param options what follows the column list, e.g. `PARTITION BY RANGE (timestamp)`
  */
-void createTable(std::shared_ptr<pqxx::connection> &conn, const std::string &tableName, const std::string &columns);
+void createTable(std::shared_ptr<pqxx::connection> &conn, const std::string &tableName, const std::string &columns, const std::string &options = "");
 
 /**
  * Check if a function exists in PostgreSQL
@@ -87,7 +105,7 @@ void createTable(std::shared_ptr<pqxx::connection> &conn, const std::string &tab
 bool doesFunctionExist(std::shared_ptr<pqxx::connection> &conn, const std::string &functionName, const std::vector<std::string> &argTypes);
 
 /**
- * Create a new function in PostgreSQL
+ * Create a new function in PostgreSQL, or replace it if it exists with another body
  * @param conn a pointer to the connection object
  * @param functionName the name of the function to create
  * @param args the arguments of the function, as a vector of pairs of the argument name and type
@@ -121,6 +139,11 @@ void printRows(const pqxx::result &R);
  */
 void initDatabase();
 
+/**
+ * Open the connections of the `customer`, `supplier` and `transporter` users ahead of time, with their statements prepared
+ */
+void warmUpPostgres();
+
 /**
  * Initialize the types in PostgreSQL
  * @param conn a pointer to the connection object
@@ -133,6 +156,46 @@ void initTypes(std::shared_ptr<pqxx::connection> &conn);
  */
 void initTables(std::shared_ptr<pqxx::connection> &conn);
 
+/**
+ * Convert the unpartitioned `orders` and `order_items` tables of an existing database to partitioned tables, keeping their rows
+ * Exits the process if the conversion fails, for example on items without an order; the tables are then left unchanged.
+ * @param conn a pointer to the connection object
+ */
+void partitionOrderTables(std::shared_ptr<pqxx::connection> &conn);
+
+/**
+ * Create the monthly partitions of `orders` and `order_items`, from the current month on, if they do not exist
+ * @param conn a pointer to the connection object
+ * @param monthsAhead how many months after the current one to create in advance
+ */
+void createOrderPartitions(std::shared_ptr<pqxx::connection> &conn, int monthsAhead);
+
+/**
+ * Keep creating the partitions of the coming months in the background, while the process runs
+ */
+void startOrderPartitionMaintenance();
+
+/**
+ * Archive the cold partitions of `orders` and `order_items`: detach them, export them as gzip-compressed CSV files and drop them
+ * The rows of `supplier_orders` of the archived months are deleted.
+ * @param keepMonths how many months before the current one stay in the database
+ * @param directory the directory to write the files to, as `{partition}.csv.gz`
+ */
+void archiveOrderPartitions(uint32_t keepMonths, const std::string &directory);
+
+/**
+ * Export the orders and their items placed since the last export to columnar files (see ColumnarFile), from a replica if there is one
+ * @param directory the directory to write the files to, as `orders-{first id}-{last id}.ordc` and `order_items-...`,
+ * and holding the `watermark` file (the id of the last exported order)
+ * @note Each order is exported once, so its `status` is the one at export time; later changes are not exported.
+ */
+void exportOrders(const std::string &directory);
+
+/**
+ * Recompute `supplier_sales_daily` from the orders, for databases created before the rollups or after a manual fix of the orders
+ */
+void backfillSalesRollups();
+
 /**
  * Initialize the functions in PostgreSQL
  * @param conn a pointer to the connection object
@@ -144,3 +207,18 @@ void initFunctions(std::shared_ptr<pqxx::connection> &conn);
  * Used for testing purposes
  */
 void dropDatabase();
+
+/**
+ * Copy the ecommerce database to the template database `ecommerce_snapshot_{name}`, replacing a previous snapshot of the same name
+ * Used for testing purposes, to seed a dataset once and restore it before each run
+ * @param name the name of the snapshot, made of lowercase letters, digits and underscores
+ * @return true if the snapshot was taken
+ */
+bool snapshotDatabase(const std::string &name);
+
+/**
+ * Replace the ecommerce database with a copy of a snapshot taken by `snapshotDatabase`, closing the sessions open on it
+ * @param name the name of the snapshot
+ * @return true if the database was restored
+ */
+bool restoreDatabase(const std::string &name);
@@ -1,7 +1,10 @@
+#include "db/BalanceLedger.h"
 #include "db/dbutils.h"
 #include "models/Customer.h"
 #include "models/Supplier.h"
 #include "models/Transporter.h"
+#include "redis/RedisCartStore.h"
+#include <charconv>
 
 void testUsersInteractions() {
     Utils::log(Utils::LogLevel::DEBUG, std::cout, "Testing users interactions...");
@@ -41,12 +44,37 @@ void testUsersInteractions() {
     }
 }
 
+/**
+ * Parse a non-negative integer argument
+ * @param value the argument
+ * @return the number, or std::nullopt if the argument is not entirely a number that fits
+ */
+std::optional<uint32_t> parseNumber(std::string_view value) {
+    uint32_t number;
+    auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), number);
+    if (error != std::errc() || end != value.data() + value.size()) return std::nullopt;
+    return number;
+}
+
 /**
  * Handle command line arguments.
  * @param argc the number of arguments
  * @param argv the arguments
  */
+std::optional<uint32_t> archiveMonths;      ///< Set by `--archive`, the archiving runs once the database is initialized
+std::vector<uint32_t> hotProducts;          ///< Set by `--hot-product`, made hot once the database is initialized
+bool backfillSales = false;                 ///< Set by `--backfill-sales`, the backfill runs once the database is initialized
+bool buildRecommendations = false;          ///< Set by `--build-recommendations`, the job runs once the database is initialized
+std::optional<std::string> exportDirectory; ///< Set by `--export`, the export runs once the database is initialized
+std::optional<std::string> snapshotName;    ///< Set by `--snapshot`, the snapshot is taken once the database is initialized
+std::optional<std::string> restoreName;     ///< Set by `--restore`, the snapshot is restored before the database is initialized
+
 void handleArgs(int argc, char *argv[]) {
+    std::string primary;
+    std::vector<std::string> replicas;
+    std::vector<std::string> cartShards;
+    std::vector<std::string> addedCartShards, removedCartShards;
+
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
         if (arg == "-h" || arg == "--help") {
@@ -56,7 +84,23 @@ void handleArgs(int argc, char *argv[]) {
                                "Options:\n"
                                "\t-h, --help    Show this help message and exit\n"
                                "\t--drop        Drop the database and exit\n"
-                               "\t-v            Enable verbose logging to console\n");
+                               "\t-v            Enable verbose logging to console\n"
+                               "\t--primary <host[:port]>     Postgres primary server (default: local server)\n"
+                               "\t--replica <host[:port]>     Postgres read replica, can be repeated\n"
+                               "\t--read-your-writes <ms>     Keep reading from the primary for <ms> after a write (default: 0)\n"
+                               "\t--cart-shard <host[:port]>  Redis server holding a share of the carts, can be repeated (default: local server)\n"
+                               "\t--add-cart-shard <host[:port]>    Move a share of the carts of the --cart-shard servers to this one\n"
+                               "\t--remove-cart-shard <host[:port]> Move the carts of this --cart-shard server to the others\n"
+                               "\t--cart-store <redis|memory> Keep the carts in Redis, or in this process (default: redis);\n"
+                               "\t                            the rest of the state still needs Redis\n"
+                               "\t--hot-product <id>          Take the stock of this product from Redis, can be repeated\n"
+                               "\t--transporter-pool          Leave new orders for transporters to claim instead of assigning them\n"
+                               "\t--archive <months>          Archive the orders older than <months> months to ./archive and exit\n"
+                               "\t--backfill-sales            Recompute the sales rollups of the suppliers from the orders and exit\n"
+                               "\t--build-recommendations     Recompute the products bought together from the orders and exit\n"
+                               "\t--export <directory>        Export the orders placed since the last export to columnar files and exit\n"
+                               "\t--snapshot <name>           Save the database and Redis as snapshot <name> and exit\n"
+                               "\t--restore <name>            Restore the database and Redis from snapshot <name> before running\n");
             exit(EXIT_SUCCESS);
         } else if (arg == "--drop") {
             dropDatabase();
@@ -65,6 +109,39 @@ void handleArgs(int argc, char *argv[]) {
             exit(EXIT_SUCCESS);
         } else if (arg == "-v") {
             Utils::logToConsole = true;
+        } else if (arg == "--archive" && i + 1 < argc && parseNumber(argv[i + 1])) {
+            archiveMonths = parseNumber(argv[++i]);
+        } else if (arg == "--export" && i + 1 < argc) {
+            exportDirectory = argv[++i];
+        } else if (arg == "--snapshot" && i + 1 < argc) {
+            snapshotName = argv[++i];
+        } else if (arg == "--restore" && i + 1 < argc) {
+            restoreName = argv[++i];
+        } else if (arg == "--build-recommendations") {
+            buildRecommendations = true;
+        } else if (arg == "--backfill-sales") {
+            backfillSales = true;
+        } else if (arg == "--hot-product" && i + 1 < argc && parseNumber(argv[i + 1])) {
+            hotProducts.push_back(parseNumber(argv[++i]).value());
+        } else if (arg == "--transporter-pool") {
+            TransporterDispatcher::getInstance().setPooled(true);
+        } else if (arg == "--cart-store" && i + 1 < argc && (std::string_view(argv[i + 1]) == "redis" || std::string_view(argv[i + 1]) == "memory")) {
+            CartStore::setBackend(std::string_view(argv[++i]) == "memory" ? CartStore::Backend::MEMORY : CartStore::Backend::REDIS);
+        } else if (arg == "--add-cart-shard" && i + 1 < argc) {
+            addedCartShards.emplace_back(argv[++i]);
+        } else if (arg == "--remove-cart-shard" && i + 1 < argc) {
+            removedCartShards.emplace_back(argv[++i]);
+        } else if (arg == "--cart-shard" && i + 1 < argc) {
+            cartShards.emplace_back(argv[++i]);
+            CartShardRing::getInstance().setShards(cartShards);
+        } else if (arg == "--read-your-writes" && i + 1 < argc && parseNumber(argv[i + 1])) {
+            PostgresConnectionPool::getInstance().setReadYourWritesWindow(std::chrono::milliseconds(parseNumber(argv[++i]).value()));
+        } else if ((arg == "--primary" || arg == "--replica") && i + 1 < argc) {
+            // Applied as soon as parsed, so that a later `--drop` targets the right server
+            std::string value = argv[++i];
+            if (arg == "--primary") primary = value;
+            else replicas.push_back(value);
+            PostgresConnectionPool::getInstance().setEndpoints(primary, replicas);
         } else {
             Utils::log(Utils::LogLevel::ERROR, std::cerr, "Unknown argument: " + arg);
             Utils::log(Utils::LogLevel::TRACE, std::cout,
@@ -73,18 +150,79 @@ void handleArgs(int argc, char *argv[]) {
                                "Options:\n"
                                "\t-h, --help    Show this help message and exit\n"
                                "\t--drop        Drop the database and exit\n"
-                               "\t-v            Enable verbose logging to console\n");
+                               "\t-v            Enable verbose logging to console\n"
+                               "\t--primary <host[:port]>     Postgres primary server (default: local server)\n"
+                               "\t--replica <host[:port]>     Postgres read replica, can be repeated\n"
+                               "\t--read-your-writes <ms>     Keep reading from the primary for <ms> after a write (default: 0)\n"
+                               "\t--cart-shard <host[:port]>  Redis server holding a share of the carts, can be repeated (default: local server)\n"
+                               "\t--add-cart-shard <host[:port]>    Move a share of the carts of the --cart-shard servers to this one\n"
+                               "\t--remove-cart-shard <host[:port]> Move the carts of this --cart-shard server to the others\n"
+                               "\t--cart-store <redis|memory> Keep the carts in Redis, or in this process (default: redis);\n"
+                               "\t                            the rest of the state still needs Redis\n"
+                               "\t--hot-product <id>          Take the stock of this product from Redis, can be repeated\n"
+                               "\t--transporter-pool          Leave new orders for transporters to claim instead of assigning them\n"
+                               "\t--archive <months>          Archive the orders older than <months> months to ./archive and exit\n"
+                               "\t--backfill-sales            Recompute the sales rollups of the suppliers from the orders and exit\n"
+                               "\t--build-recommendations     Recompute the products bought together from the orders and exit\n"
+                               "\t--export <directory>        Export the orders placed since the last export to columnar files and exit\n"
+                               "\t--snapshot <name>           Save the database and Redis as snapshot <name> and exit\n"
+                               "\t--restore <name>            Restore the database and Redis from snapshot <name> before running\n");
 
             exit(EXIT_FAILURE);
         }
     }
+
+    // Resharding starts from the complete `--cart-shard` list, whatever the order of the options
+    try {
+        for (const auto &endpoint: addedCartShards) CartShardRing::getInstance().addShard(endpoint);
+        for (const auto &endpoint: removedCartShards) CartShardRing::getInstance().removeShard(endpoint);
+    } catch (const std::logic_error &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Cannot change the cart shards: {}", e.what()));
+        exit(EXIT_FAILURE);
+    }
 }
 
 int main(int argc, char *argv[]) {
     handleArgs(argc, argv);
 
     // Initialize the database
+    if (restoreName) {
+        if (!restoreDatabase(restoreName.value()) || !restoreRedis(restoreName.value())) return EXIT_FAILURE;
+        Utils::log(Utils::LogLevel::TRACE, std::cout, "Snapshot restored.");
+    }
     initDatabase();
+    if (snapshotName) {
+        if (!snapshotDatabase(snapshotName.value()) || !snapshotRedis(snapshotName.value())) return EXIT_FAILURE;
+        Utils::log(Utils::LogLevel::TRACE, std::cout, "Snapshot taken.");
+        return EXIT_SUCCESS;
+    }
+    if (archiveMonths) {
+        archiveOrderPartitions(archiveMonths.value(), "archive");
+        Utils::log(Utils::LogLevel::TRACE, std::cout, "Orders archived.");
+        return EXIT_SUCCESS;
+    }
+    if (backfillSales) {
+        backfillSalesRollups();
+        Utils::log(Utils::LogLevel::TRACE, std::cout, "Sales rollups backfilled.");
+        return EXIT_SUCCESS;
+    }
+    if (buildRecommendations) {
+        Recommendations::getInstance().rebuild();
+        Utils::log(Utils::LogLevel::TRACE, std::cout, "Recommendations built.");
+        return EXIT_SUCCESS;
+    }
+    if (exportDirectory) {
+        exportOrders(exportDirectory.value());
+        Utils::log(Utils::LogLevel::TRACE, std::cout, "Orders exported.");
+        return EXIT_SUCCESS;
+    }
+    warmUpPostgres();
+    if (CartStore::getBackend() == CartStore::Backend::REDIS) RedisCartStore::migrateLegacyCarts();
+    TransporterDispatcher::getInstance().rebuild();
+    InventoryReservations::getInstance().rebuild(hotProducts);
+    BalanceLedger::getInstance().start();
+    startOrderPartitionMaintenance();
+    ProductRankings::getInstance().start();
     Utils::log(Utils::LogLevel::TRACE, std::cout, "Ready to work...");
 
     // Testing
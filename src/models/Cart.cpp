@@ -0,0 +1,43 @@
+#include "Cart.h"
+#include <algorithm>
+#include <charconv>
+
+Cart Cart::parse(const redisReply &reply) {
+    Cart cart;
+    if (reply.type != REDIS_REPLY_ARRAY || reply.elements % 2) throw std::invalid_argument("Malformed cart, expected field/value pairs");
+
+    cart.lines.reserve(reply.elements / 2);
+    for (size_t i = 0; i < reply.elements; i += 2) {
+        const redisReply &field = *reply.element[i];
+        const redisReply &value = *reply.element[i + 1];
+
+        uint32_t productId{};
+        auto [end, ec] = std::from_chars(field.str, field.str + field.len, productId);
+        if (ec != std::errc() || end != field.str + field.len) throw std::invalid_argument("Malformed cart, product id is not a number");
+
+        CartCodec::Item item = CartCodec::decode(std::string_view(value.str, value.len));
+        cart.lines.push_back({productId, item.amount, item.price, item.supplierId, {}});
+        cart.total += item.price * item.amount;
+    }
+
+    // Redis returns the fields in no particular order
+    std::ranges::sort(cart.lines, {}, &CartLine::productId);
+    return cart;
+}
+
+Cart Cart::fromLines(std::vector<CartLine> lines) {
+    Cart cart;
+    cart.lines = std::move(lines);
+    for (const auto &line: cart.lines) cart.total += line.price * line.amount;
+    std::ranges::sort(cart.lines, {}, &CartLine::productId);
+    return cart;
+}
+
+void Cart::resolveNames(pqxx::result catalog) {
+    this->catalog = std::move(catalog);
+    for (const auto &row: this->catalog) {
+        auto productId = row[0].as<uint32_t>();
+        auto line = std::ranges::lower_bound(lines, productId, {}, &CartLine::productId);
+        if (line != lines.end() && line->productId == productId) line->name = row[1].view();
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "../redis/CartCodec.h"
+#include <pqxx/pqxx>
+#include <sw/redis++/redis++.h>
+#include <vector>
+
+/**
+ * A line of a cart.
+ */
+struct CartLine {
+    uint32_t productId;
+    uint32_t amount;
+    uint32_t price; ///< Unit price when the product was added to the cart.
+    uint32_t supplierId;
+    std::string_view name; ///< Empty until `Cart::resolveNames`, then points into the catalog result held by the cart.
+};
+
+/**
+ * The contents of a cart, as a flat vector of lines sorted by product id
+ *
+ * @details A cart is parsed in a single pass over the HGETALL reply, reading the packed lines where hiredis left them
+ * and summing the total price on the way. Reading a cart therefore costs the same few allocations whatever its size:
+ * the reply, the vector of lines and, when the names are resolved, the catalog result they point into.
+ */
+class Cart {
+public:
+    /**
+     * Parse the reply of `HGETALL cart:{customerId}`.
+     * @param reply the reply, an array alternating product ids and packed lines
+     * @return the cart, empty if the reply is empty
+     * @throws std::invalid_argument if the reply is not an array of pairs or holds a malformed line
+     */
+    static Cart parse(const redisReply &reply);
+
+    /**
+     * Build a cart from lines read from another backend than Redis.
+     * @param lines the lines, without names
+     * @return the cart
+     */
+    static Cart fromLines(std::vector<CartLine> lines);
+
+    /**
+     * Attach the product names to the lines.
+     * @param catalog the result of a query selecting the `id` and `name` of the products of the cart, in that order
+     */
+    void resolveNames(pqxx::result catalog);
+
+    /**
+     * @return the sum of the price times the amount of every line
+     */
+    [[nodiscard]] uint32_t totalPrice() const { return total; }
+
+    [[nodiscard]] bool empty() const { return lines.empty(); }
+    [[nodiscard]] size_t size() const { return lines.size(); }
+    [[nodiscard]] std::vector<CartLine>::const_iterator begin() const { return lines.begin(); }
+    [[nodiscard]] std::vector<CartLine>::const_iterator end() const { return lines.end(); }
+
+private:
+    std::vector<CartLine> lines;
+    uint32_t total = 0;
+    pqxx::result catalog; ///< Owns the names the lines point to, shared by the copies of the cart.
+};
@@ -0,0 +1,22 @@
+#include "CartStore.h"
+#include "../redis/RedisCartStore.h"
+#include "MemoryCartStore.h"
+#include <atomic>
+
+namespace {
+std::atomic<CartStore::Backend> selectedBackend{CartStore::Backend::REDIS};
+}
+
+CartStore &CartStore::getInstance() {
+    // Only the selected backend is ever constructed, the in-memory one starts a sweeping thread
+    if (selectedBackend.load(std::memory_order_relaxed) == Backend::MEMORY) {
+        static MemoryCartStore memory;
+        return memory;
+    }
+    static RedisCartStore redis;
+    return redis;
+}
+
+void CartStore::setBackend(Backend backend) { selectedBackend.store(backend, std::memory_order_relaxed); }
+
+CartStore::Backend CartStore::getBackend() { return selectedBackend.load(std::memory_order_relaxed); }
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "../redis/CartCodec.h"
+#include "Cart.h"
+#include <optional>
+#include <string>
+
+/**
+ * Where the carts of the customers are kept
+ *
+ * @details `Customer` only goes through this interface, so the cart logic does not depend on the backend:
+ *  - `RedisCartStore` (default) keeps each cart as a hash on its Redis shard, shared by every process
+ *  - `MemoryCartStore` keeps them in the process, for single-node deployments and to measure the cart logic alone.
+ *    Only the carts leave Redis: sessions, rankings, reservations, the dispatcher and the notifier still require it at startup.
+ * The backend is chosen once at startup with `setBackend`, before any cart is used.
+ */
+class CartStore {
+public:
+    enum class Backend {
+        REDIS,
+        MEMORY
+    };
+
+    /**
+     * The outcome of `remove`.
+     */
+    struct Removal {
+        enum class Status {
+            REMOVED,
+            NOT_FOUND, ///< The product is not in the cart.
+            NOT_ENOUGH ///< The cart holds less than the amount to remove, nothing was removed.
+        } status;
+        uint32_t amount = 0; ///< The amount removed.
+        uint32_t price = 0;  ///< The unit price of the line.
+    };
+
+    CartStore() = default;
+    CartStore(const CartStore &) = delete;
+    CartStore &operator=(const CartStore &) = delete;
+    virtual ~CartStore() = default;
+
+    /**
+     * Get the cart store of the selected backend
+     * @return The cart store
+     */
+    static CartStore &getInstance();
+
+    /**
+     * Select the backend. Must be called before any cart is used.
+     * @param backend the backend
+     */
+    static void setBackend(Backend backend);
+
+    /**
+     * @return the selected backend
+     */
+    static Backend getBackend();
+
+    /**
+     * Add a product to a cart. If the product is already in it, the amounts are summed and the price refreshed.
+     * @param customerId the id of the customer
+     * @param productId the id of the product
+     * @param item the amount to add, the current price and the supplier of the product
+     */
+    virtual void add(const std::string &customerId, uint32_t productId, const CartCodec::Item &item) = 0;
+
+    /**
+     * Remove a product from a cart.
+     * @param customerId the id of the customer
+     * @param productId the id of the product
+     * @param amount the amount to remove, all of it if not provided
+     * @return what was removed
+     */
+    virtual Removal remove(const std::string &customerId, uint32_t productId, std::optional<uint32_t> amount) = 0;
+
+    /**
+     * Read a cart, without the product names.
+     * @param customerId the id of the customer
+     * @return the cart, empty if the customer has none
+     */
+    virtual Cart read(const std::string &customerId) = 0;
+
+    /**
+     * Empty a cart.
+     * @param customerId the id of the customer
+     */
+    virtual void clear(const std::string &customerId) = 0;
+};
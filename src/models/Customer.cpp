@@ -17,49 +17,133 @@ void Customer::searchProduct(const std::optional<std::string> &name,
                              const std::optional<uint32_t> &priceLowerBound,
                              const std::optional<uint32_t> &priceUpperBound,
                              const std::optional<std::vector<std::pair<std::string, bool>>> &orderBy) const {
+    Arena arena;
     try {
-        // Connect to `ecommerce` db as `customer` user using conn2Postgres
-        auto conn = conn2Postgres("ecommerce", "customer", "customer");
+        // Connect to `ecommerce` db as `customer` user using conn2PostgresReadOnly
+        auto conn = conn2PostgresReadOnly("ecommerce", "customer", "customer", sessionKey());
 
         // Build query from parameters
-        std::string query = "SELECT * FROM products";
-        std::string filters;
+        std::pmr::string query("SELECT products.* FROM products", arena.resource());
+        std::pmr::string filters(arena.resource());
+
+        // Sorting by popularity joins the scores of the trending products, the others rank last.
+        // They are bound as two array parameters, the query text stays the same whatever the ranking.
+        bool byPopularity = orderBy && std::ranges::any_of(orderBy.value(), [](const auto &column) { return column.first == "popularity"; });
+        std::string popularIds = "{", popularScores = "{";
+        if (byPopularity) {
+            query += " LEFT JOIN unnest($1::INT[], $2::FLOAT8[]) AS popularity(product_id, score) ON popularity.product_id = products.id";
+            for (const auto &[productId, score]: ProductRankings::getInstance().top(popularityDepth, ProductRankings::Window::TRENDING)) {
+                const char *separator = popularIds.size() > 1 ? "," : "";
+                std::format_to(std::back_inserter(popularIds), "{}{}", separator, productId);
+                std::format_to(std::back_inserter(popularScores), "{}{}", separator, score);
+            }
+        }
+        popularIds += "}";
+        popularScores += "}";
 
         // Filters
-        if (name) filters += std::format("name LIKE '%{}%' AND ", name.value());
-        if (supplierUsername) filters += std::format("supplier_username LIKE '%{}%' AND ", supplierUsername.value());
-        if (priceLowerBound) filters += std::format("price >= {} AND", priceLowerBound.value());
-        if (priceUpperBound) filters += std::format("price <= {} AND", priceUpperBound.value());
+        if (name) filters += arena.format("name LIKE '%{}%' AND ", name.value());
+        if (supplierUsername) filters += arena.format("supplier_username LIKE '%{}%' AND ", supplierUsername.value());
+        if (priceLowerBound) filters += arena.format("price >= {} AND", priceLowerBound.value());
+        if (priceUpperBound) filters += arena.format("price <= {} AND", priceUpperBound.value());
         filters += " amount != -1 AND ";  // Only show products that are in stock
 
         // Remove the last " AND " if it exists
-        if (!filters.empty() && filters.ends_with(" AND ")) filters = filters.substr(0, filters.length() - 5);
+        if (!filters.empty() && filters.ends_with(" AND ")) filters.resize(filters.length() - 5);
 
         // Add filters to the query if they exist
-        if (!filters.empty()) query += " WHERE " + filters;
+        if (!filters.empty()) query.append(" WHERE ").append(filters);
 
         // Sort
         if (orderBy) {
             query += " ORDER BY ";
             for (const auto &[columnName, sortDescending]: orderBy.value()) {
-                query += columnName;
+                if (columnName == "popularity") query += "COALESCE(popularity.score, 0)";
+                else query += columnName;
                 if (sortDescending) query += " DESC";
                 query += ", ";
             }
             // Remove the last ", " if it exists
-            if (!orderBy.value().empty()) query = query.substr(0, query.length() - 2);
+            if (!orderBy.value().empty()) query.resize(query.length() - 2);
         }
         query += ";";
 
         // Execute query
-        pqxx::work tx(*conn);
-        pqxx::result R = tx.exec(query);
+        pqxx::read_transaction tx(*conn);
+        pqxx::result R = byPopularity ? tx.exec_params(query, popularIds, popularScores) : tx.exec(query);
         tx.commit();
 
         // Print results
         printRows(R);
     } catch (const std::exception &e) {
-        Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to search products: {}", e.what()));
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to search products: {}", e.what()));
+    }
+}
+
+void Customer::getBestsellers(uint32_t k, ProductRankings::Window window) const {
+    Arena arena;
+    try {
+        // Rank in Redis, then only look up the k products found
+        auto ranking = ProductRankings::getInstance().top(k, window);
+        if (ranking.empty()) {
+            Utils::log(Utils::LogLevel::TRACE, *logFile, "No bestsellers yet.");
+            return;
+        }
+
+        std::vector<uint32_t> productIds;
+        productIds.reserve(ranking.size());
+        for (const auto &[productId, score]: ranking) productIds.push_back(productId);
+
+        // Connect to `ecommerce` db as `customer` user using conn2PostgresReadOnly
+        auto conn = conn2PostgresReadOnly("ecommerce", "customer", "customer", sessionKey());
+        auto query = arena.format("SELECT {} FROM products WHERE id = ANY({}) AND amount != -1;", columnList<ProductRow>(), idArray(productIds, arena));
+        pqxx::read_transaction tx(*conn);
+        pqxx::result R = tx.exec(query);
+        tx.commit();
+
+        // Print in ranking order, removed products are skipped
+        auto products = decodeRows<ProductRow>(R);
+        uint32_t rank = 0;
+        for (const auto &[productId, score]: ranking) {
+            auto product = std::ranges::find(products, productId, &ProductRow::id);
+            if (product == products.end()) continue;
+            Utils::log(Utils::LogLevel::TRACE, *logFile, arena.format("#{} {} (id {}, price {}, score {:.1f})", ++rank, product->name, product->id, product->price, score));
+        }
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to fetch bestsellers: {}", e.what()));
+    }
+}
+
+void Customer::getRecommendations(const uint32_t &productId) const {
+    Arena arena;
+    try {
+        // A single lookup, the neighbours were computed offline
+        auto neighbours = Recommendations::getInstance().lookup(productId);
+        if (neighbours.empty()) {
+            Utils::log(Utils::LogLevel::TRACE, *logFile, arena.format("No recommendations for product {}.", productId));
+            return;
+        }
+
+        std::vector<uint32_t> productIds;
+        productIds.reserve(neighbours.size());
+        for (const auto &neighbour: neighbours) productIds.push_back(neighbour.productId);
+
+        // Connect to `ecommerce` db as `customer` user using conn2PostgresReadOnly
+        auto conn = conn2PostgresReadOnly("ecommerce", "customer", "customer", sessionKey());
+        auto query = arena.format("SELECT {} FROM products WHERE id = ANY({}) AND amount != -1;", columnList<ProductRow>(), idArray(productIds, arena));
+        pqxx::read_transaction tx(*conn);
+        pqxx::result R = tx.exec(query);
+        tx.commit();
+
+        // Print most frequent first, removed products are skipped
+        auto products = decodeRows<ProductRow>(R);
+        for (const auto &neighbour: neighbours) {
+            auto product = std::ranges::find(products, neighbour.productId, &ProductRow::id);
+            if (product == products.end()) continue;
+            Utils::log(Utils::LogLevel::TRACE, *logFile, arena.format("{} (id {}, price {}), bought together in {} orders", product->name, product->id, product->price, neighbour.count));
+        }
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to fetch recommendations: {}", e.what()));
     }
 }
 
@@ -72,50 +156,35 @@ void Customer::addProductToCart(const uint32_t &productId, const std::optional<u
      * 2. Add X amount of the product to the cart.
      */
 
+    Arena arena;
     // Validate amount
     if (amount && amount.value() <= 0) {
-        Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to add product to cart, invalid amount: {}", amount.value()));
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to add product to cart, invalid amount: {}", amount.value()));
         return;
     } else if (!amount) Utils::log(Utils::LogLevel::TRACE, *logFile, "Quantity not provided, defaulting to 1.");
 
 
     try {
-        // Connect to `ecommerce` db as `customer` user using conn2Postgres
-        auto pgConn = conn2Postgres("ecommerce", "customer", "customer");
+        // Connect to `ecommerce` db as `customer` user using conn2PostgresReadOnly
+        auto pgConn = conn2PostgresReadOnly("ecommerce", "customer", "customer", sessionKey());
 
         // Build query from parameters
-        std::string query = std::format("SELECT name, supplier_id, price FROM products WHERE id = {} AND amount != -1;", productId);
+        auto query = arena.format("SELECT {} FROM products WHERE id = {} AND amount != -1;", columnList<ProductRow>(), productId);
 
-        // Execute query
-        pqxx::work tx(*pgConn);
-        auto [name, supplierId, price] = tx.query1<std::string, std::string, std::string>(query);
+        // Execute query, the row is decoded in place and its name points into the result
+        pqxx::read_transaction tx(*pgConn);
+        pqxx::result R = tx.exec(query);
         tx.commit();
+        auto product = decodeRow<ProductRow>(R.one_row());
 
-        // Add product to cart
-        auto rdConn = conn2Redis();
-
-        std::string productKey = std::format("cart:{}:{}", id, productId);
-        std::unordered_map<std::string, std::string> productData{{"name", name}, {"supplierId", supplierId}, {"price", price}};
+        // Add product to cart, at its current price
+        CartStore::getInstance().add(id, productId, {amount.value_or(1), product.price, product.supplierId});
 
-        // Check if the product is already in the cart, if so, update the amount
-        std::optional<std::string> currentAmount = rdConn->hget(productKey, "amount");
-        uint32_t newAmount = amount.value_or(1);
-        if (currentAmount) newAmount += std::stoi(currentAmount.value());
-        productData["amount"] = std::to_string(newAmount);
-
-        rdConn->hset(productKey, productData.begin(), productData.end());
-
-        // Update the total price of the cart
-        uint32_t productTotalPrice = std::stoi(price) * amount.value_or(1);
-        std::string totalPriceKey = std::format("cart:{}:total_price", id);
-        if (!rdConn->exists(totalPriceKey)) rdConn->set(totalPriceKey, "0");
-        rdConn->incrby(totalPriceKey, productTotalPrice);
-
-        Utils::log(Utils::LogLevel::TRACE, *logFile, std::format("Added {}x `{}` to the cart. Total price updated by {}", amount.value_or(1), name, productTotalPrice));
+        Utils::log(Utils::LogLevel::TRACE, *logFile, arena.format("Added {}x `{}` to the cart. Total price updated by {}", amount.value_or(1), product.name, product.price * amount.value_or(1)));
     } catch (const sw::redis::Error &e) {
-        Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to add product to cart: {}", e.what()));
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to add product to cart: {}", e.what()));
     } catch (const std::exception &e) {
-        Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to add product to cart: {}", e.what()));
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to add product to cart: {}", e.what()));
     }
 }
 
@@ -130,139 +199,100 @@ void Customer::removeProductFromCart(const uint32_t &productId, const std::optio
      * 2. Remove X amount of the product from the cart.
      */
 
+    Arena arena;
     // Validate amount
     if (amount && amount.value() <= 0) {
-        Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to remove product from cart, invalid amount: {}", amount.value()));
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to remove product from cart, invalid amount: {}", amount.value()));
         return;
     } else if (!amount) Utils::log(Utils::LogLevel::TRACE, *logFile, "Quantity not provided, defaulting to max.");
 
     try {
-        // Connect to the redis server
-        auto conn = conn2Redis();
-
-        // Get the product from cart
-        std::string productKey = std::format("cart:{}:{}", id, productId);
-
-        // Get the product's current amount to decide if and how much to remove
-        std::optional<std::string> currentQuantity = conn->hget(productKey, "amount");
-        std::optional<std::string> price = conn->hget(productKey, "price");
-        if (!currentQuantity) {
+        // Remove the product from the cart, if it holds enough of it
+        auto removal = CartStore::getInstance().remove(id, productId, amount);
+        if (removal.status == CartStore::Removal::Status::NOT_FOUND) {
             Utils::log(Utils::LogLevel::ERROR, *logFile, "Failed to remove product from cart, product not found in cart.");
             return;
-        } else if (amount && std::stoi(currentQuantity.value()) < static_cast<int>(amount.value())) {
+        }
+        if (removal.status == CartStore::Removal::Status::NOT_ENOUGH) {
             Utils::log(Utils::LogLevel::ERROR, *logFile, "Failed to remove product from cart, not enough amount in cart.");
             return;
         }
+        uint32_t removedAmount = removal.amount;
+        uint32_t productTotalPrice = removal.price * removedAmount;
 
-        // Calculate the total price to be subtracted
-        uint32_t productTotalPrice = std::stoi(price.value()) * amount.value_or(std::stoi(currentQuantity.value()));
+        Utils::log(Utils::LogLevel::TRACE, *logFile, arena.format("Removed {}x product from the cart. Total price updated by {}", removedAmount, -static_cast<int64_t>(productTotalPrice)));
+    } catch (const sw::redis::Error &e) {
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to remove product from cart: {}", e.what()));
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to remove product from cart: {}", e.what()));
+    }
+}
 
-        // Remove the product from the cart
-        if (amount && std::stoi(currentQuantity.value()) > static_cast<int>(amount.value())) {
-            conn->hincrby(productKey, "amount", -static_cast<int>(amount.value()));
-        } else {
-            conn->del(productKey);
-        }
+Cart Customer::readCart(bool withNames) const {
+    Arena arena;
+    Cart cart = CartStore::getInstance().read(id);
+    if (!withNames || cart.empty()) return cart;
 
-        // Update the total price of the cart
-        std::string totalPriceKey = std::format("cart:{}:total_price", id);
-        conn->decrby(totalPriceKey, productTotalPrice);
+    // Resolve the names from the catalog, they are not duplicated in every cart
+    std::pmr::string productIds(arena.resource());
+    for (const auto &line: cart) std::format_to(std::back_inserter(productIds), "{}{}", productIds.empty() ? "" : ", ", line.productId);
 
-        Utils::log(Utils::LogLevel::TRACE, *logFile,
-                   std::format("Removed {}x product from the cart. Total price updated by {}", amount.value_or(std::stoi(currentQuantity.value())), -productTotalPrice));
-    } catch (sw::redis::Error &e) {
-        Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to remove product from cart: {}", e.what()));
-    }
+    auto conn = conn2PostgresReadOnly("ecommerce", "customer", "customer", sessionKey());
+    pqxx::read_transaction tx(*conn);
+    cart.resolveNames(tx.exec(arena.format("SELECT id, name FROM products WHERE id IN ({});", productIds)));
+    tx.commit();
+
+    return cart;
 }
 
-std::map<std::string, std::unordered_map<std::string, std::string>> Customer::getCart() const {
-    std::map<std::string, std::unordered_map<std::string, std::string>> completeCart;
+Cart Customer::getCart() const {
+    Arena arena;
+    Cart cart;
     try {
-        // Connect to the redis server
-        auto conn = conn2Redis();
-
-        // Retrieve the prodKeys of the products in the cart of the customer
-        std::string pattern = std::format("cart:{}:*", id);
-        std::unordered_set<std::string> prodKeys;
-        long long cursor = 0LL;
-        do {
-            cursor = conn->scan(cursor, pattern, 10, std::inserter(prodKeys, prodKeys.end()));
-        } while (cursor != 0);
-        prodKeys.erase(std::format("cart:{}:total_price", id));
-
-        // Iterate over the prodKeys and print the contents of the hashsets
-        for (const auto &key: prodKeys) {
-            std::unordered_map<std::string, std::string> prodData;
-            conn->hgetall(key, std::inserter(prodData, prodData.begin()));
-            completeCart[key.substr(key.find(':', key.find(':') + 1) + 1)] = prodData;
-        }
-        Utils::log(Utils::LogLevel::TRACE, *logFile, completeCart.empty() ? "Cart is empty." : "Cart fetched.");
-    } catch (const sw::redis::Error &e) {
-        Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to get cart: {}", e.what()));
+        cart = readCart(true);
+        Utils::log(Utils::LogLevel::TRACE, *logFile, cart.empty() ? "Cart is empty." : "Cart fetched.");
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to get cart: {}", e.what()));
     }
 
-    return completeCart;
+    return cart;
 }
 
 void Customer::printCart() const {
+    Arena arena;
     auto cart = getCart();
     if (cart.empty()) {
         Utils::log(Utils::LogLevel::TRACE, *logFile, "Cart is empty.");
         return;
     }
 
-    std::ostringstream oss;
-    for (const auto &[productKey, productData]: cart) {
-        oss << "\nProduct: " << productKey << " {\n";
-        for (const auto &[field, value]: productData) {
-            oss << "\t" << field << ": " << value << std::endl;
-        }
-        oss << "}";
+    std::pmr::string out(arena.resource());
+    for (const auto &line: cart) {
+        std::format_to(std::back_inserter(out), "\nProduct: {} {{\n\tname: {}\n\tamount: {}\n\tprice: {}\n\tsupplierId: {}\n}}",
+                       line.productId, line.name, line.amount, line.price, line.supplierId);
     }
-    Utils::log(Utils::LogLevel::TRACE, *logFile, std::format("{}\nTotal price: {}", oss.str(), getCartTotalPrice()));
+    Utils::log(Utils::LogLevel::TRACE, *logFile, arena.format("{}\nTotal price: {}", out, cart.totalPrice()));
 }
 
 uint32_t Customer::getCartTotalPrice() const {
+    Arena arena;
     try {
-        // Connect to the redis server
-        auto conn = conn2Redis();
-
-        // Get the total price
-        std::string totalPriceKey = std::format("cart:{}:total_price", id);
-        std::optional<std::string> totalPrice = conn->get(totalPriceKey);
-
-        return totalPrice ? std::stoi(totalPrice.value()) : 0;
-    } catch (const sw::redis::Error &e) {
-        Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to get total price of cart: {}", e.what()));
+        // The total is not stored separately, it is summed while the cart is parsed
+        return readCart(false).totalPrice();
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to get total price of cart: {}", e.what()));
         return 0;
     }
 }
 
 void Customer::clearCart() {
+    Arena arena;
     try {
-        // Connect to the redis server
-        auto conn = conn2Redis();
-
-        // Retrieve all keys for the customer's cart products
-        std::string pattern = std::format("cart:{}:*", id);
-        std::unordered_set<std::string> keysToDelete;
-        auto cursor = 0LL;
-        do {
-            cursor = conn->scan(cursor, pattern, 10, std::inserter(keysToDelete, keysToDelete.end()));
-        } while (cursor != 0);
-
-        // Delete each key
-        for (const auto &key: keysToDelete) {
-            conn->del(key);
-        }
-
-        // Delete the main cart key
-        std::string mainCartKey = "cart:" + id;
-        conn->del(mainCartKey);
+        CartStore::getInstance().clear(id);
 
         Utils::log(Utils::LogLevel::TRACE, *logFile, "Cart cleared.");
-    } catch (const sw::redis::Error &e) {
-        Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to clear cart: {}", e.what()));
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to clear cart: {}", e.what()));
     }
 }
 
@@ -275,70 +305,154 @@ void Customer::makeOrder(const std::string &address) {
      *  1.2. If all items are available, continue.
      *  1.3. If the cart is empty, log an error and return.
      * 2. Create an order with the items in the cart.
-     * 3. Remove the items from the Redis cart.
+     * 3. Remove the items from the cart.
      * 4. Update the customer's and suppliers' balances.
      * 5. Update the products and orders tables.
      */
 
+    Arena arena;
+    // Released if the order cannot be created
+    std::optional<uint32_t> transporterId;
+    std::vector<InventoryReservations::Line> reserved;
+    auto releaseAll = [&] {
+        if (transporterId) TransporterDispatcher::getInstance().release(transporterId.value());
+        InventoryReservations::getInstance().release(reserved);
+    };
+
     try {
+        // Fetch the balance and the cart concurrently
+        auto [balance, cart] = EventLoop::getInstance().runSync(fetchCheckoutState());
+        uint32_t totalPrice = cart.totalPrice();
+
         // Verify that the user has enough balance
-        uint32_t totalPrice = getCartTotalPrice();
-        if (getBalance() < totalPrice) {
+        if (balance < totalPrice) {
             Utils::log(Utils::LogLevel::ERROR, *logFile, "Failed to make order, not enough balance.");
             return;
         }
 
-        // Get the cart
-        auto cart = getCart();
+        // Verify that the cart is not empty
         if (cart.empty()) {
             Utils::log(Utils::LogLevel::ERROR, *logFile, "Failed to make order, cart is empty.");
             return;
         }
 
-        // Connect to the redis server
-        auto rdConn = conn2Redis();
+        // Reserve the stock of the hot products in Redis, the stock of the others is checked and taken in Postgres
+        std::vector<InventoryReservations::Line> lines;
+        lines.reserve(cart.size());
+        for (const auto &line: cart) lines.push_back({line.productId, line.amount});
+        auto reservation = InventoryReservations::getInstance().reserve(lines);
+        if (!reservation) {
+            Utils::log(Utils::LogLevel::ERROR, *logFile, "Failed to make order, not enough stock for a product.");
+            return;
+        }
+        reserved = std::move(reservation.value());
+        auto isReserved = [&](const CartLine &line) {
+            return std::ranges::binary_search(reserved, line.productId, {}, &InventoryReservations::Line::productId); // Same order as the cart
+        };
+
+        // Pick the least loaded transporter. In pool mode, or if no transporter is logged in,
+        // the order is left unassigned for a transporter to claim it.
+        if (!TransporterDispatcher::getInstance().isPooled()) transporterId = TransporterDispatcher::getInstance().assign();
+        bool pooled = !transporterId;
 
         // Connect to `ecommerce` db as `customer` user using conn2Postgres
         auto conn = conn2Postgres("ecommerce", "customer", "customer");
         pqxx::work tx(*conn);
 
-        // Step 1: Insert the new order and get the order ID
-        std::string insertOrderQuery = std::format("SELECT make_order({}, {}, '{}');", id, totalPrice, address);
-        auto newOrderId = tx.query_value<uint32_t>(insertOrderQuery);
-
-        // Steps 2-4
-        for (auto &[productKey, productData]: cart) {
-            // Verify that each product is still available
-            std::string query = std::format("SELECT amount FROM products WHERE id = {};", productKey);
-            auto productAmount = tx.query_value<int32_t>(query);
-
-            if (std::stoi(productData["amount"]) > productAmount) {
-                Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to make order, not enough stock for product {}", productKey));
-                return;
+        // Step 1: Insert the new order and, in the same batch, verify that each product is still available
+        uint32_t newOrderId;
+        {
+            StatementBatch batch(tx);
+            size_t orderIndex = pooled ? batch.add(arena.format("SELECT make_pooled_order({}, {}, '{}');", id, totalPrice, address))
+                                       : batch.add(arena.format("SELECT make_order({}, {}, '{}', {});", id, totalPrice, address, transporterId.value()));
+            std::vector<std::pair<const CartLine *, size_t>> stockIndexes;
+            stockIndexes.reserve(cart.size());
+            for (const auto &line: cart) {
+                if (!isReserved(line)) stockIndexes.emplace_back(&line, batch.add(arena.format("SELECT amount FROM products WHERE id = {};", line.productId)));
+            }
+            batch.flush();
+
+            newOrderId = batch.get(orderIndex).one_field().as<uint32_t>();
+            for (const auto &[line, stockIndex]: stockIndexes) {
+                auto productAmount = batch.get(stockIndex).one_field().as<int32_t>();
+                if (static_cast<int64_t>(line->amount) > productAmount) {
+                    Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to make order, not enough stock for product {}", line->productId));
+                    releaseAll();
+                    return;
+                }
             }
+        }
 
-            // Step 2-3: Add each product to the order_items table, update the products table
-            std::string insertOrderItemQuery = std::format("SELECT add_order_item({}, {}, {}, {}, {});", newOrderId, productKey, productData["amount"], productData["price"], productData["supplierId"]);
-            tx.exec(insertOrderItemQuery);
+        // Steps 2-4: queue the order items and the supplier payments, they are independent of each other
+        {
+            StatementBatch batch(tx);
+            std::vector<std::pair<uint32_t, uint32_t>> supplierPayments; // Supplier id -> payment, carts only have a few suppliers
+            supplierPayments.reserve(cart.size());
+            for (const auto &line: cart) {
+                // Step 2-3: Add each product to the order_items table, update the products table (or log the reservation of hot products)
+                batch.add(arena.format("SELECT {}({}, {}, {}, {}, {});", isReserved(line) ? "add_reserved_order_item" : "add_order_item",
+                                      newOrderId, line.productId, line.amount, line.price, line.supplierId));
+
+                auto payment = std::ranges::find(supplierPayments, line.supplierId, &std::pair<uint32_t, uint32_t>::first);
+                if (payment == supplierPayments.end()) supplierPayments.emplace_back(line.supplierId, line.price * line.amount);
+                else payment->second += line.price * line.amount;
+            }
 
-            // Step 4: Update the supplier's balance
-            uint32_t productPrice = std::stoi(productData["price"]) * std::stoi(productData["amount"]);
-            std::string updateSupplierBalanceQuery = std::format("SELECT set_balance('supplier', {}, {});", productData["supplierId"], productPrice);
-            tx.exec(updateSupplierBalanceQuery);
+            // Step 4: Pay each supplier once, through the balance ledger
+            for (const auto &[supplierId, payment]: supplierPayments) batch.add(arena.format("SELECT pay_supplier({}, {});", supplierId, payment));
+            batch.flush();
+            for (size_t i = 0; i < batch.size(); ++i) batch.get(i); // Rethrow the first failure, if any
         }
 
-        // Step 6: Remove items from Redis cart and reset the total price
+        // Step 6: Remove items from the cart and reset the total price
         clearCart();
 
         // Commit the transaction
         tx.commit();
+        markPostgresWrite(sessionKey());
+        if (!reserved.empty()) InventoryReservations::getInstance().markLogged();
+        // The order now owns the stock and the transporter, a failure below must not hand them back
+        reserved.clear();
+        transporterId.reset();
+
+        // Count the sales in the product rankings, only once the order is committed
+        std::vector<ProductRankings::Sale> sales;
+        sales.reserve(cart.size());
+        for (const auto &line: cart) sales.push_back({line.productId, line.supplierId, line.amount});
+        ProductRankings::getInstance().recordSales(sales);
 
         // Step 5: update the customer's balance
         setBalance(-static_cast<int32_t>(totalPrice));
-        Utils::log(Utils::LogLevel::TRACE, *logFile, std::format("Order made, tracking id: {}", newOrderId));
+        Utils::log(Utils::LogLevel::TRACE, *logFile, arena.format("Order made, tracking id: {}", newOrderId));
     } catch (const sw::redis::Error &e) {
-        Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to make order: {}", e.what()));
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to make order: {}", e.what()));
+        releaseAll();
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to make order: {}", e.what()));
+        releaseAll();
+    }
+}
+
+Task<std::tuple<uint32_t, Cart>> Customer::fetchCheckoutState() const {
+    // Send the balance query, it stays in flight while the loop is free to serve other coroutines...
+    auto &db = AsyncPostgres::getInstance("ecommerce", "customer", "customer");
+    auto balance = db.queryValue<uint32_t>(AsyncPostgres::ResultFormat::BINARY, "SELECT get_balance_customer($1);", id);
+    balance.start();
+
+    // ...and meanwhile read the cart on a helper thread. Checkout does not need the product names.
+    // The balance query is awaited even if the cart cannot be read: its state lives in `balance`,
+    // which must not be destroyed while the connection still refers to it.
+    std::optional<Cart> cart;
+    std::exception_ptr cartError;
+    try {
+        cart = co_await EventLoop::getInstance().offload([this] { return readCart(false); });
+    } catch (...) {
+        cartError = std::current_exception();
     }
+    uint32_t balanceValue = co_await balance;
+    if (cartError) std::rethrow_exception(cartError);
+
+    co_return std::tuple{balanceValue, std::move(cart.value())};
 }
 
 void Customer::cancelOrder(const uint32_t &orderId) {
@@ -347,35 +461,46 @@ void Customer::cancelOrder(const uint32_t &orderId) {
      * This doesn't effectively delete the order rom the db, but it marks it as cancelled.
      */
 
+    Arena arena;
     try {
         // Connect to `ecommerce` db as `customer` user using conn2Postgres
         auto conn = conn2Postgres("ecommerce", "customer", "customer");
 
-        // Check if the order exists
-        std::string query = std::format("SELECT * FROM orders WHERE id = {} AND customer_id = '{}';", orderId, id);
+        // Check if the order exists and cancel it in the same batch, `set_order_status` validates the order on its own.
+        // If any check fails the transaction is not committed, so the status change is discarded.
+        std::string userType = userTypeToString(getUserType());
         pqxx::work tx(*conn);
-        pqxx::result R = tx.exec(query);
+        std::optional<uint32_t> transporterId;
+        {
+            StatementBatch batch(tx);
+            size_t orderIndex = batch.add(arena.format("SELECT {} FROM orders WHERE id = {} AND customer_id = '{}';", columnList<OrderRow>(), orderId, id));
+            size_t cancelIndex = batch.add(arena.format("SELECT set_order_status('{}', {}, {}, 'cancelled');", userType, id, orderId));
+            batch.flush();
+
+            pqxx::result R = batch.get(orderIndex);
+            if (R.empty()) {
+                Utils::log(Utils::LogLevel::ERROR, *logFile, "Failed to cancel order, order not found.");
+                return;
+            }
 
-        if (R.empty()) {
-            Utils::log(Utils::LogLevel::ERROR, *logFile, "Failed to cancel order, order not found.");
-            return;
-        }
+            auto order = decodeRow<OrderRow>(R[0]);
+            if (order.status == "delivered" || order.status == "cancelled") {
+                Utils::log(Utils::LogLevel::ERROR, *logFile, "Failed to cancel order, order is already delivered or cancelled.");
+                return;
+            }
+            transporterId = order.transporterId;
 
-        auto orderStatus = R[0]["status"].as<std::string>();
-        if (orderStatus == "delivered" || orderStatus == "cancelled") {
-            Utils::log(Utils::LogLevel::ERROR, *logFile, "Failed to cancel order, order is already delivered or cancelled.");
-            return;
+            batch.get(cancelIndex);
         }
-
-        // Cancel the order
-        std::string userType = userTypeToString(getUserType());
-        query = std::format("SELECT set_order_status('{}', {}, {}, 'cancelled');", userType, id, orderId);
-        tx.exec(query);
         tx.commit();
+        markPostgresWrite(sessionKey());
+        OrderStatusNotifier::publish(orderId, Order::Status::CANCELLED);
+        if (transporterId) TransporterDispatcher::getInstance().release(transporterId.value()); // Unclaimed orders are in no backlog
+        ProductRankings::getInstance().recordCancellations(std::span(&orderId, 1));
 
-        Utils::log(Utils::LogLevel::TRACE, *logFile, std::format("Order cancelled: {}", orderId));
+        Utils::log(Utils::LogLevel::TRACE, *logFile, arena.format("Order cancelled: {}", orderId));
     } catch (const std::exception &e) {
-        Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to cancel order: {}", e.what()));
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to cancel order: {}", e.what()));
     }
 }
 
@@ -389,13 +514,14 @@ void Customer::getOrderStatus(const uint32_t &orderId) const {
      * 2. Print the status of the order.
      */
 
+    Arena arena;
     try {
-        // Connect to `ecommerce` db as `customer` user using conn2Postgres
-        auto conn = conn2Postgres("ecommerce", "customer", "customer");
+        // Connect to `ecommerce` db as `customer` user using conn2PostgresReadOnly
+        auto conn = conn2PostgresReadOnly("ecommerce", "customer", "customer", sessionKey());
 
         // Check if the order exists
-        std::string query = std::format("SELECT status FROM orders WHERE id = {} AND customer_id = '{}';", orderId, id);
-        pqxx::work tx(*conn);
+        auto query = arena.format("SELECT status FROM orders WHERE id = {} AND customer_id = '{}';", orderId, id);
+        pqxx::read_transaction tx(*conn);
         pqxx::result R = tx.exec(query);
         tx.commit();
 
@@ -404,19 +530,51 @@ void Customer::getOrderStatus(const uint32_t &orderId) const {
             return;
         }
 
-        Utils::log(Utils::LogLevel::TRACE, *logFile, std::format("Order {} status: {}", orderId, R[0]["status"].c_str()));
+        Utils::log(Utils::LogLevel::TRACE, *logFile, arena.format("Order {} status: {}", orderId, R[0]["status"].c_str()));
     } catch (const std::exception &e) {
-        Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to fetch order status: {}", e.what()));
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to fetch order status: {}", e.what()));
     }
 }
 
-void Customer::getOrdersHistory() const {
+void Customer::getOrderStatuses(std::span<const uint32_t> orderIds) const {
+    if (orderIds.empty()) return;
+
+    Arena arena;
     try {
-        // Connect to `ecommerce` db as `customer` user using conn2Postgres
-        auto conn = conn2Postgres("ecommerce", "customer", "customer");
+        // Connect to `ecommerce` db as `customer` user using conn2PostgresReadOnly
+        auto conn = conn2PostgresReadOnly("ecommerce", "customer", "customer", sessionKey());
 
-        std::string query = std::format("SELECT * FROM orders WHERE customer_id = {};", id);
-        pqxx::work tx(*conn);
+        // Look up every order at once
+        auto query = arena.format("SELECT id, status FROM orders WHERE customer_id = {} AND id = ANY({}) ORDER BY id;", id, idArray(orderIds, arena));
+        pqxx::read_transaction tx(*conn);
+        pqxx::result R = tx.exec(query);
+        tx.commit();
+
+        std::vector<uint32_t> found;
+        found.reserve(R.size());
+        for (const auto &row: R) {
+            found.push_back(row[0].as<uint32_t>());
+            Utils::log(Utils::LogLevel::TRACE, *logFile, arena.format("Order {} status: {}", found.back(), row[1].c_str()));
+        }
+        for (auto orderId: orderIds) {
+            if (!std::binary_search(found.begin(), found.end(), orderId)) {
+                Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to get order {} status, order not found.", orderId));
+            }
+        }
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to fetch order statuses: {}", e.what()));
+    }
+}
+
+void Customer::getOrdersHistory(const std::optional<uint32_t> &lastMonths) const {
+    Arena arena;
+    try {
+        // Connect to `ecommerce` db as `customer` user using conn2PostgresReadOnly
+        auto conn = conn2PostgresReadOnly("ecommerce", "customer", "customer", sessionKey());
+
+        // Bounding the timestamp lets Postgres skip the partitions of older months
+        auto query = arena.format("SELECT * FROM orders WHERE customer_id = {}{};", id, historyWindow(lastMonths));
+        pqxx::read_transaction tx(*conn);
         pqxx::result R = tx.exec(query);
         tx.commit();
 
@@ -426,6 +584,36 @@ void Customer::getOrdersHistory() const {
         }
         printRows(R);
     } catch (const std::exception &e) {
-        Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to fetch order history: {}", e.what()));
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to fetch order history: {}", e.what()));
     }
 }
+
+void Customer::subscribeToOrderStatus(const uint32_t &orderId, OrderStatusNotifier::Callback callback) {
+    Arena arena;
+    try {
+        // Connect to `ecommerce` db as `customer` user using conn2PostgresReadOnly
+        auto conn = conn2PostgresReadOnly("ecommerce", "customer", "customer", sessionKey());
+
+        // Check that the order belongs to the customer
+        auto query = arena.format("SELECT 1 FROM orders WHERE id = {} AND customer_id = {};", orderId, id);
+        pqxx::read_transaction tx(*conn);
+        pqxx::result R = tx.exec(query);
+        tx.commit();
+
+        if (R.empty()) {
+            Utils::log(Utils::LogLevel::ERROR, *logFile, "Failed to subscribe to order status, order not found.");
+            return;
+        }
+
+        OrderStatusNotifier::getInstance().subscribe(orderId, this, std::move(callback));
+        Utils::log(Utils::LogLevel::TRACE, *logFile, arena.format("Subscribed to status changes of order {}.", orderId));
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to subscribe to order status: {}", e.what()));
+    }
+}
+
+void Customer::unsubscribeFromOrderStatus(const uint32_t &orderId) {
+    Arena arena;
+    OrderStatusNotifier::getInstance().unsubscribe(orderId, this);
+    Utils::log(Utils::LogLevel::TRACE, *logFile, arena.format("Unsubscribed from status changes of order {}.", orderId));
+}
@@ -1,5 +1,9 @@
 #pragma once
 
+#include "../async/EventLoop.h"
+#include "../db/AsyncPostgres.h"
+#include "Cart.h"
+#include "CartStore.h"
 #include "User.h"
 
 /**
@@ -13,6 +17,21 @@ class Customer : public User {
 protected:
     [[nodiscard]] UserType getUserType() const override;
 
+    static constexpr uint32_t popularityDepth = 1000; ///< Products ranked when sorting a search by popularity, the others tie at 0.
+
+    /**
+     * Fetch the balance from Postgres while the cart is read, overlapping the two round trips.
+     * @return the balance and the cart
+     */
+    [[nodiscard]] Task<std::tuple<uint32_t, Cart>> fetchCheckoutState() const;
+
+    /**
+     * Read the cart from the cart store, without logging failures.
+     * @param withNames whether to resolve the product names from the catalog, at the cost of a query
+     * @return the cart
+     */
+    [[nodiscard]] Cart readCart(bool withNames) const;
+
 public:
     explicit Customer(std::string name) : User(std::move(name)) {
         try {
@@ -25,6 +44,7 @@ public:
     };
 
     ~Customer() override {
+        OrderStatusNotifier::getInstance().unsubscribeAll(this);
         if (loggedInSuccessfully) User::logout();
     };
 
@@ -60,13 +80,14 @@ public:
      *  - name
      *  - supplier_username
      *  - price
+     *  - popularity (trending sales, see ProductRankings)
      * Multiple sorting criteria can be used, and each one can be sorted in ascending or descending order.
      *
      * @param name The name of the product to filter for.
      * @param supplierUsername The username of the supplier to filter for.
      * @param priceLowerBound The lower bound of the price range to filter for.
      * @param priceUpperBound The upper bound of the price range to filter for.
-     * @param orderBy The columns to sort the results by. (Can be "name", "supplier_username" or "price". The bool indicates the sorting order, true -> ascending, false -> descending.)
+     * @param orderBy The columns to sort the results by. (Can be "name", "supplier_username", "price" or "popularity". The bool indicates the sorting order, true -> ascending, false -> descending.)
      */
     void searchProduct(const std::optional<std::string> &name,
                                         const std::optional<std::string> &supplierUsername,
@@ -74,6 +95,19 @@ public:
                                         const std::optional<uint32_t> &priceUpperBound,
                                         const std::optional<std::vector<std::pair<std::string, bool>>> &orderBy) const;
 
+    /**
+     * Get the best selling products.
+     * @param k the maximum number of products to list.
+     * @param window the period to rank the products over.
+     */
+    void getBestsellers(uint32_t k, ProductRankings::Window window = ProductRankings::Window::TRENDING) const;
+
+    /**
+     * Get the products most often bought together with a product, see `--build-recommendations`.
+     * @param productId the id of the product.
+     */
+    void getRecommendations(const uint32_t &productId) const;
+
     // Cart related methods
 
     /**
@@ -91,9 +125,9 @@ public:
     void removeProductFromCart(const uint32_t &productId, const std::optional<uint32_t> &amount);
 
     /**
-     * Get the contents of the cart.
+     * Get the contents of the cart. Carts expire after `CartCodec::ttl` without modification.
      */
-    [[nodiscard]] std::map<std::string, std::unordered_map<std::string, std::string>> getCart() const;
+    [[nodiscard]] Cart getCart() const;
 
     /**
      * Print the contents of the cart.
@@ -129,8 +163,27 @@ public:
      * @param orderId the id of the order to get the status of.
      */
     void getOrderStatus(const uint32_t &orderId) const;
+
+    /**
+     * Get the status of a batch of orders with a single query.
+     * @param orderIds the ids of the orders to get the status of.
+     */
+    void getOrderStatuses(std::span<const uint32_t> orderIds) const;
     /**
      * Get the history of orders.
+     * @param lastMonths only show the orders of the current month and of this many months before it. Defaults to every order.
+     */
+    void getOrdersHistory(const std::optional<uint32_t> &lastMonths = std::nullopt) const;
+    /**
+     * Get notified of every status change of an order, instead of polling `getOrderStatus`.
+     * @param orderId the id of the order to follow.
+     * @param callback the function to call with the new status, invoked on the notifier thread.
+     */
+    void subscribeToOrderStatus(const uint32_t &orderId, OrderStatusNotifier::Callback callback);
+
+    /**
+     * Stop receiving the status changes of an order.
+     * @param orderId the id of the order to stop following.
      */
-    void getOrdersHistory() const;
+    void unsubscribeFromOrderStatus(const uint32_t &orderId);
 };
@@ -0,0 +1,79 @@
+#include "MemoryCartStore.h"
+#include <algorithm>
+
+MemoryCartStore::MemoryCartStore() : sweepTask("cart sweep", sweepInterval, [this] { sweep(); }) {}
+
+MemoryCartStore::Stripe &MemoryCartStore::stripeOf(const std::string &customerId) { return stripes[std::hash<std::string>{}(customerId) % stripeCount]; }
+
+MemoryCartStore::Entry *MemoryCartStore::find(Stripe &stripe, const std::string &customerId) {
+    auto it = stripe.carts.find(customerId);
+    if (it == stripe.carts.end()) return nullptr;
+    if (it->second.expiry <= std::chrono::steady_clock::now()) {
+        stripe.carts.erase(it);
+        return nullptr;
+    }
+    return &it->second;
+}
+
+void MemoryCartStore::add(const std::string &customerId, uint32_t productId, const CartCodec::Item &item) {
+    Stripe &stripe = stripeOf(customerId);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    Entry *entry = find(stripe, customerId);
+    if (!entry) entry = &stripe.carts[customerId];
+
+    // If the product is already in the cart, update the amount. The price is refreshed to the current one.
+    auto line = std::ranges::lower_bound(entry->lines, productId, {}, &Line::productId);
+    if (line != entry->lines.end() && line->productId == productId) line->item = {line->item.amount + item.amount, item.price, item.supplierId};
+    else entry->lines.insert(line, {productId, item});
+    entry->expiry = std::chrono::steady_clock::now() + CartCodec::ttl;
+}
+
+CartStore::Removal MemoryCartStore::remove(const std::string &customerId, uint32_t productId, std::optional<uint32_t> amount) {
+    Stripe &stripe = stripeOf(customerId);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    Entry *entry = find(stripe, customerId);
+    if (!entry) return {Removal::Status::NOT_FOUND};
+
+    auto line = std::ranges::lower_bound(entry->lines, productId, {}, &Line::productId);
+    if (line == entry->lines.end() || line->productId != productId) return {Removal::Status::NOT_FOUND};
+    if (amount && line->item.amount < amount.value()) return {Removal::Status::NOT_ENOUGH};
+
+    uint32_t removedAmount = amount.value_or(line->item.amount);
+    uint32_t price = line->item.price;
+    if (removedAmount < line->item.amount) line->item.amount -= removedAmount;
+    else entry->lines.erase(line);
+
+    // An empty cart is dropped, like an empty hash in Redis
+    if (entry->lines.empty()) stripe.carts.erase(customerId);
+    else entry->expiry = std::chrono::steady_clock::now() + CartCodec::ttl;
+    return {Removal::Status::REMOVED, removedAmount, price};
+}
+
+Cart MemoryCartStore::read(const std::string &customerId) {
+    std::vector<CartLine> lines;
+    {
+        Stripe &stripe = stripeOf(customerId);
+        std::lock_guard<std::mutex> lock(stripe.mutex);
+        Entry *entry = find(stripe, customerId);
+        if (!entry) return {};
+        lines.reserve(entry->lines.size());
+        for (const auto &[productId, item]: entry->lines) lines.push_back({productId, item.amount, item.price, item.supplierId, {}});
+    }
+    return Cart::fromLines(std::move(lines));
+}
+
+void MemoryCartStore::clear(const std::string &customerId) {
+    Stripe &stripe = stripeOf(customerId);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    stripe.carts.erase(customerId);
+}
+
+void MemoryCartStore::sweep() {
+    auto now = std::chrono::steady_clock::now();
+    size_t swept = 0;
+    for (auto &stripe: stripes) {
+        std::lock_guard<std::mutex> lock(stripe.mutex);
+        swept += std::erase_if(stripe.carts, [now](const auto &cart) { return cart.second.expiry <= now; });
+    }
+    if (swept) Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("{} abandoned carts expired.", swept));
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "../async/PeriodicTask.h"
+#include "CartStore.h"
+#include <array>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * The in-process backend of the cart store
+ *
+ * @details The carts are spread over `stripeCount` stripes by the hash of the customer id, each stripe a hash map
+ * guarded by its own mutex, so customers on different stripes never contend. A cart is a vector of lines sorted by
+ * product id: carts hold a few products, a binary search over contiguous lines beats a map.
+ * Like in Redis, a cart expires once abandoned for `CartCodec::ttl`: expired carts read as empty,
+ * and are freed by a sweep every `sweepInterval`.
+ * The carts are lost when the process exits, and are not shared with other processes.
+ */
+class MemoryCartStore : public CartStore {
+public:
+    MemoryCartStore();
+
+    void add(const std::string &customerId, uint32_t productId, const CartCodec::Item &item) override;
+    Removal remove(const std::string &customerId, uint32_t productId, std::optional<uint32_t> amount) override;
+    Cart read(const std::string &customerId) override;
+    void clear(const std::string &customerId) override;
+
+private:
+    static constexpr size_t stripeCount = 64;
+    static constexpr std::chrono::minutes sweepInterval{10};
+
+    struct Line {
+        uint32_t productId;
+        CartCodec::Item item;
+    };
+
+    struct Entry {
+        std::vector<Line> lines; ///< Sorted by product id.
+        std::chrono::steady_clock::time_point expiry;
+    };
+
+    struct alignas(64) Stripe { // On its own cache line, so that locking a stripe does not slow down its neighbours
+        std::mutex mutex;
+        std::unordered_map<std::string, Entry> carts; ///< Customer id -> cart, guarded by `mutex`.
+    };
+
+    Stripe &stripeOf(const std::string &customerId);
+
+    /**
+     * Find a cart, dropping it if it expired. The stripe must be locked.
+     * @return the cart, nullptr if the customer has none
+     */
+    static Entry *find(Stripe &stripe, const std::string &customerId);
+
+    /**
+     * Free the expired carts of every stripe.
+     */
+    void sweep();
+
+    std::array<Stripe, stripeCount> stripes;
+    PeriodicTask sweepTask; ///< Declared last, so that it stops before the stripes are destroyed.
+};
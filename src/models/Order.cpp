@@ -8,3 +8,10 @@ std::string Order::orderStatusToString(Order::Status orderStatus) {
         default: throw std::invalid_argument("Invalid order status");
     }
 }
+
+Order::Status Order::stringToOrderStatus(const std::string &orderStatus) {
+    if (orderStatus == "shipped") return Order::Status::SHIPPED;
+    if (orderStatus == "delivered") return Order::Status::DELIVERED;
+    if (orderStatus == "cancelled") return Order::Status::CANCELLED;
+    throw std::invalid_argument("Invalid order status");
+}
@@ -19,4 +19,6 @@ public:
     };
 
     static std::string orderStatusToString(Status orderStatus);
+
+    static Status stringToOrderStatus(const std::string &orderStatus);
 };
@@ -16,24 +16,25 @@ void Supplier::getProducts(const std::optional<std::string> &name,
                            const std::optional<uint32_t> &priceLowerBound,
                            const std::optional<uint32_t> &priceUpperBound,
                            const std::optional<std::vector<std::pair<std::string, bool>>> &orderBy) const {
+    Arena arena;
     try {
         // Connect to `ecommerce` db as `supplier`
-        auto conn = conn2Postgres("ecommerce", "supplier", "supplier");
+        auto conn = conn2PostgresReadOnly("ecommerce", "supplier", "supplier", sessionKey());
 
         // Build query from parameters
-        std::string query = std::format("SELECT * FROM products WHERE supplier_id = {}", id);
-        std::string filters;
+        auto query = arena.format("SELECT * FROM products WHERE supplier_id = {}", id);
+        std::pmr::string filters(arena.resource());
 
         // Filters
-        if (name) filters += std::format("name LIKE '%{}%' AND ", name.value());
-        if (priceLowerBound) filters += std::format("price >= {} AND ", priceLowerBound.value());
-        if (priceUpperBound) filters += std::format("price <= {} AND ", priceUpperBound.value());
+        if (name) filters += arena.format("name LIKE '%{}%' AND ", name.value());
+        if (priceLowerBound) filters += arena.format("price >= {} AND ", priceLowerBound.value());
+        if (priceUpperBound) filters += arena.format("price <= {} AND ", priceUpperBound.value());
 
         // Remove the last " AND " if it exists
-        if (!filters.empty() && filters.ends_with(" AND ")) filters = filters.substr(0, filters.length() - 5);
+        if (!filters.empty() && filters.ends_with(" AND ")) filters.resize(filters.length() - 5);
 
         // Add filters to the query if they exist
-        if (!filters.empty()) query += " AND " + filters;
+        if (!filters.empty()) query.append(" AND ").append(filters);
 
         // Sort
         if (orderBy) {
@@ -44,59 +45,64 @@ void Supplier::getProducts(const std::optional<std::string> &name,
                 query += ", ";
             }
             // Remove the last ", " if it exists
-            if (!orderBy.value().empty()) query = query.substr(0, query.length() - 2);
+            if (!orderBy.value().empty()) query.resize(query.length() - 2);
         }
         query += ";";
 
         // Execute query
-        pqxx::work tx(*conn);
+        pqxx::read_transaction tx(*conn);
         pqxx::result R = tx.exec(query);
         tx.commit();
 
         // Print results
         printRows(R);
     } catch (const std::exception &e) {
-        Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to search products: {}", e.what()));
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to search products: {}", e.what()));
     }
 }
 
 void Supplier::addProduct(const std::string &name, const uint32_t &price, const uint32_t &amount, const std::string &description) {
+    Arena arena;
     try {
         // Connect to `ecommerce` db as `supplier`
         auto conn = conn2Postgres("ecommerce", "supplier", "supplier");
 
         // Build the query to call the stored procedure
-        std::string query = std::format("SELECT add_product('{}', {}, {}, {}, '{}');", name, id, price, amount, description);
+        auto query = arena.format("SELECT add_product('{}', {}, {}, {}, '{}');", name, id, price, amount, description);
 
         // Execute query
         pqxx::work tx(*conn);
-        auto newProductId = tx.query_value<uint32_t>(query);
+        auto newProductId = tx.exec(query).one_field().as<uint32_t>();
         tx.commit();
+        markPostgresWrite(sessionKey());
 
-        Utils::log(Utils::LogLevel::TRACE, *logFile, std::format("Product added successfully: {}", newProductId));
+        Utils::log(Utils::LogLevel::TRACE, *logFile, arena.format("Product added successfully: {}", newProductId));
     } catch (const std::exception &e) {
-        Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to add a product: {}", e.what()));
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to add a product: {}", e.what()));
     }
 }
 
 void Supplier::removeProduct(const uint32_t &productId) {
+    Arena arena;
     try {
         // Connect to `ecommerce` db as `supplier`
         auto conn = conn2Postgres("ecommerce", "supplier", "supplier");
 
         // Build the query to call the stored procedure
-        std::string query = std::format("SELECT remove_product({});", productId);
+        auto query = arena.format("SELECT remove_product({});", productId);
 
         // Execute query
         pqxx::work tx(*conn);
-        auto removedProductId = tx.query_value<uint32_t>(query);
+        auto removedProductId = tx.exec(query).one_field().as<uint32_t>();
         tx.commit();
+        markPostgresWrite(sessionKey());
+        if (removedProductId) InventoryReservations::getInstance().discontinue(productId);
 
         // if removedProductId is 0 then the product was not removed, log accordingly
-        if (!removedProductId) Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to remove a product: product with id {} does not exist", productId));
-        else Utils::log(Utils::LogLevel::TRACE, *logFile, std::format("Product removed successfully: {}", removedProductId));
+        if (!removedProductId) Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to remove a product: product with id {} does not exist", productId));
+        else Utils::log(Utils::LogLevel::TRACE, *logFile, arena.format("Product removed successfully: {}", removedProductId));
     } catch (const std::exception &e) {
-        Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to remove a product: {}", e.what()));
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to remove a product: {}", e.what()));
     }
 }
 
@@ -105,39 +111,43 @@ void Supplier::editProduct(const uint32_t &productId,
                            const std::optional<uint32_t> &price,
                            const std::optional<uint32_t> &amount,
                            const std::optional<std::string> &description) {
+    Arena arena;
     try {
         // Connect to `ecommerce` db as `supplier`
         auto conn = conn2Postgres("ecommerce", "supplier", "supplier");
 
         // Build the query to call the stored procedure
-        std::string query = std::format("SELECT edit_product({}, {}, {}, {}, {});", productId,
-                                        name ? std::format("'{}'", name.value()) : "NULL",
-                                        price ? std::format("{}", price.value()) : "NULL",
-                                        amount ? std::format("{}", amount.value()) : "NULL",
-                                        description ? std::format("'{}'", description.value()) : "NULL");
+        auto query = arena.format("SELECT * FROM edit_product({}, {}, {}, {}, {});", productId,
+                                        name ? arena.format("'{}'", name.value()) : "NULL",
+                                        price ? arena.format("{}", price.value()) : "NULL",
+                                        amount ? arena.format("{}", amount.value()) : "NULL",
+                                        description ? arena.format("'{}'", description.value()) : "NULL");
 
         // Execute query
         pqxx::work tx(*conn);
-        auto editedProductId = tx.query_value<uint32_t>(query);
+        auto [editedProductId, previousAmount] = tx.query1<uint32_t, std::optional<int32_t>>(query);
         tx.commit();
+        markPostgresWrite(sessionKey());
+        if (editedProductId && amount) InventoryReservations::getInstance().adjust(productId, static_cast<int64_t>(amount.value()) - previousAmount.value());
 
         // if editedProductId is 0 then the product was not edited, log accordingly
-        if (!editedProductId) Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to edit a product: product with id {} does not exist", productId));
-        else Utils::log(Utils::LogLevel::TRACE, *logFile, std::format("Product edited successfully: {}", editedProductId));
+        if (!editedProductId) Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to edit a product: product with id {} does not exist", productId));
+        else Utils::log(Utils::LogLevel::TRACE, *logFile, arena.format("Product edited successfully: {}", editedProductId));
     } catch (const std::exception &e) {
-        Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to edit a product: {}", e.what()));
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to edit a product: {}", e.what()));
     }
 }
 
-void Supplier::getOrdersHistory() const {
+void Supplier::getOrdersHistory(const std::optional<uint32_t> &lastMonths) const {
+    Arena arena;
     try {
-        // Connect to `ecommerce` db as `supplier` user using conn2Postgres
-        auto conn = conn2Postgres("ecommerce", "supplier", "supplier");
+        // Connect to `ecommerce` db as `supplier` user using conn2PostgresReadOnly
+        auto conn = conn2PostgresReadOnly("ecommerce", "supplier", "supplier", sessionKey());
 
         // Check if the order exists
-        std::string query = std::format("SELECT DISTINCT o.* FROM orders o JOIN order_items oi ON o.id = oi.order_id WHERE oi.supplier_id = {};", id);
+        auto query = arena.format("SELECT order_id, status, total_price, timestamp FROM supplier_orders WHERE supplier_id = {}{} ORDER BY order_id;", id, historyWindow(lastMonths));
 
-        pqxx::work tx(*conn);
+        pqxx::read_transaction tx(*conn);
         pqxx::result R = tx.exec(query);
         tx.commit();
 
@@ -147,19 +157,20 @@ void Supplier::getOrdersHistory() const {
         }
         printRows(R);
     } catch (const std::exception &e) {
-        Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to fetch order history: {}", e.what()));
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to fetch order history: {}", e.what()));
     }
 }
 
 void Supplier::getOrderStatus(const uint32_t &orderId) const {
+    Arena arena;
     try {
-        // Connect to `ecommerce` db as `supplier` user using conn2Postgres
-        auto conn = conn2Postgres("ecommerce", "supplier", "supplier");
+        // Connect to `ecommerce` db as `supplier` user using conn2PostgresReadOnly
+        auto conn = conn2PostgresReadOnly("ecommerce", "supplier", "supplier", sessionKey());
 
         // Check if the order exists
-        std::string query = std::format("SELECT DISTINCT o.id, o.status FROM orders o JOIN order_items oi ON o.id = oi.order_id WHERE oi.supplier_id = {} AND o.id = {};", id, orderId);
+        auto query = arena.format("SELECT status FROM supplier_orders WHERE supplier_id = {} AND order_id = {};", id, orderId);
 
-        pqxx::work tx(*conn);
+        pqxx::read_transaction tx(*conn);
         pqxx::result R = tx.exec(query);
         tx.commit();
 
@@ -168,8 +179,123 @@ void Supplier::getOrderStatus(const uint32_t &orderId) const {
             return;
         }
 
-        Utils::log(Utils::LogLevel::TRACE, *logFile, std::format("Order {} status: {}", orderId, R[0]["status"].c_str()));
+        Utils::log(Utils::LogLevel::TRACE, *logFile, arena.format("Order {} status: {}", orderId, R[0]["status"].c_str()));
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to fetch order status: {}", e.what()));
+    }
+}
+
+void Supplier::getOrderStatuses(std::span<const uint32_t> orderIds) const {
+    if (orderIds.empty()) return;
+
+    Arena arena;
+    try {
+        // Connect to `ecommerce` db as `supplier` user using conn2PostgresReadOnly
+        auto conn = conn2PostgresReadOnly("ecommerce", "supplier", "supplier", sessionKey());
+
+        // Look up every order at once
+        auto query = arena.format("SELECT order_id, status FROM supplier_orders WHERE supplier_id = {} AND order_id = ANY({}) ORDER BY order_id;", id, idArray(orderIds, arena));
+        pqxx::read_transaction tx(*conn);
+        pqxx::result R = tx.exec(query);
+        tx.commit();
+
+        std::vector<uint32_t> found;
+        found.reserve(R.size());
+        for (const auto &row: R) {
+            found.push_back(row[0].as<uint32_t>());
+            Utils::log(Utils::LogLevel::TRACE, *logFile, arena.format("Order {} status: {}", found.back(), row[1].c_str()));
+        }
+        for (auto orderId: orderIds) {
+            if (!std::binary_search(found.begin(), found.end(), orderId)) {
+                Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to get order {} status, order not found.", orderId));
+            }
+        }
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to fetch order statuses: {}", e.what()));
+    }
+}
+
+void Supplier::subscribeToOrderStatus(const uint32_t &orderId, OrderStatusNotifier::Callback callback) {
+    Arena arena;
+    try {
+        // Connect to `ecommerce` db as `supplier` user using conn2PostgresReadOnly
+        auto conn = conn2PostgresReadOnly("ecommerce", "supplier", "supplier", sessionKey());
+
+        // Check that the order belongs to the supplier
+        auto query = arena.format("SELECT 1 FROM supplier_orders WHERE order_id = {} AND supplier_id = {};", orderId, id);
+        pqxx::read_transaction tx(*conn);
+        pqxx::result R = tx.exec(query);
+        tx.commit();
+
+        if (R.empty()) {
+            Utils::log(Utils::LogLevel::ERROR, *logFile, "Failed to subscribe to order status, order not found.");
+            return;
+        }
+
+        OrderStatusNotifier::getInstance().subscribe(orderId, this, std::move(callback));
+        Utils::log(Utils::LogLevel::TRACE, *logFile, arena.format("Subscribed to status changes of order {}.", orderId));
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to subscribe to order status: {}", e.what()));
+    }
+}
+
+void Supplier::unsubscribeFromOrderStatus(const uint32_t &orderId) {
+    Arena arena;
+    OrderStatusNotifier::getInstance().unsubscribe(orderId, this);
+    Utils::log(Utils::LogLevel::TRACE, *logFile, arena.format("Unsubscribed from status changes of order {}.", orderId));
+}
+
+void Supplier::getSalesReport(const std::chrono::year_month_day &from, const std::chrono::year_month_day &to, Granularity granularity) const {
+    if (!from.ok() || !to.ok() || from > to) {
+        Utils::log(Utils::LogLevel::ERROR, *logFile, "Failed to get sales report, invalid date range.");
+        return;
+    }
+
+    Arena arena;
+    try {
+        // Connect to `ecommerce` db as `supplier` user using conn2PostgresReadOnly
+        auto conn = conn2PostgresReadOnly("ecommerce", "supplier", "supplier", sessionKey());
+
+        // Only the daily rollups of the range are read, then grouped by period
+        const char *period = granularity == Granularity::DAY ? "day" : granularity == Granularity::WEEK ? "week" : "month";
+        auto query = arena.format(R"(
+            SELECT date_trunc('{}', s.day)::date AS period, s.product_id, p.name, SUM(s.quantity) AS quantity, SUM(s.revenue) AS revenue
+            FROM supplier_sales_daily s
+            JOIN products p ON p.id = s.product_id
+            WHERE s.supplier_id = {} AND s.day BETWEEN '{}' AND '{}'
+            GROUP BY period, s.product_id, p.name
+            HAVING SUM(s.quantity) > 0
+            ORDER BY period, s.product_id;
+        )", period, id, from, to);
+
+        pqxx::read_transaction tx(*conn);
+        pqxx::result R = tx.exec(query);
+        tx.commit();
+
+        if (R.empty()) {
+            Utils::log(Utils::LogLevel::TRACE, *logFile, "No sales in this range.");
+            return;
+        }
+        printRows(R);
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to fetch sales report: {}", e.what()));
+    }
+}
+
+void Supplier::getBestsellers(uint32_t k) const {
+    Arena arena;
+    try {
+        auto ranking = ProductRankings::getInstance().topOfSupplier(std::stoul(id), k);
+        if (ranking.empty()) {
+            Utils::log(Utils::LogLevel::TRACE, *logFile, "No bestsellers yet.");
+            return;
+        }
+
+        uint32_t rank = 0;
+        for (const auto &[productId, score]: ranking) {
+            Utils::log(Utils::LogLevel::TRACE, *logFile, arena.format("#{} product {} (score {:.1f})", ++rank, productId, score));
+        }
     } catch (const std::exception &e) {
-        Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to fetch order status: {}", e.what()));
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to fetch bestsellers: {}", e.what()));
     }
 }
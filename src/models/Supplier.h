@@ -1,6 +1,7 @@
 #pragma once
 
 #include "User.h"
+#include <chrono>
 
 /**
  * Implementation of a Supplier class.
@@ -13,6 +14,15 @@ protected:
     [[nodiscard]] UserType getUserType() const override;
 
 public:
+    /**
+     * The length of the periods of a sales report.
+     */
+    enum class Granularity {
+        DAY,
+        WEEK, ///< Weeks start on Monday.
+        MONTH
+    };
+
     explicit Supplier(std::string name) : User(std::move(name)) {
         try {
             User::openLogFile();
@@ -24,6 +34,7 @@ public:
     }
 
     ~Supplier() override {
+        OrderStatusNotifier::getInstance().unsubscribeAll(this);
         if (loggedInSuccessfully) User::logout();
     };
 
@@ -77,13 +88,50 @@ public:
     // Order related methods
 
     /**
-    * Get the history of orders.
-    */
-    void getOrdersHistory() const;
+     * Get the history of orders.
+     * @param lastMonths only show the orders of the current month and of this many months before it. Defaults to every order.
+     */
+    void getOrdersHistory(const std::optional<uint32_t> &lastMonths = std::nullopt) const;
 
     /**
      * Get the status of an order.
      * @param orderId the id of the order to get the status of.
      */
     void getOrderStatus(const uint32_t &orderId) const;
+
+    /**
+     * Get the status of a batch of orders with a single query.
+     * @param orderIds the ids of the orders to get the status of.
+     */
+    void getOrderStatuses(std::span<const uint32_t> orderIds) const;
+
+    /**
+     * Get notified of every status change of an order, instead of polling `getOrderStatus`.
+     * @param orderId the id of the order to follow.
+     * @param callback the function to call with the new status, invoked on the notifier thread.
+     */
+    void subscribeToOrderStatus(const uint32_t &orderId, OrderStatusNotifier::Callback callback);
+
+    /**
+     * Stop receiving the status changes of an order.
+     * @param orderId the id of the order to stop following.
+     */
+    void unsubscribeFromOrderStatus(const uint32_t &orderId);
+
+    // Analytics related methods
+
+    /**
+     * Get the quantity sold and the revenue of each product per period, cancelled orders excluded.
+     * Served from the daily rollups, so its cost depends on the days in the range rather than on the number of orders.
+     * @param from the first day of the report.
+     * @param to the last day of the report, included.
+     * @param granularity the length of the periods to group the days by. Periods are cut to the range.
+     */
+    void getSalesReport(const std::chrono::year_month_day &from, const std::chrono::year_month_day &to, Granularity granularity) const;
+
+    /**
+     * Get the trending products of the supplier, see ProductRankings.
+     * @param k the maximum number of products to list.
+     */
+    void getBestsellers(uint32_t k) const;
 };
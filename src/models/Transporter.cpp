@@ -1,4 +1,5 @@
 #include "Transporter.h"
+#include <unordered_map>
 
 User::UserType Transporter::getUserType() const { return User::UserType::TRANSPORTER; }
 
@@ -12,15 +13,16 @@ std::string Transporter::toString() const {
     return oss.str();
 }
 
-void Transporter::getOrdersHistory() const {
+void Transporter::getOrdersHistory(const std::optional<uint32_t> &lastMonths) const {
+    Arena arena;
     try {
-        // Connect to `ecommerce` db as `transporter` user using conn2Postgres
-        auto conn = conn2Postgres("ecommerce", "transporter", "transporter");
+        // Connect to `ecommerce` db as `transporter` user using conn2PostgresReadOnly
+        auto conn = conn2PostgresReadOnly("ecommerce", "transporter", "transporter", sessionKey());
 
-        // Check if the order exists
-        std::string query = std::format("SELECT * FROM orders WHERE transporter_id = {};", id);
+        // Bounding the timestamp lets Postgres skip the partitions of older months
+        auto query = arena.format("SELECT * FROM orders WHERE transporter_id = {}{};", id, historyWindow(lastMonths));
 
-        pqxx::work tx(*conn);
+        pqxx::read_transaction tx(*conn);
         pqxx::result R = tx.exec(query);
         tx.commit();
 
@@ -30,18 +32,19 @@ void Transporter::getOrdersHistory() const {
         }
         printRows(R);
     } catch (const std::exception &e) {
-        Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to fetch order history: {}", e.what()));
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to fetch order history: {}", e.what()));
     }
 }
 
 void Transporter::getOngoingOrdersInfo() const {
+    Arena arena;
     try {
-        // Connect to `ecommerce` db as `transporter` user using conn2Postgres
-        auto conn = conn2Postgres("ecommerce", "transporter", "transporter");
+        // Connect to `ecommerce` db as `transporter` user using conn2PostgresReadOnly
+        auto conn = conn2PostgresReadOnly("ecommerce", "transporter", "transporter", sessionKey());
 
         // Check if the order exists
-        std::string query = std::format("SELECT (get_ongoing_orders({})).*;", id);
-        pqxx::work tx(*conn);
+        auto query = arena.format("SELECT (get_ongoing_orders({})).*;", id);
+        pqxx::read_transaction tx(*conn);
         pqxx::result R = tx.exec(query);
         tx.commit();
 
@@ -51,25 +54,108 @@ void Transporter::getOngoingOrdersInfo() const {
         }
         printRows(R);
     } catch (const std::exception &e) {
-        Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to fetch ongoing orders: {}", e.what()));
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to fetch ongoing orders: {}", e.what()));
     }
 }
 
+std::vector<uint32_t> Transporter::claimNextOrders(uint32_t maxOrders) {
+    Arena arena;
+    std::vector<uint32_t> claimed;
+    try {
+        // Connect to `ecommerce` db as `transporter` user using conn2Postgres
+        auto conn = conn2Postgres("ecommerce", "transporter", "transporter");
+
+        // Claim the orders, the row locks are held until the commit so no other transporter can take them meanwhile
+        auto query = arena.format("SELECT * FROM claim_orders({}, {});", id, maxOrders);
+        pqxx::work tx(*conn);
+        pqxx::result R = tx.exec(query);
+        tx.commit();
+        markPostgresWrite(sessionKey());
+
+        claimed.reserve(R.size());
+        for (const auto &row: R) claimed.push_back(row["order_id"].as<uint32_t>());
+        TransporterDispatcher::getInstance().charge(std::stoul(id), claimed.size());
+
+        if (R.empty()) {
+            Utils::log(Utils::LogLevel::TRACE, *logFile, "No order to claim.");
+            return claimed;
+        }
+        printRows(R);
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to claim orders: {}", e.what()));
+    }
+    return claimed;
+}
+
 void Transporter::setOrderStatus(const uint32_t &orderId, Order::Status orderStatus) {
+    Arena arena;
     try {
         // Connect to `ecommerce` db as `transporter` user using conn2Postgres
         auto conn = conn2Postgres("ecommerce", "transporter", "transporter");
 
         // Edit the status of the order
         std::string userType = userTypeToString(getUserType());
-        std::string query = std::format("SELECT set_order_status('{}', {}, {}, '{}');", userType, id, orderId, Order::orderStatusToString(orderStatus));
+        auto query = arena.format("SELECT set_order_status('{}', {}, {}, '{}');", userType, id, orderId, Order::orderStatusToString(orderStatus));
 
         pqxx::work tx(*conn);
         tx.exec(query);
         tx.commit();
+        markPostgresWrite(sessionKey());
+        OrderStatusNotifier::publish(orderId, orderStatus);
+        if (orderStatus != Order::Status::SHIPPED) TransporterDispatcher::getInstance().release(std::stoul(id)); // The order left the backlog
+        if (orderStatus == Order::Status::CANCELLED) ProductRankings::getInstance().recordCancellations(std::span(&orderId, 1));
+
+        Utils::log(Utils::LogLevel::TRACE, *logFile, arena.format("Order {} status updated to {}.", orderId, Order::orderStatusToString(orderStatus)));
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to update order status: {}", e.what()));
+    }
+}
+
+std::vector<bool> Transporter::setOrderStatuses(std::span<const uint32_t> orderIds, Order::Status orderStatus) {
+    Arena arena;
+    std::vector<bool> updated(orderIds.size(), false);
+    if (orderIds.empty()) return updated;
+
+    try {
+        // Connect to `ecommerce` db as `transporter` user using conn2Postgres
+        auto conn = conn2Postgres("ecommerce", "transporter", "transporter");
+
+        // Edit the status of every order with a single set-based call
+        std::string userType = userTypeToString(getUserType());
+        auto status = Order::orderStatusToString(orderStatus);
+        auto query = arena.format("SELECT * FROM set_order_statuses('{}', {}, {}, '{}');", userType, id, idArray(orderIds, arena), status);
+
+        pqxx::work tx(*conn);
+        pqxx::result R = tx.exec(query);
+        tx.commit();
+        markPostgresWrite(sessionKey());
+
+        // Map the outcome of each order back to its positions in the batch, an id may be given more than once
+        std::unordered_map<uint32_t, std::vector<size_t>> positions;
+        for (size_t i = 0; i < orderIds.size(); ++i) positions[orderIds[i]].push_back(i);
+
+        std::vector<uint32_t> changed;
+        for (const auto &row: R) {
+            auto orderId = row["order_id"].as<uint32_t>();
+            bool success = row["updated"].as<bool>();
+            for (auto i: positions[orderId]) updated[i] = success;
+
+            if (!success) {
+                Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to update order {} status: {}", orderId, row["failure"].c_str()));
+                continue;
+            }
+            changed.push_back(orderId);
+        }
+
+        // Notify and release the changed orders in one round trip each
+        OrderStatusNotifier::publish(changed, orderStatus);
+        if (orderStatus != Order::Status::SHIPPED) TransporterDispatcher::getInstance().release(std::stoul(id), changed.size()); // The orders left the backlog
+        if (orderStatus == Order::Status::CANCELLED) ProductRankings::getInstance().recordCancellations(changed);
 
-        Utils::log(Utils::LogLevel::TRACE, *logFile, std::format("Order {} status updated to {}.", orderId, Order::orderStatusToString(orderStatus)));
+        auto count = std::count(updated.begin(), updated.end(), true);
+        Utils::log(Utils::LogLevel::TRACE, *logFile, arena.format("{} of {} orders updated to {}.", count, orderIds.size(), status));
     } catch (const std::exception &e) {
-        Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("Failed to update order status: {}", e.what()));
+        Utils::log(Utils::LogLevel::ERROR, *logFile, arena.format("Failed to update order statuses: {}", e.what()));
     }
+    return updated;
 }
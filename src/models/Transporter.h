@@ -19,13 +19,16 @@ public:
             User::openLogFile();
             User::login();
             loggedInSuccessfully = true;
+            TransporterDispatcher::getInstance().registerTransporter(std::stoul(id));
         } catch (const std::exception &e) {
             Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to create a Transporter: {}", e.what()));
         }
     }
 
     ~Transporter() override {
-        if (loggedInSuccessfully) User::logout();
+        if (!loggedInSuccessfully) return;
+        TransporterDispatcher::getInstance().unregisterTransporter(std::stoul(id)); // Logged out transporters get no new orders
+        User::logout();
     };
 
     /**
@@ -40,19 +43,37 @@ public:
     // Order related methods
 
     /**
-    * Get the history of orders.
-    */
-    void getOrdersHistory() const;
+     * Get the history of orders.
+     * @param lastMonths only show the orders of the current month and of this many months before it. Defaults to every order.
+     */
+    void getOrdersHistory(const std::optional<uint32_t> &lastMonths = std::nullopt) const;
 
     /**
      * From the orders to deliver, get the customer's name and the address to deliver the order.
      */
     void getOngoingOrdersInfo() const;
 
+    /**
+     * Claim the oldest orders waiting in the transporter pool, see `--transporter-pool`.
+     * Concurrent transporters never wait for each other nor claim the same order.
+     * @param maxOrders the maximum number of orders to claim.
+     * @return the ids of the claimed orders, possibly fewer than `maxOrders`.
+     */
+    std::vector<uint32_t> claimNextOrders(uint32_t maxOrders);
+
     /**
      * Set the status of an order.
      * @param orderId id of the order to update.
      * @param orderStatus status to set.
      */
     void setOrderStatus(const uint32_t &orderId, Order::Status orderStatus);
+
+    /**
+     * Set the status of a batch of orders in a single transaction, e.g. when closing out a route.
+     * An order that cannot be updated does not prevent the others from being updated.
+     * @param orderIds ids of the orders to update.
+     * @param orderStatus status to set.
+     * @return whether each order was updated, in the order of `orderIds`. All false if the batch failed as a whole.
+     */
+    std::vector<bool> setOrderStatuses(std::span<const uint32_t> orderIds, Order::Status orderStatus);
 };
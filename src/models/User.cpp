@@ -9,6 +9,23 @@ std::string User::userTypeToString(User::UserType userType) {
     }
 }
 
+std::string User::sessionKey() const { return std::format("{}:{}", userTypeToString(getUserType()), id); }
+
+std::string User::historyWindow(const std::optional<uint32_t> &lastMonths) {
+    if (!lastMonths) return "";
+    return std::format(" AND timestamp >= date_trunc('month', NOW()) - interval '{} months'", lastMonths.value());
+}
+
+std::pmr::string User::idArray(std::span<const uint32_t> ids, Arena &arena) {
+    std::pmr::string array("'{", arena.resource());
+    for (size_t i = 0; i < ids.size(); ++i) {
+        if (i > 0) array.push_back(',');
+        std::format_to(std::back_inserter(array), "{}", ids[i]);
+    }
+    array.append("}'::INT[]");
+    return array;
+}
+
 void User::openLogFile() {
     if (!logFile) logFile = std::make_shared<std::ofstream>(std::format("{}.log", userTypeToString(getUserType())), std::ios::out | std::ios::app);
 }
@@ -17,47 +34,42 @@ void User::login() {
     /*
      * This function should establish a connection to the db to allow creating an instance of a User subclass.
      * In order, it should:
-     * 1. Connect to the `ecommerce` database as the `userType` user using conn2Postgres
-     * 2. Check if the given username is already in the database
-     *  2.1 If it is, fetch the id and balance, and set the logged_in field to true
-     *  2.2 If it is not, create a new entry in the database and fetch the id and balance, and set the logged_in field to true
-     *  2.3 If the user is already connected to the database, throw an exception
-     * 3. If no exception is thrown, set the id and balance fields of the User subclass
+     * 1. Look for the username in the Redis user directory
+     *  1.1 If it is not there, fetch the id and balance from Postgres using conn2Postgres
+     *  1.2 If it is not in Postgres either, create a new entry in the database and fetch its id
+     * 2. Open a Redis session for the user
+     *  2.1 If the user already has a session, throw an exception
+     * 3. If no exception is thrown, set the id field of the User subclass
      */
     std::string userType = userTypeToString(getUserType());
     try {
-        // Connect to the `ecommerce` database as the `userType` user using conn2Postgres
-        auto conn = conn2Postgres("ecommerce", userType, userType);
+        auto &sessions = SessionRegistry::getInstance();
+
+        // Returning users are found in the directory, Postgres is only queried for usernames never seen before
+        std::optional<SessionRegistry::DirectoryEntry> entry = sessions.lookupUser(userType, name);
+        bool created = false;
+        if (!entry) {
+            // Connect to the `ecommerce` database as the `userType` user using conn2Postgres
+            auto conn = conn2Postgres("ecommerce", userType, userType);
+
+            pqxx::work tx(*conn);
+            auto R = tx.query01<std::string, uint32_t>(std::format("SELECT id, balance FROM check_user_{}('{}');", userType, name));
+            if (R) entry = SessionRegistry::DirectoryEntry{std::get<0>(R.value()), std::get<1>(R.value())};
+            else {
+                entry = SessionRegistry::DirectoryEntry{tx.query_value<std::string>(std::format("SELECT insert_user_{}('{}');", userType, name)), 0};
+                created = true;
+            }
+            tx.commit();
+
+            sessions.rememberUser(userType, name, entry.value());
+        }
 
-        // Build the query to check if the user is already in the database
-        std::string query = std::format("SELECT (check_user('{}', '{}')).*;", userType, name);
-        pqxx::work tx(*conn);
-        auto R = tx.query01<std::string, uint32_t, bool>(query);
-        tx.commit();
+        // Only one session per user, `open` fails if another one is still alive
+        if (!sessions.open({entry->userId, userType, entry->balance, std::chrono::system_clock::now()})) throw std::invalid_argument("user already connected");
+        id = entry->userId;
+        if (created) markPostgresWrite(sessionKey()); // The new row may not have reached the replicas yet
 
-        if (R) {
-            // Access individual fields directly from the tuple
-            auto [user_id, user_balance, logged_in] = R.value();
-
-            // If the user is already in the database, fetch the id and balance, and set the logged_in field to true
-            if (!logged_in) {
-                id = user_id;
-
-                query = std::format("SELECT set_logged_in('{}', {}, true);", userType, id);
-                pqxx::work tx_login(*conn);
-                tx_login.exec(query);
-                tx_login.commit();
-            } else throw std::invalid_argument("user already connected");
-        } else {
-            // Else, create a new entry in the database and fetch the id and balance, and set the logged_in field to true
-            query = std::format("SELECT insert_user('{}', '{}');", userType, name);
-            pqxx::work tx_new_user(*conn);
-            auto new_user_id = tx_new_user.query_value<std::string>(query);
-            tx_new_user.commit();
-
-            id = new_user_id;
-        }
-        Utils::log(Utils::LogLevel::TRACE, *logFile, std::format("User `{}` logged in {{type: `{}`, id: {}, balance: {}}}", name, userType, id, getBalance()));
+        Utils::log(Utils::LogLevel::TRACE, *logFile, std::format("User `{}` logged in {{type: `{}`, id: {}, balance: {}}}", name, userType, id, entry->balance));
     } catch (const std::exception &e) {
         throw; // Rethrow the exception to propagate it to the caller
     }
@@ -67,30 +79,13 @@ void User::logout() {
     /*
      * This function should disconnect an instance of a user from the database.
      * In order, it should:
-     *  1. Connect to the `ecommerce` database as the `userType` user using conn2Postgres
-     *  2. Check if the user's logged_in field is true
-     *   2.1 If it is, set the logged_in field to false
-     *   2.2 If it is not, throw an exception
+     *  1. Close the Redis session of the user
+     *  2. If the user had no open session, throw an exception
      */
     std::string userType = userTypeToString(getUserType());
     try {
-        // Connect to the `ecommerce` database as the `userType` user using conn2Postgres
-        auto conn = conn2Postgres("ecommerce", userType, userType);
-
-        // Build the query to check if the user's logged_in field is true
-        std::string query = std::format("SELECT (check_user('{}', '{}')).logged_in;", userType, name);
-        pqxx::work tx(*conn);
-        bool logged_in = tx.query_value<bool>(query);
-        tx.commit();
-
-        if (logged_in) {
-            // If the user's logged_in field is true, set the logged_in field to false
-            query = std::format("SELECT set_logged_in('{}', {}, false);", userType, id);
-            pqxx::work tx_logout(*conn);
-            tx_logout.exec(query);
-            tx_logout.commit();
-            Utils::log(Utils::LogLevel::TRACE, *logFile, std::format("User `{}` logged out", name));
-        } else throw std::invalid_argument("User is not logged in");
+        if (!SessionRegistry::getInstance().close(userType, id)) throw std::invalid_argument("User is not logged in");
+        Utils::log(Utils::LogLevel::TRACE, *logFile, std::format("User `{}` logged out", name));
     } catch (const std::exception &e) {
         Utils::log(Utils::LogLevel::ERROR, *logFile, std::format("An error occurred: {}", e.what()));
     }
@@ -99,15 +94,12 @@ void User::logout() {
 uint32_t User::getBalance() const {
     std::string userType = userTypeToString(getUserType());
     try {
-        // Connect to the `ecommerce` database as the `userType` user using conn2Postgres
-        auto conn = conn2Postgres("ecommerce", userType, userType);
-
-        // Build the query
-        std::string query = std::format("SELECT get_balance('{}', {});", userType, id);
+        // Connect to the `ecommerce` database as the `userType` user using conn2PostgresReadOnly
+        auto conn = conn2PostgresReadOnly("ecommerce", userType, userType, sessionKey());
 
-        // Execute the query
-        pqxx::work tx(*conn);
-        auto bal = tx.query_value<uint32_t>(query);
+        // Execute the statement prepared for the `userType` user (see `warmUpPostgres`)
+        pqxx::read_transaction tx(*conn);
+        auto bal = tx.exec_prepared("get_balance", id).one_field().as<uint32_t>();
         tx.commit();
 
         // Print the result
@@ -124,13 +116,12 @@ void User::setBalance(const int32_t &balanceChange) {
         // Connect to the `ecommerce` database as the `userType` user using conn2Postgres
         auto conn = conn2Postgres("ecommerce", userType, userType);
 
-        // Build the query to call the stored procedure
-        std::string query = std::format("SELECT set_balance('{}', {}, {});", userType, id, balanceChange);
-
-        // Execute the query
+        // Execute the statement prepared for the `userType` user (see `warmUpPostgres`)
         pqxx::work tx(*conn);
-        auto newBal = tx.query_value<uint32_t>(query);
+        auto newBal = tx.exec_prepared("set_balance", id, balanceChange).one_field().as<uint32_t>();
         tx.commit();
+        markPostgresWrite(sessionKey());
+        SessionRegistry::getInstance().rememberUser(userType, name, {id, newBal}); // Keep the directory snapshot fresh
 
         // Print the result
         Utils::log(Utils::LogLevel::TRACE, *logFile, std::format("Balance modified to {}", newBal));
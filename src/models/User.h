@@ -1,8 +1,18 @@
 #pragma once
 
+#include "../Arena.h"
+#include "../db/Rows.h"
+#include "../db/StatementBatch.h"
 #include "../db/dbutils.h"
+#include "../redis/InventoryReservations.h"
+#include "../redis/OrderStatusNotifier.h"
+#include "../redis/ProductRankings.h"
+#include "../redis/Recommendations.h"
+#include "../redis/SessionRegistry.h"
+#include "../redis/TransporterDispatcher.h"
 #include "../redis/rdutils.h"
 #include <optional>
+#include <span>
 
 /**
  * Abstract class representing a user of the system.
@@ -37,6 +47,28 @@ protected:
      */
     static std::string userTypeToString(UserType userType);
 
+    /**
+     * Get the key identifying the session of the user, used to route its reads to a replica
+     * unless it wrote recently (see `markPostgresWrite`).
+     * @return the session key, e.g. `customer:3`.
+     */
+    [[nodiscard]] std::string sessionKey() const;
+
+    /**
+     * Build the filter restricting a history query to its last months.
+     * @param lastMonths how many months before the current one to include, std::nullopt for no restriction.
+     * @return the filter to append to the WHERE clause, starting with ` AND `, or an empty string.
+     */
+    static std::string historyWindow(const std::optional<uint32_t> &lastMonths);
+
+    /**
+     * Build an `INT[]` literal from ids, to pass a whole batch to a single statement.
+     * @param ids the ids to put in the array
+     * @param arena the arena to format the literal in
+     * @return the literal, e.g. `'{1,2,3}'::INT[]`
+     */
+    static std::pmr::string idArray(std::span<const uint32_t> ids, Arena &arena);
+
     /**
      * Open the log file for the user, if it is not already open.
      * The log file is named after the user type.
@@ -47,12 +79,13 @@ protected:
     // Account related methods
 
     /**
-     * Connect an instance of a user to the database.
+     * Connect an instance of a user to the database, opening its session in the SessionRegistry.
+     * @throws std::invalid_argument if the user is already connected
      */
     void login();
 
     /**
-     * Disconnect an instance of a user from the database.
+     * Disconnect an instance of a user from the database, closing its session.
      */
     void logout();
 
@@ -0,0 +1,49 @@
+#include "CartCodec.h"
+#include "../Utils.h"
+
+std::string CartCodec::keyOf(const std::string &customerId) { return std::format("cart:{}", customerId); }
+
+std::pmr::string CartCodec::keyOf(std::string_view customerId, std::pmr::memory_resource *resource) {
+    std::pmr::string key("cart:", resource);
+    key += customerId;
+    return key;
+}
+
+std::string CartCodec::encode(const Item &item) {
+    std::string packed;
+    packed.reserve(15);
+    putVarint(packed, item.amount);
+    putVarint(packed, item.price);
+    putVarint(packed, item.supplierId);
+    return packed;
+}
+
+CartCodec::Item CartCodec::decode(std::string_view packed) {
+    Item item{};
+    item.amount = getVarint(packed);
+    item.price = getVarint(packed);
+    item.supplierId = getVarint(packed);
+    if (!packed.empty()) throw std::invalid_argument("Malformed cart line, trailing bytes");
+    return item;
+}
+
+void CartCodec::putVarint(std::string &out, uint32_t value) {
+    // LEB128: 7 bits per byte, least significant group first, high bit set on every byte but the last
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+uint32_t CartCodec::getVarint(std::string_view &in) {
+    uint32_t value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (in.empty()) throw std::invalid_argument("Malformed cart line, truncated varint");
+        auto byte = static_cast<uint8_t>(in.front());
+        in.remove_prefix(1);
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return value;
+    }
+    throw std::invalid_argument("Malformed cart line, varint too long");
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+
+/**
+ * Compact encoding of the carts stored in Redis
+ *
+ * @details A cart is a single hash `cart:{customerId}` mapping each product id to its line, packed as three varints
+ * (amount, price when added, supplier id): usually 3 to 6 bytes instead of four decimal string fields per product.
+ * Product names are not stored, they are resolved from the catalog when the cart is read.
+ * Small hashes like these are kept by Redis in its compact listpack encoding, with integer fields stored as integers.
+ */
+class CartCodec {
+public:
+    CartCodec() = delete;
+
+    /**
+     * A line of a cart, without its product id (the hash field).
+     */
+    struct Item {
+        uint32_t amount;
+        uint32_t price; ///< Unit price when the product was added to the cart.
+        uint32_t supplierId;
+    };
+
+    static constexpr std::chrono::hours ttl{24 * 7}; ///< Carts not modified for this long are abandoned and expire.
+
+    /**
+     * @return the key of the hash holding the cart of a customer
+     */
+    static std::string keyOf(const std::string &customerId);
+
+    /**
+     * @return the key of the hash holding the cart of a customer, allocated from the given memory resource
+     */
+    static std::pmr::string keyOf(std::string_view customerId, std::pmr::memory_resource *resource);
+
+    /**
+     * Pack a cart line.
+     * @param item the line to pack
+     * @return the packed line
+     */
+    static std::string encode(const Item &item);
+
+    /**
+     * Unpack a cart line.
+     * @param packed the line packed by `encode`
+     * @return the line
+     * @throws std::invalid_argument if the line is truncated or malformed
+     */
+    static Item decode(std::string_view packed);
+
+private:
+    static void putVarint(std::string &out, uint32_t value);
+    static uint32_t getVarint(std::string_view &in);
+};
@@ -0,0 +1,195 @@
+#include "CartShardRing.h"
+
+CartShardRing::CartShardRing() { setShards({"127.0.0.1:6379"}); }
+
+CartShardRing &CartShardRing::getInstance() {
+    static CartShardRing instance;
+    return instance;
+}
+
+uint64_t CartShardRing::hash(const std::string &value) {
+    // FNV-1a, then the splitmix64 finalizer since FNV alone spreads similar keys (`3`, `4`...) poorly.
+    // std::hash is not used: the placement must not change between builds or processes.
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c: value) h = (h ^ c) * 1099511628211ULL;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+std::string CartShardRing::uriOf(const std::string &endpoint) {
+    return endpoint.find(':') == std::string::npos ? std::format("tcp://{}:6379", endpoint) : std::format("tcp://{}", endpoint);
+}
+
+const std::string &CartShardRing::ownerOf(const Ring &ring, const std::string &customerId) {
+    // The owner is the first point clockwise from the customer's hash
+    auto it = ring.lower_bound(hash(customerId));
+    return it == ring.end() ? ring.begin()->second : it->second;
+}
+
+CartShardRing::Ring CartShardRing::buildRing(const std::set<std::string> &endpoints) {
+    Ring ring;
+    for (const auto &endpoint: endpoints) {
+        for (int i = 0; i < virtualNodes; ++i) ring.emplace(hash(std::format("{}#{}", endpoint, i)), endpoint);
+    }
+    return ring;
+}
+
+void CartShardRing::setShards(const std::vector<std::string> &endpoints) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    if (endpoints.empty()) throw std::invalid_argument("At least one cart shard is required");
+
+    shards = std::set<std::string>(endpoints.begin(), endpoints.end());
+    ring = buildRing(shards);
+    previousRing.reset();
+    pendingSources.clear();
+    cursor = 0;
+}
+
+void CartShardRing::addShard(const std::string &endpoint) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    if (previousRing) throw std::logic_error("A cart migration is already in progress");
+    if (shards.contains(endpoint)) return;
+
+    auto endpoints = shards;
+    endpoints.insert(endpoint);
+    reshard(std::move(endpoints));
+}
+
+void CartShardRing::removeShard(const std::string &endpoint) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    if (previousRing) throw std::logic_error("A cart migration is already in progress");
+    if (!shards.contains(endpoint)) return;
+    if (shards.size() == 1) throw std::logic_error("Cannot remove the last cart shard");
+
+    auto endpoints = shards;
+    endpoints.erase(endpoint);
+    reshard(std::move(endpoints));
+}
+
+void CartShardRing::reshard(std::set<std::string> endpoints) {
+    // A removed shard gives its carts away, while an added one takes a slice of every other shard
+    pendingSources.clear();
+    std::ranges::set_difference(shards, endpoints, std::back_inserter(pendingSources));
+    if (pendingSources.empty()) pendingSources.assign(shards.begin(), shards.end());
+
+    previousRing = std::move(ring);
+    shards = std::move(endpoints);
+    ring = buildRing(shards);
+    cursor = 0;
+    {
+        std::lock_guard<std::mutex> movedLock(movedMutex);
+        movedCustomers.clear();
+    }
+    if (!migrationTask) migrationTask.emplace("cart migration", migrationInterval, [this] { migrateStep(migrationBatch); });
+
+    Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("Cart shards changed, migrating carts from {} shard(s)...", pendingSources.size()));
+}
+
+void CartShardRing::moveCart(const std::string &customerId, const std::string &from, const std::string &to) {
+    auto source = RedisConnectionPool::getInstance().getConnection(uriOf(from));
+
+    std::string key = CartCodec::keyOf(customerId);
+    if (!source->exists(key)) return;
+
+    // MIGRATE moves the key and deletes it from the source, replacing any stale copy on the target. The TTL is kept.
+    auto separator = to.find(':');
+    std::string host = to.substr(0, separator);
+    std::string port = separator == std::string::npos ? "6379" : to.substr(separator + 1);
+    std::vector<std::string> command{"MIGRATE", host, port, key, "0", "5000", "REPLACE"};
+    source->command(command.begin(), command.end());
+
+    Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("Moved the cart of customer {} from {} to {}.", customerId, from, to));
+}
+
+void CartShardRing::ensureMoved(const std::string &customerId, const std::string &from, const std::string &to) {
+    {
+        std::unique_lock<std::mutex> lock(movedMutex);
+        moveDone.wait(lock, [&] { return !movingCustomers.contains(customerId); });
+        if (movedCustomers.contains(customerId)) return;
+        movingCustomers.insert(customerId);
+    }
+
+    // A single mover per customer, so that a cart written on its new owner is never replaced by its stale copy
+    try {
+        moveCart(customerId, from, to);
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(movedMutex);
+        movingCustomers.erase(customerId);
+        moveDone.notify_all();
+        throw;
+    }
+    std::lock_guard<std::mutex> lock(movedMutex);
+    movingCustomers.erase(customerId);
+    movedCustomers.insert(customerId);
+    moveDone.notify_all();
+}
+
+bool CartShardRing::migrateStep(long long count) {
+    std::lock_guard<std::mutex> step(migrationMutex);
+    std::string source;
+    long long from;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        if (!previousRing) return true;
+        source = pendingSources.front();
+        from = cursor;
+    }
+
+    std::vector<std::string> keys;
+    long long next = RedisConnectionPool::getInstance().getConnection(uriOf(source))->scan(from, "cart:*", count, std::back_inserter(keys));
+
+    // Key format: cart:{customerId}
+    std::vector<std::pair<std::string, std::string>> moves; // Customer id -> new owner
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        for (const auto &key: keys) {
+            std::string customerId = key.substr(key.find(':') + 1);
+            if (customerId.contains(':')) continue; // Legacy per-product key, see `RedisCartStore::migrateLegacyCarts`
+            const std::string &owner = ownerOf(ring, customerId);
+            if (owner != source) moves.emplace_back(std::move(customerId), owner);
+        }
+    }
+    for (const auto &[customerId, owner]: moves) ensureMoved(customerId, source, owner);
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    cursor = next;
+    if (cursor != 0) return false;
+    pendingSources.erase(pendingSources.begin());
+    if (!pendingSources.empty()) return false;
+
+    previousRing.reset();
+    std::lock_guard<std::mutex> movedLock(movedMutex);
+    movedCustomers.clear();
+    Utils::log(Utils::LogLevel::DEBUG, std::cout, "Cart migration done.");
+    return true;
+}
+
+void CartShardRing::migrate() {
+    while (!migrateStep()) {}
+}
+
+std::shared_ptr<sw::redis::Redis> CartShardRing::getConnection(const std::string &customerId) {
+    std::string owner, previousOwner;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        owner = ownerOf(ring, customerId);
+        if (previousRing) previousOwner = ownerOf(*previousRing, customerId);
+    }
+
+    // The cart is moved outside of the lock, lookups of other customers do not wait for it
+    if (!previousOwner.empty() && previousOwner != owner) ensureMoved(customerId, previousOwner, owner);
+    return RedisConnectionPool::getInstance().getConnection(uriOf(owner));
+}
+
+std::vector<std::shared_ptr<sw::redis::Redis>> CartShardRing::getAllConnections() {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+
+    // Shards being emptied by a migration still hold carts
+    std::set<std::string> endpoints = shards;
+    endpoints.insert(pendingSources.begin(), pendingSources.end());
+
+    std::vector<std::shared_ptr<sw::redis::Redis>> connections;
+    for (const auto &endpoint: endpoints) connections.push_back(RedisConnectionPool::getInstance().getConnection(uriOf(endpoint)));
+    return connections;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "../Utils.h"
+#include "../async/PeriodicTask.h"
+#include "CartCodec.h"
+#include "RedisConnectionPool.h"
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <shared_mutex>
+#include <vector>
+
+/**
+ * A singleton class that spreads the carts of the customers over several Redis servers (shards)
+ *
+ * @details Customers are placed on a consistent-hash ring, each shard owning `virtualNodes` points of it,
+ * so the cart of a customer (see `CartCodec`) lives on a single shard and scripts or pipelines on a cart stay single-node.
+ * Adding or removing a shard only moves the carts of the customers whose owner changed. They are moved incrementally:
+ * either when the customer touches its cart (`getConnection`) or by `migrateStep`, which scans the previous owners in batches
+ * on a background task. Until the migration is over, a cart is still found on its previous shard and moved before being used.
+ * Looking up an owner only takes a shared lock on the ring; carts are moved outside of it, one customer at a time.
+ */
+class CartShardRing {
+public:
+    CartShardRing();
+    CartShardRing(const CartShardRing &) = delete;
+    CartShardRing &operator=(const CartShardRing &) = delete;
+
+    /**
+     * Get the singleton instance of the CartShardRing class
+     * @return The singleton instance of the CartShardRing class
+     */
+    static CartShardRing &getInstance();
+
+    /**
+     * Set the shards, without moving any key. Must be called before any cart is used.
+     * @param endpoints The `host[:port]` of each Redis server
+     */
+    void setShards(const std::vector<std::string> &endpoints);
+
+    /**
+     * Add a shard to the ring. The carts it now owns are moved to it lazily and by a background task.
+     * @param endpoint The `host[:port]` of the Redis server
+     * @throws std::logic_error if a migration is still in progress
+     */
+    void addShard(const std::string &endpoint);
+
+    /**
+     * Remove a shard from the ring. Its carts are moved to the other shards lazily and by a background task.
+     * @param endpoint The `host[:port]` of the Redis server
+     * @throws std::logic_error if a migration is still in progress, or if it is the last shard
+     */
+    void removeShard(const std::string &endpoint);
+
+    /**
+     * Move the carts of one batch of customers whose owner changed.
+     * @param count The number of keys to scan on the previous shard
+     * @return true once every cart is on its owner and the migration is over
+     */
+    bool migrateStep(long long count = 100);
+
+    /**
+     * Run `migrateStep` until the migration is over.
+     */
+    void migrate();
+
+    /**
+     * Get a connection to the shard owning the cart of a customer, moving the cart there first if needed.
+     * @param customerId The id of the customer
+     * @return The connection to the Redis server
+     */
+    std::shared_ptr<sw::redis::Redis> getConnection(const std::string &customerId);
+
+    /**
+     * @return a connection to every shard
+     */
+    std::vector<std::shared_ptr<sw::redis::Redis>> getAllConnections();
+
+private:
+    using Ring = std::map<uint64_t, std::string>; ///< Point on the ring -> endpoint owning it.
+
+    static constexpr int virtualNodes = 64; ///< Points per shard, to even out the load.
+
+    /**
+     * @return a well mixed, process independent hash of a string
+     */
+    static uint64_t hash(const std::string &value);
+
+    /**
+     * @return the URI of a `host[:port]` endpoint
+     */
+    static std::string uriOf(const std::string &endpoint);
+
+    /**
+     * @return the endpoint owning a customer on a ring
+     */
+    static const std::string &ownerOf(const Ring &ring, const std::string &customerId);
+
+    /**
+     * Build the ring of a set of shards.
+     */
+    static Ring buildRing(const std::set<std::string> &endpoints);
+
+    /**
+     * Start a migration from the current ring to the ring of `endpoints`. Requires an exclusive lock on `mutex`.
+     */
+    void reshard(std::set<std::string> endpoints);
+
+    /**
+     * Move the cart of a customer from one shard to another with MIGRATE.
+     */
+    static void moveCart(const std::string &customerId, const std::string &from, const std::string &to);
+
+    /**
+     * Move the cart of a customer to its new owner, unless it was already moved. Waits if another thread is moving it.
+     * Must be called without holding `mutex`.
+     */
+    void ensureMoved(const std::string &customerId, const std::string &from, const std::string &to);
+
+    static constexpr std::chrono::milliseconds migrationInterval{100};
+    static constexpr long long migrationBatch = 1000; ///< Keys scanned per step of the background migration.
+
+    std::shared_mutex mutex; ///< Guards the ring and the migration state below, shared for lookups.
+    std::set<std::string> shards;
+    Ring ring;
+
+    // Migration state, all empty when no migration is in progress
+    std::optional<Ring> previousRing;        ///< The ring before the last `addShard`/`removeShard`.
+    std::vector<std::string> pendingSources; ///< Previous shards not fully scanned yet, the first one is being scanned.
+    long long cursor = 0;                    ///< SCAN cursor on `pendingSources.front()`.
+
+    std::mutex migrationMutex; ///< Serializes the steps of the migration, whose scans run outside of `mutex`.
+    std::optional<PeriodicTask> migrationTask; ///< Started by the first `addShard`/`removeShard`, guarded by `mutex`.
+
+    std::mutex movedMutex;
+    std::condition_variable moveDone;
+    std::set<std::string> movedCustomers;  ///< Customers already moved to their new owner, guarded by `movedMutex`.
+    std::set<std::string> movingCustomers; ///< Customers whose cart is being moved, guarded by `movedMutex`.
+};
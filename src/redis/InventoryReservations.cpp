@@ -0,0 +1,185 @@
+#include "InventoryReservations.h"
+
+// Add to the stock of hot products, given as (product id, quantity) argument pairs. Products that are not hot are skipped.
+static constexpr const char *incrementHotScript = R"(
+    for i = 1, #ARGV, 2 do
+        if redis.call('HEXISTS', KEYS[1], ARGV[i]) == 1 then redis.call('HINCRBY', KEYS[1], ARGV[i], ARGV[i + 1]) end
+    end
+    return 0
+)";
+
+InventoryReservations &InventoryReservations::getInstance() {
+    static InventoryReservations instance;
+    return instance;
+}
+
+InventoryReservations::~InventoryReservations() {
+    flushTask.reset();
+    flush(); // Leave `products` up to date on a clean shutdown
+}
+
+void InventoryReservations::markHot(uint32_t productId) {
+    try {
+        load({std::to_string(productId)});
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to mark product {} as hot: {}", productId, e.what()));
+        return;
+    }
+
+    startFlushing();
+}
+
+std::optional<std::vector<InventoryReservations::Line>> InventoryReservations::reserve(const std::vector<Line> &lines) {
+    // Check every hot line before taking anything, so that a cart is reserved all at once or not at all.
+    // Returns {1, reserved product ids...} or {0, id of the product short of stock}.
+    static constexpr const char *reserveScript = R"(
+        for i = 1, #ARGV, 2 do
+            local available = redis.call('HGET', KEYS[1], ARGV[i])
+            if available and tonumber(available) < tonumber(ARGV[i + 1]) then return {0, tonumber(ARGV[i])} end
+        end
+        local reserved = {1}
+        for i = 1, #ARGV, 2 do
+            if redis.call('HEXISTS', KEYS[1], ARGV[i]) == 1 then
+                redis.call('HINCRBY', KEYS[1], ARGV[i], -tonumber(ARGV[i + 1]))
+                table.insert(reserved, tonumber(ARGV[i]))
+            end
+        end
+        return reserved
+    )";
+
+    std::vector<std::string> keys{availableKey}, args;
+    for (const auto &line: lines) {
+        args.push_back(std::to_string(line.productId));
+        args.push_back(std::to_string(line.quantity));
+    }
+
+    std::vector<long long> reply;
+    conn2Redis()->eval(reserveScript, keys.begin(), keys.end(), args.begin(), args.end(), std::back_inserter(reply));
+    if (reply.empty() || reply[0] == 0) return std::nullopt;
+
+    std::vector<Line> reserved;
+    for (const auto &line: lines) {
+        if (std::find(reply.begin() + 1, reply.end(), line.productId) != reply.end()) reserved.push_back(line);
+    }
+    return reserved;
+}
+
+void InventoryReservations::release(const std::vector<Line> &lines) {
+    // Products that stopped being hot in the meantime are not added back
+    if (lines.empty()) return;
+
+    std::vector<std::string> keys{availableKey}, args;
+    for (const auto &line: lines) {
+        args.push_back(std::to_string(line.productId));
+        args.push_back(std::to_string(line.quantity));
+    }
+
+    try {
+        conn2Redis()->eval<long long>(incrementHotScript, keys.begin(), keys.end(), args.begin(), args.end());
+    } catch (const sw::redis::Error &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to release reserved stock, it is restored by the next rebuild: {}", e.what()));
+    }
+}
+
+void InventoryReservations::markLogged() { pending.store(true); }
+
+void InventoryReservations::flush() {
+    pending.store(false); // Reservations logged from now on are left for the next flush
+    try {
+        // Connect to the 'ecommerce' database as the 'ecommerce' user, the owner of the reservation log
+        auto conn = conn2Postgres("ecommerce", "ecommerce", "ecommerce");
+
+        // Take the log and apply it in the same transaction, one update per product however many orders it was in
+        pqxx::work tx(*conn);
+        pqxx::result R = tx.exec(R"(
+            WITH flushed AS (
+                DELETE FROM inventory_reservations RETURNING product_id, quantity
+            ), totals AS (
+                SELECT product_id, SUM(quantity) AS quantity FROM flushed GROUP BY product_id
+            )
+            UPDATE products p SET amount = p.amount - t.quantity
+            FROM totals t
+            WHERE p.id = t.product_id AND p.amount != -1;
+        )");
+        tx.commit();
+
+        if (R.affected_rows() > 0) Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("Reserved stock flushed for {} products.", R.affected_rows()));
+    } catch (const std::exception &e) {
+        pending.store(true);
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to flush reserved stock: {}", e.what()));
+    }
+}
+
+void InventoryReservations::adjust(uint32_t productId, int64_t delta) {
+    if (delta == 0) return;
+    std::vector<std::string> keys{availableKey}, args{std::to_string(productId), std::to_string(delta)};
+    try {
+        conn2Redis()->eval<long long>(incrementHotScript, keys.begin(), keys.end(), args.begin(), args.end());
+    } catch (const sw::redis::Error &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to adjust the stock of product {}: {}", productId, e.what()));
+    }
+}
+
+void InventoryReservations::discontinue(uint32_t productId) {
+    // Below any quantity, every reservation of the product fails from now on
+    static constexpr const char *discontinueScript = R"(
+        if redis.call('HEXISTS', KEYS[1], ARGV[1]) == 1 then redis.call('HSET', KEYS[1], ARGV[1], -1) end
+        return 0
+    )";
+    try {
+        conn2Redis()->eval<long long>(discontinueScript, {availableKey}, {std::to_string(productId)});
+    } catch (const sw::redis::Error &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to discontinue product {}: {}", productId, e.what()));
+    }
+}
+
+void InventoryReservations::rebuild(const std::vector<uint32_t> &productIds) {
+    try {
+        std::vector<std::string> hot, cooled;
+        for (auto productId: productIds) hot.push_back(std::to_string(productId));
+        conn2Redis()->hkeys(availableKey, std::back_inserter(cooled));
+        std::erase_if(cooled, [&](const std::string &productId) { return std::ranges::find(hot, productId) != hot.end(); });
+
+        // Products leaving the hot list are dropped first: their next checkouts take the stock from Postgres,
+        // which the flush then brings up to date with their logged reservations
+        for (const auto &productId: cooled) conn2Redis()->hdel(availableKey, productId);
+        flush();
+        load(hot);
+        Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("{} hot products, {} no longer hot.", hot.size(), cooled.size()));
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to rebuild the stock of hot products: {}", e.what()));
+    }
+
+    startFlushing();
+}
+
+void InventoryReservations::startFlushing() {
+    // Only this process's own reservations are flushed in the background, those of a crashed one by the next `rebuild`
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!flushTask) flushTask.emplace("inventory flush", flushInterval, [this] { if (pending.load()) flush(); });
+}
+
+void InventoryReservations::load(const std::vector<std::string> &productIds) {
+    if (productIds.empty()) return;
+
+    std::string ids;
+    for (const auto &productId: productIds) ids += (ids.empty() ? "" : ", ") + productId;
+
+    // Connect to the 'ecommerce' database as the 'ecommerce' user, suppliers and customers cannot read the reservation log
+    auto conn = conn2Postgres("ecommerce", "ecommerce", "ecommerce");
+    pqxx::read_transaction tx(*conn);
+    std::vector<std::pair<std::string, std::string>> available;
+    for (auto [productId, amount]: tx.query<std::string, std::string>(std::format(R"(
+            SELECT p.id, p.amount - COALESCE((SELECT SUM(r.quantity) FROM inventory_reservations r WHERE r.product_id = p.id), 0)
+            FROM products p
+            WHERE p.id IN ({});
+    )", ids))) {
+        available.emplace_back(std::move(productId), std::move(amount));
+    }
+    tx.commit();
+
+    // HSETNX, a product made hot meanwhile by another process keeps the stock it already holds
+    auto pipe = conn2Redis()->pipeline(false);
+    for (const auto &[productId, amount]: available) pipe.hsetnx(availableKey, productId, amount);
+    pipe.exec();
+}
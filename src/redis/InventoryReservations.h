@@ -0,0 +1,117 @@
+#pragma once
+
+#include "../Utils.h"
+#include "../async/PeriodicTask.h"
+#include "../db/dbutils.h"
+#include "rdutils.h"
+#include <algorithm>
+#include <atomic>
+#include <optional>
+#include <vector>
+
+/**
+ * A singleton class that takes the stock of hot products from Redis instead of their `products` row
+ *
+ * @details The available stock of each hot product is kept in the Redis hash `inventory:available`.
+ * Checkout reserves the whole cart atomically with one script call, then its transaction appends the reserved lines
+ * to the `inventory_reservations` table (the reservation log) instead of updating the product rows.
+ * A background flush applies the log to `products` in batches, one row update per product per flush,
+ * so concurrent buyers of a hot product no longer queue on its row lock.
+ * The log is durable and transactional: after a crash, committed reservations are still flushed by the next `rebuild`.
+ * The Redis stock is only ever changed by deltas once loaded (reservations, releases, supplier edits), so that it stays
+ * right while other checkouts hold reservations not logged yet. The stock reserved by a checkout that crashed before
+ * committing is lost until the product is made hot again: the products are undersold rather than oversold.
+ */
+class InventoryReservations {
+public:
+    /**
+     * A product and a quantity of it.
+     */
+    struct Line {
+        uint32_t productId;
+        uint32_t quantity;
+    };
+
+    InventoryReservations() = default;
+    InventoryReservations(const InventoryReservations &) = delete;
+    InventoryReservations &operator=(const InventoryReservations &) = delete;
+
+    ~InventoryReservations();
+
+    /**
+     * Get the singleton instance of the InventoryReservations class
+     * @return The singleton instance of the InventoryReservations class
+     */
+    static InventoryReservations &getInstance();
+
+    /**
+     * Take the stock of a product from Redis from now on.
+     * @param productId the id of the product
+     */
+    void markHot(uint32_t productId);
+
+    /**
+     * Reserve the hot products of a cart, all or none of them. Other products are ignored.
+     * @param lines the lines of the cart
+     * @return the reserved lines (possibly none), or std::nullopt if a hot product is short of stock
+     * @throws sw::redis::Error if Redis is unreachable
+     */
+    std::optional<std::vector<Line>> reserve(const std::vector<Line> &lines);
+
+    /**
+     * Give back reserved lines, when the order could not be created.
+     * @param lines the lines returned by `reserve`
+     */
+    void release(const std::vector<Line> &lines);
+
+    /**
+     * Note that reserved lines were committed to the reservation log, so that the next background flush applies them.
+     */
+    void markLogged();
+
+    /**
+     * Apply the reservation log to the `products` table.
+     */
+    void flush();
+
+    /**
+     * Change the stock of a hot product by the same amount as its `products` row, after its supplier edited it.
+     * Does nothing for other products.
+     * @param productId the id of the product
+     * @param delta the new amount of the row minus its previous amount
+     */
+    void adjust(uint32_t productId, int64_t delta);
+
+    /**
+     * Stop selling a hot product, after its supplier removed it. Does nothing for other products.
+     * @param productId the id of the product
+     */
+    void discontinue(uint32_t productId);
+
+    /**
+     * Flush the reservation log, make exactly the given products hot and start the background flush.
+     * The products that were hot and are not in the list go back to taking their stock from Postgres.
+     * @param productIds the ids of the hot products, the same in every process sharing the Redis server
+     */
+    void rebuild(const std::vector<uint32_t> &productIds);
+
+private:
+    static constexpr const char *availableKey = "inventory:available";
+    static constexpr std::chrono::milliseconds flushInterval{1000};
+
+    /**
+     * Set the Redis stock of the products that are not hot yet from their Postgres stock, minus the reservations not flushed yet.
+     * The stock of products already hot is left alone, it may be held by reservations not logged yet.
+     * @param productIds the ids of the products
+     */
+    void load(const std::vector<std::string> &productIds);
+
+    /**
+     * Start the background flush, if it is not running yet.
+     */
+    void startFlushing();
+
+    std::mutex mutex;
+    std::optional<PeriodicTask> flushTask; ///< Started by `rebuild` or `markHot`, guarded by `mutex`.
+    std::atomic<bool> pending{false};      ///< Reservations were logged by this process since the last flush.
+};
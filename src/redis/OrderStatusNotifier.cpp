@@ -0,0 +1,115 @@
+#include "OrderStatusNotifier.h"
+
+OrderStatusNotifier &OrderStatusNotifier::getInstance() {
+    static OrderStatusNotifier instance;
+    return instance;
+}
+
+OrderStatusNotifier::~OrderStatusNotifier() {
+    running = false;
+    if (thread.joinable()) thread.join();
+}
+
+std::string OrderStatusNotifier::channelOf(uint32_t orderId) { return std::format("order:{}:status", orderId); }
+
+void OrderStatusNotifier::publish(uint32_t orderId, Order::Status status) {
+    try {
+        conn2Redis()->publish(channelOf(orderId), Order::orderStatusToString(status));
+    } catch (const sw::redis::Error &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to publish status of order {}: {}", orderId, e.what()));
+    }
+}
+
+void OrderStatusNotifier::publish(std::span<const uint32_t> orderIds, Order::Status status) {
+    if (orderIds.empty()) return;
+    try {
+        std::string message = Order::orderStatusToString(status);
+        auto pipe = conn2Redis()->pipeline(false);
+        for (auto orderId: orderIds) pipe.publish(channelOf(orderId), message);
+        pipe.exec();
+    } catch (const sw::redis::Error &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to publish status of {} orders: {}", orderIds.size(), e.what()));
+    }
+}
+
+void OrderStatusNotifier::subscribe(uint32_t orderId, const void *owner, Callback callback) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    auto &callbacks = subscriptions[orderId];
+    if (callbacks.empty()) pendingSubscribe.push_back(channelOf(orderId));
+    callbacks.emplace_back(owner, std::move(callback));
+
+    if (!thread.joinable()) thread = std::thread(&OrderStatusNotifier::run, this);
+}
+
+void OrderStatusNotifier::unsubscribe(uint32_t orderId, const void *owner) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    removeSubscription(orderId, owner);
+}
+
+void OrderStatusNotifier::unsubscribeAll(const void *owner) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    std::vector<uint32_t> orderIds;
+    for (const auto &[orderId, callbacks]: subscriptions) orderIds.push_back(orderId);
+    for (auto orderId: orderIds) removeSubscription(orderId, owner);
+}
+
+void OrderStatusNotifier::removeSubscription(uint32_t orderId, const void *owner) {
+    auto it = subscriptions.find(orderId);
+    if (it == subscriptions.end()) return;
+
+    std::erase_if(it->second, [owner](const auto &subscription) { return subscription.first == owner; });
+    if (it->second.empty()) {
+        subscriptions.erase(it);
+        pendingUnsubscribe.push_back(channelOf(orderId));
+    }
+}
+
+void OrderStatusNotifier::run() {
+    std::optional<sw::redis::Subscriber> subscriber;
+
+    while (running) {
+        try {
+            // (Re)connect, subscribing again to every channel that still has callbacks
+            if (!subscriber) {
+                subscriber.emplace(redisSubscriber(pollInterval));
+                subscriber->on_message([this](std::string channel, std::string message) {
+                    // Channel format: order:{id}:status
+                    uint32_t orderId = std::stoul(channel.substr(channel.find(':') + 1));
+                    Order::Status status = Order::stringToOrderStatus(message);
+
+                    std::lock_guard<std::recursive_mutex> lock(mutex);
+                    auto it = subscriptions.find(orderId);
+                    if (it == subscriptions.end()) return;
+                    auto callbacks = it->second; // Callbacks may unsubscribe, iterate over a copy
+                    for (const auto &[owner, callback]: callbacks) callback(orderId, status);
+                });
+
+                std::lock_guard<std::recursive_mutex> lock(mutex);
+                pendingSubscribe.clear();
+                pendingUnsubscribe.clear();
+                for (const auto &[orderId, callbacks]: subscriptions) subscriber->subscribe(channelOf(orderId));
+            }
+
+            // Apply the (un)subscriptions requested since the last poll
+            {
+                std::lock_guard<std::recursive_mutex> lock(mutex);
+                for (const auto &channel: pendingSubscribe) subscriber->subscribe(channel);
+                for (const auto &channel: pendingUnsubscribe) subscriber->unsubscribe(channel);
+                pendingSubscribe.clear();
+                pendingUnsubscribe.clear();
+            }
+
+            subscriber->consume();
+        } catch (const sw::redis::TimeoutError &) {
+            continue; // No message within the poll interval
+        } catch (const sw::redis::Error &e) {
+            Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Order status subscriber failed, reconnecting: {}", e.what()));
+            subscriber.reset();
+            std::this_thread::sleep_for(pollInterval);
+        } catch (const std::exception &e) {
+            Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to deliver order status notification: {}", e.what()));
+        }
+    }
+}
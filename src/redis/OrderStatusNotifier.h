@@ -0,0 +1,102 @@
+#pragma once
+
+#include "../Utils.h"
+#include "../models/Order.h"
+#include "rdutils.h"
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * A singleton class that pushes order status changes to subscribers through Redis pub/sub
+ *
+ * @details Every status change is published on the order's own channel (`order:{id}:status`).
+ * Subscriptions are served by a single background thread, started on the first subscription,
+ * which owns the Redis subscriber connection and invokes the callbacks.
+ */
+class OrderStatusNotifier {
+public:
+    /**
+     * Function called with the id and the new status of an order, on the notifier thread.
+     */
+    using Callback = std::function<void(uint32_t orderId, Order::Status status)>;
+
+    OrderStatusNotifier() = default;
+    OrderStatusNotifier(const OrderStatusNotifier &) = delete;
+    OrderStatusNotifier &operator=(const OrderStatusNotifier &) = delete;
+
+    ~OrderStatusNotifier();
+
+    /**
+     * Get the singleton instance of the OrderStatusNotifier class
+     * @return The singleton instance of the OrderStatusNotifier class
+     */
+    static OrderStatusNotifier &getInstance();
+
+    /**
+     * Publish the new status of an order. Failures are logged and otherwise ignored,
+     * the status change is already committed and subscribers can still fall back to polling.
+     * @param orderId the id of the order
+     * @param status the new status
+     */
+    static void publish(uint32_t orderId, Order::Status status);
+
+    /**
+     * Publish the same new status for several orders, in a single round trip. Failures are logged and otherwise ignored.
+     * @param orderIds the ids of the orders
+     * @param status the new status
+     */
+    static void publish(std::span<const uint32_t> orderIds, Order::Status status);
+
+    /**
+     * Register a callback for the status changes of an order.
+     * @param orderId the id of the order
+     * @param owner the object owning the callback, used to unsubscribe
+     * @param callback the function to call on every status change
+     */
+    void subscribe(uint32_t orderId, const void *owner, Callback callback);
+
+    /**
+     * Remove the callbacks registered by an owner for an order.
+     * Once this returns, the callbacks are no longer running nor will they be called.
+     * @param orderId the id of the order
+     * @param owner the object owning the callbacks
+     */
+    void unsubscribe(uint32_t orderId, const void *owner);
+
+    /**
+     * Remove every callback registered by an owner.
+     * @param owner the object owning the callbacks
+     */
+    void unsubscribeAll(const void *owner);
+
+private:
+    /**
+     * @return the channel the status changes of an order are published on
+     */
+    static std::string channelOf(uint32_t orderId);
+
+    /**
+     * Body of the notifier thread: apply pending (un)subscriptions, then wait for messages.
+     */
+    void run();
+
+    /**
+     * Remove the callbacks of an owner for an order, queueing the channel for unsubscription if none is left. Requires `mutex`.
+     */
+    void removeSubscription(uint32_t orderId, const void *owner);
+
+    static constexpr std::chrono::milliseconds pollInterval{100}; ///< Upper bound on the delay before a (un)subscription is applied.
+
+    std::recursive_mutex mutex; ///< Recursive, so that callbacks can (un)subscribe.
+    std::unordered_map<uint32_t, std::vector<std::pair<const void *, Callback>>> subscriptions;
+    std::vector<std::string> pendingSubscribe;   ///< Channels to subscribe to on the next poll, guarded by `mutex`.
+    std::vector<std::string> pendingUnsubscribe; ///< Channels to unsubscribe from on the next poll, guarded by `mutex`.
+
+    std::atomic<bool> running = true;
+    std::thread thread; ///< Started on the first subscription.
+};
@@ -0,0 +1,169 @@
+#include "ProductRankings.h"
+#include <cmath>
+
+ProductRankings &ProductRankings::getInstance() {
+    static ProductRankings instance;
+    return instance;
+}
+
+std::string ProductRankings::bucketKey(const char *kind, std::chrono::sys_days day) { return std::format("rankings:{}:day:{:%Y%m%d}", kind, day); }
+
+std::string ProductRankings::windowKey(Window window) {
+    switch (window) {
+        case Window::DAY:
+            return std::format("{}:window:day", salesKey);
+        case Window::WEEK:
+            return std::format("{}:window:week", salesKey);
+        default:
+            return salesKey;
+    }
+}
+
+void ProductRankings::recordSales(const std::vector<Sale> &sales) {
+    // KEYS: trending set, today's bucket, supplier registry, then the supplier set of each sale.
+    // ARGV: bucket TTL, then the product id and quantity of each sale.
+    static constexpr const char *recordScript = R"(
+        for i = 1, #KEYS - 3 do
+            local product, quantity = ARGV[2 * i], ARGV[2 * i + 1]
+            redis.call('ZINCRBY', KEYS[1], quantity, product)
+            redis.call('ZINCRBY', KEYS[2], quantity, product)
+            redis.call('ZINCRBY', KEYS[3 + i], quantity, product)
+            redis.call('SADD', KEYS[3], KEYS[3 + i])
+        end
+        redis.call('EXPIRE', KEYS[2], ARGV[1])
+        return 0
+    )";
+    if (sales.empty()) return;
+
+    auto today = std::chrono::floor<std::chrono::days>(std::chrono::system_clock::now());
+    std::vector<std::string> keys{salesKey, bucketKey("sales", today), supplierKeysKey}, args{std::to_string(bucketTtl.count())};
+    for (const auto &sale: sales) {
+        keys.push_back(supplierKey(sale.supplierId));
+        args.push_back(std::to_string(sale.productId));
+        args.push_back(std::to_string(sale.quantity));
+    }
+
+    try {
+        conn2Redis()->eval<long long>(recordScript, keys.begin(), keys.end(), args.begin(), args.end());
+    } catch (const sw::redis::Error &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to record the sales of an order: {}", e.what()));
+    }
+}
+
+void ProductRankings::recordCancellations(std::span<const uint32_t> orderIds) {
+    // KEYS: trending set, then the daily bucket and the supplier set of each line.
+    // ARGV: minimum score, then the product id, quantity and decayed quantity of each line.
+    // Buckets that expired are not recreated, and products falling below the minimum score leave the sets.
+    static constexpr const char *cancelScript = R"(
+        for i = 1, (#KEYS - 1) / 2 do
+            local product, quantity, decayed = ARGV[3 * i - 1], ARGV[3 * i], ARGV[3 * i + 1]
+            redis.call('ZINCRBY', KEYS[1], -decayed, product)
+            redis.call('ZINCRBY', KEYS[2 * i + 1], -decayed, product)
+            if redis.call('EXISTS', KEYS[2 * i]) == 1 then
+                redis.call('ZINCRBY', KEYS[2 * i], -quantity, product)
+                redis.call('ZREMRANGEBYSCORE', KEYS[2 * i], '-inf', 0)
+            end
+            redis.call('ZREMRANGEBYSCORE', KEYS[1], '-inf', '(' .. ARGV[1])
+            redis.call('ZREMRANGEBYSCORE', KEYS[2 * i + 1], '-inf', '(' .. ARGV[1])
+        end
+        return 0
+    )";
+    if (orderIds.empty()) return;
+
+    try {
+        std::string ids = "{";
+        for (auto orderId: orderIds) ids += (ids.size() > 1 ? "," : "") + std::to_string(orderId);
+        ids += "}";
+
+        // Connect to the 'ecommerce' database as the 'ecommerce' user, customers cannot read the order items
+        auto conn = conn2Postgres("ecommerce", "ecommerce", "ecommerce");
+        pqxx::read_transaction tx(*conn);
+        pqxx::result R = tx.exec_params(R"(
+            SELECT product_id, supplier_id, SUM(quantity), EXTRACT(EPOCH FROM order_timestamp::TIMESTAMPTZ)::BIGINT
+            FROM order_items
+            WHERE order_id = ANY($1::INT[])
+            GROUP BY product_id, supplier_id, order_timestamp;
+        )", ids);
+        tx.commit();
+        if (R.empty()) return;
+
+        auto now = std::chrono::system_clock::now();
+        std::vector<std::string> keys{salesKey}, args{std::to_string(minScore)};
+        for (const auto &row: R) {
+            std::chrono::sys_seconds soldAt{std::chrono::seconds(row[3].as<int64_t>())};
+            auto quantity = row[2].as<uint32_t>();
+            // The trending sets were decayed once an hour since the sale
+            auto hours = std::max<int64_t>(0, std::chrono::floor<std::chrono::hours>(now - soldAt).count());
+            keys.push_back(bucketKey("sales", std::chrono::floor<std::chrono::days>(soldAt)));
+            keys.push_back(supplierKey(row[1].as<uint32_t>()));
+            args.push_back(row[0].c_str());
+            args.push_back(std::to_string(quantity));
+            args.push_back(std::to_string(quantity * std::pow(hourlyDecay, static_cast<double>(hours))));
+        }
+        conn2Redis()->eval<long long>(cancelScript, keys.begin(), keys.end(), args.begin(), args.end());
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to take back the sales of cancelled orders: {}", e.what()));
+    }
+}
+
+std::vector<std::pair<uint32_t, double>> ProductRankings::top(uint32_t k, Window window) { return topOf(windowKey(window), k); }
+
+std::vector<std::pair<uint32_t, double>> ProductRankings::topOfSupplier(uint32_t supplierId, uint32_t k) { return topOf(supplierKey(supplierId), k); }
+
+std::vector<std::pair<uint32_t, double>> ProductRankings::topOf(const std::string &key, uint32_t k) {
+    std::vector<std::pair<uint32_t, double>> ranking;
+    if (k == 0) return ranking;
+
+    std::vector<std::pair<std::string, double>> members;
+    conn2Redis()->zrevrange(key, 0, static_cast<long long>(k) - 1, std::back_inserter(members));
+
+    ranking.reserve(members.size());
+    for (const auto &[productId, score]: members) ranking.emplace_back(std::stoul(productId), score);
+    return ranking;
+}
+
+void ProductRankings::start() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (rolloverTask) return;
+    try {
+        rollover(); // The windows may be stale if no process ran for a while
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to roll the product rankings over: {}", e.what()));
+    }
+    rolloverTask.emplace("rankings rollover", rolloverInterval, [this] { rollover(); });
+}
+
+void ProductRankings::rollover() {
+    // KEYS: supplier registry, then the trending sets. ARGV: decay factor, minimum score.
+    static constexpr const char *decayScript = R"(
+        for i = 2, #KEYS do
+            redis.call('ZUNIONSTORE', KEYS[i], 1, KEYS[i], 'WEIGHTS', ARGV[1])
+            redis.call('ZREMRANGEBYSCORE', KEYS[i], '-inf', '(' .. ARGV[2])
+            if redis.call('EXISTS', KEYS[i]) == 0 then redis.call('SREM', KEYS[1], KEYS[i]) end
+        end
+        return 0
+    )";
+
+    auto now = std::chrono::system_clock::now();
+    auto today = std::chrono::floor<std::chrono::days>(now);
+    double elapsed = std::chrono::duration<double>(now - today) / std::chrono::days(1);
+    auto redis = conn2Redis();
+
+    // A window covers its last full days and the part of the day before them that is still inside it.
+    // ZUNIONSTORE replaces the window in one command, readers never see it half computed.
+    for (auto [window, days]: {std::pair{Window::DAY, 1}, std::pair{Window::WEEK, 7}}) {
+        std::vector<std::pair<std::string, double>> buckets;
+        for (int i = 0; i <= days; ++i) buckets.emplace_back(bucketKey("sales", today - std::chrono::days(i)), i == days ? 1.0 - elapsed : 1.0);
+        redis->zunionstore(windowKey(window), buckets.begin(), buckets.end());
+    }
+
+    // Every process runs this task, only the first one to claim the hour decays the trending sets
+    auto hour = std::chrono::floor<std::chrono::hours>(now).time_since_epoch().count();
+    if (!redis->set(std::format("rankings:decayed:{}", hour), "1", std::chrono::hours(2), sw::redis::UpdateType::NOT_EXIST)) return;
+
+    std::vector<std::string> keys{supplierKeysKey, salesKey};
+    redis->smembers(supplierKeysKey, std::back_inserter(keys));
+    std::vector<std::string> args{std::to_string(hourlyDecay), std::to_string(minScore)};
+    redis->eval<long long>(decayScript, keys.begin(), keys.end(), args.begin(), args.end());
+    Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("Trending rankings of {} sets decayed.", keys.size() - 1));
+}
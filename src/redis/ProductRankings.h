@@ -0,0 +1,109 @@
+#pragma once
+
+#include "../Utils.h"
+#include "../async/PeriodicTask.h"
+#include "../db/dbutils.h"
+#include "rdutils.h"
+#include <optional>
+#include <span>
+#include <vector>
+
+/**
+ * A singleton class that ranks products by popularity in Redis sorted sets
+ *
+ * @details Sales are counted at checkout in three kinds of sets: the trending set of every product (`rankings:sales`),
+ * the trending set of each supplier (`rankings:sales:supplier:{id}`) and one bucket per day (`rankings:sales:day:{yyyymmdd}`).
+ * Cancelled orders take their sales back from the same sets, weighted by the decay they went through.
+ * Reading the top K of a set costs O(log n + k), so rankings never aggregate `order_items`.
+ * A background task, run by every process, keeps the sliding windows (last day, last week) up to date from the daily buckets,
+ * and once an hour one of the processes decays the trending sets, so that old sales weigh less and less.
+ * Daily buckets expire on their own once no window covers them anymore.
+ */
+class ProductRankings {
+public:
+    /**
+     * The period a ranking covers.
+     */
+    enum class Window {
+        DAY,     ///< The last 24 hours.
+        WEEK,    ///< The last 7 days.
+        TRENDING ///< Every sale, halving in weight every day.
+    };
+
+    /**
+     * A product sold by a supplier, and a quantity of it.
+     */
+    struct Sale {
+        uint32_t productId;
+        uint32_t supplierId;
+        uint32_t quantity;
+    };
+
+    ProductRankings() = default;
+    ProductRankings(const ProductRankings &) = delete;
+    ProductRankings &operator=(const ProductRankings &) = delete;
+
+    /**
+     * Get the singleton instance of the ProductRankings class
+     * @return The singleton instance of the ProductRankings class
+     */
+    static ProductRankings &getInstance();
+
+    /**
+     * Count the sales of an order, in a single script call.
+     * @param sales the lines of the order
+     */
+    void recordSales(const std::vector<Sale> &sales);
+
+    /**
+     * Take back the sales of cancelled orders, in a single script call.
+     * @param orderIds the ids of the orders, once their cancellation is committed
+     */
+    void recordCancellations(std::span<const uint32_t> orderIds);
+
+    /**
+     * Get the best selling products.
+     * @param k the maximum number of products
+     * @param window the period to rank the products over
+     * @return the ids of the products and their score (units sold, decayed for `TRENDING`), best first
+     */
+    std::vector<std::pair<uint32_t, double>> top(uint32_t k, Window window);
+
+    /**
+     * Get the best selling products of a supplier, over the `TRENDING` window.
+     * @param supplierId the id of the supplier
+     * @param k the maximum number of products
+     * @return the ids of the products and their score, best first
+     */
+    std::vector<std::pair<uint32_t, double>> topOfSupplier(uint32_t supplierId, uint32_t k);
+
+    /**
+     * Start the background task maintaining the windows and decaying the trending sets.
+     */
+    void start();
+
+private:
+    static constexpr const char *salesKey = "rankings:sales";
+    static constexpr const char *supplierKeysKey = "rankings:suppliers"; ///< Keys of the per-supplier sets, to decay them.
+    static constexpr std::chrono::milliseconds rolloverInterval{60000};
+    static constexpr double hourlyDecay = 0.971531;                          ///< 0.5^(1/24), halves the trending scores every day.
+    static constexpr double minScore = 0.01;                                 ///< Products decayed below this score leave the trending sets.
+    static constexpr std::chrono::seconds bucketTtl{std::chrono::days(9)}; ///< Longer than the week window and its partial eighth day.
+
+    static std::string bucketKey(const char *kind, std::chrono::sys_days day);
+    static std::string supplierKey(uint32_t supplierId) { return std::format("{}:supplier:{}", salesKey, supplierId); }
+    static std::string windowKey(Window window);
+
+    /**
+     * Recompute the sliding windows from the daily buckets, and decay the trending sets once an hour.
+     */
+    void rollover();
+
+    /**
+     * Read the top K of a sorted set.
+     */
+    static std::vector<std::pair<uint32_t, double>> topOf(const std::string &key, uint32_t k);
+
+    std::mutex mutex;
+    std::optional<PeriodicTask> rolloverTask; ///< Started by `start`, guarded by `mutex`.
+};
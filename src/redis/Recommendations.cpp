@@ -0,0 +1,223 @@
+#include "Recommendations.h"
+#include <algorithm>
+#include <charconv>
+#include <condition_variable>
+#include <deque>
+#include <libpq-fe.h>
+#include <optional>
+
+namespace {
+/**
+ * A bounded queue of batches between the COPY reader and the workers, so that reading never runs far ahead of counting.
+ */
+template<typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return items.size() < capacity || closed; });
+        if (closed) return;
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+
+    /**
+     * @return the next item, or std::nullopt once the queue is closed and drained
+     */
+    std::optional<T> pop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+        if (items.empty()) return std::nullopt;
+        T item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return item;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+
+private:
+    size_t capacity;
+    std::mutex mutex;
+    std::condition_variable notEmpty, notFull;
+    std::deque<T> items; ///< Guarded by `mutex`, like `closed`.
+    bool closed = false;
+};
+} // namespace
+
+Recommendations &Recommendations::getInstance() {
+    static Recommendations instance;
+    return instance;
+}
+
+void Recommendations::countPairs(const Batch &batch, std::vector<PairCounts> &shards) {
+    size_t begin = 0;
+    for (size_t end: batch.ends) {
+        if (end - begin <= maxBasketSize) {
+            for (size_t i = begin; i < end; ++i) {
+                for (size_t j = i + 1; j < end; ++j) {
+                    uint64_t a = batch.items[i], b = batch.items[j];
+                    ++shards[a % shards.size()][a << 32 | b];
+                    ++shards[b % shards.size()][b << 32 | a];
+                }
+            }
+        }
+        begin = end;
+    }
+}
+
+std::vector<std::pair<std::string, std::string>> Recommendations::mergeShard(std::vector<PairCounts *> shards, uint32_t topK) {
+    // Merge into the largest map, freeing the others as soon as they are merged
+    std::ranges::sort(shards, std::greater{}, &PairCounts::size);
+    PairCounts &merged = *shards.front();
+    for (size_t i = 1; i < shards.size(); ++i) {
+        for (const auto &[pair, count]: *shards[i]) merged[pair] += count;
+        PairCounts().swap(*shards[i]);
+    }
+
+    std::unordered_map<uint32_t, std::vector<Neighbour>> neighbours;
+    for (const auto &[pair, count]: merged) neighbours[static_cast<uint32_t>(pair >> 32)].push_back({static_cast<uint32_t>(pair), count});
+    PairCounts().swap(merged);
+
+    std::vector<std::pair<std::string, std::string>> fields;
+    fields.reserve(neighbours.size());
+    for (auto &[productId, list]: neighbours) {
+        auto kept = list.begin() + std::min<size_t>(topK, list.size());
+        std::partial_sort(list.begin(), kept, list.end(), [](const Neighbour &a, const Neighbour &b) {
+            return a.count != b.count ? a.count > b.count : a.productId < b.productId;
+        });
+
+        std::string value;
+        for (auto it = list.begin(); it != kept; ++it) std::format_to(std::back_inserter(value), "{}{}:{}", value.empty() ? "" : ",", it->productId, it->count);
+        fields.emplace_back(std::to_string(productId), std::move(value));
+    }
+    return fields;
+}
+
+void Recommendations::rebuild(uint32_t topK, unsigned threads) {
+    try {
+        auto startTime = std::chrono::steady_clock::now();
+
+        // COPY streams the orders without materializing them, each order's products arrive consecutively and distinct
+        std::unique_ptr<PGconn, decltype(&PQfinish)> raw(PQconnectdb(PostgresConnectionPool::getInstance().getConnectionInfo("ecommerce", "ecommerce", "ecommerce").c_str()), &PQfinish);
+        if (PQstatus(raw.get()) != CONNECTION_OK) throw std::runtime_error(PQerrorMessage(raw.get()));
+
+        std::unique_ptr<PGresult, decltype(&PQclear)> start(PQexec(raw.get(), R"(
+            COPY (
+                SELECT DISTINCT oi.order_id, oi.product_id
+                FROM order_items oi
+                JOIN orders o ON o.id = oi.order_id AND o.timestamp = oi.order_timestamp
+                WHERE o.status != 'cancelled'
+                ORDER BY oi.order_id, oi.product_id
+            ) TO STDOUT)"), &PQclear);
+        if (PQresultStatus(start.get()) != PGRES_COPY_OUT) throw std::runtime_error(PQerrorMessage(raw.get()));
+
+        // Workers count the pairs of the batches while the next ones are read
+        BoundedQueue<Batch> queue(2 * threads);
+        std::vector<std::vector<PairCounts>> counts(threads, std::vector<PairCounts>(threads));
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t) {
+            workers.emplace_back([&queue, &shards = counts[t]] {
+                while (auto batch = queue.pop()) countPairs(batch.value(), shards);
+            });
+        }
+        auto joinWorkers = [&] {
+            queue.close();
+            for (auto &worker: workers) worker.join();
+        };
+
+        size_t orders = 0;
+        try {
+            Batch batch;
+            uint64_t currentOrder = 0;
+            char *buffer = nullptr;
+            int length;
+            while ((length = PQgetCopyData(raw.get(), &buffer, 0)) > 0) {
+                // Row format: {order id}\t{product id}\n
+                uint64_t orderId = 0;
+                uint32_t productId = 0;
+                auto [tab, ec1] = std::from_chars(buffer, buffer + length, orderId);
+                auto [end, ec2] = std::from_chars(tab + 1, buffer + length, productId);
+                PQfreemem(buffer);
+                if (ec1 != std::errc() || ec2 != std::errc()) throw std::runtime_error("Malformed COPY row");
+
+                if (batch.items.empty() || orderId != currentOrder) {
+                    if (!batch.items.empty()) batch.ends.push_back(batch.items.size());
+                    if (batch.ends.size() == batchSize) {
+                        orders += batch.ends.size();
+                        queue.push(std::exchange(batch, {}));
+                    }
+                    currentOrder = orderId;
+                }
+                batch.items.push_back(productId);
+            }
+            if (!batch.items.empty()) {
+                batch.ends.push_back(batch.items.size());
+                orders += batch.ends.size();
+                queue.push(std::move(batch));
+            }
+
+            std::unique_ptr<PGresult, decltype(&PQclear)> end(PQgetResult(raw.get()), &PQclear);
+            if (length == -2 || PQresultStatus(end.get()) != PGRES_COMMAND_OK) throw std::runtime_error(PQerrorMessage(raw.get()));
+        } catch (...) {
+            joinWorkers();
+            throw;
+        }
+        joinWorkers();
+
+        // Merge each shard on its own thread, shard s only holds the pairs of the products p with p % threads == s
+        std::vector<std::vector<std::pair<std::string, std::string>>> fields(threads);
+        std::vector<std::thread> mergers;
+        for (unsigned s = 0; s < threads; ++s) {
+            std::vector<PairCounts *> shards;
+            for (auto &workerCounts: counts) shards.push_back(&workerCounts[s]);
+            mergers.emplace_back([&fields, s, shards = std::move(shards), topK] { fields[s] = mergeShard(shards, topK); });
+        }
+        for (auto &merger: mergers) merger.join();
+
+        // Build the new hash aside and swap it in, so that readers never see a partial one
+        auto redis = conn2Redis();
+        std::string rebuildKey = std::format("{}:rebuild", recommendationsKey);
+        redis->del(rebuildKey);
+        size_t products = 0;
+        for (const auto &shardFields: fields) {
+            for (size_t i = 0; i < shardFields.size(); i += 1000) {
+                auto last = shardFields.begin() + static_cast<std::ptrdiff_t>(std::min(i + 1000, shardFields.size()));
+                redis->hset(rebuildKey, shardFields.begin() + static_cast<std::ptrdiff_t>(i), last);
+            }
+            products += shardFields.size();
+        }
+        if (products == 0) redis->del(recommendationsKey);
+        else redis->rename(rebuildKey, recommendationsKey);
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime);
+        Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("Recommendations rebuilt from {} orders for {} products on {} threads in {} ms.", orders, products, threads, elapsed.count()));
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to rebuild the recommendations: {}", e.what()));
+    }
+}
+
+std::vector<Recommendations::Neighbour> Recommendations::lookup(uint32_t productId) {
+    std::vector<Neighbour> neighbours;
+    auto value = conn2Redis()->hget(recommendationsKey, std::to_string(productId));
+    if (!value) return neighbours;
+
+    // Value format: {id}:{count},{id}:{count}...
+    const char *it = value->data(), *end = value->data() + value->size();
+    while (it < end) {
+        Neighbour neighbour{};
+        auto [colon, ec1] = std::from_chars(it, end, neighbour.productId);
+        auto [next, ec2] = std::from_chars(colon + 1, end, neighbour.count);
+        if (ec1 != std::errc() || ec2 != std::errc()) break;
+        neighbours.push_back(neighbour);
+        it = next + 1;
+    }
+    return neighbours;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "../Utils.h"
+#include "../db/dbutils.h"
+#include "rdutils.h"
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * A singleton class that recommends the products most often bought together with a given product
+ *
+ * @details `rebuild` is an offline batch job: it streams the products of every order with COPY, ordered by order id,
+ * and hands the orders to worker threads in batches while it reads. Each worker counts the product pairs of its orders
+ * in its own hash maps, sharded by product, so that the shards are then merged in parallel without locking,
+ * one thread per shard, and each product keeps only its top K neighbours.
+ * The neighbours are published to the Redis hash `recommendations` (product id -> `id:count,id:count...`),
+ * built aside and swapped in at once, so reading the recommendations of a product is a single HGET.
+ */
+class Recommendations {
+public:
+    /**
+     * A product bought together with another one, and in how many orders.
+     */
+    struct Neighbour {
+        uint32_t productId;
+        uint32_t count;
+    };
+
+    Recommendations() = default;
+    Recommendations(const Recommendations &) = delete;
+    Recommendations &operator=(const Recommendations &) = delete;
+
+    /**
+     * Get the singleton instance of the Recommendations class
+     * @return The singleton instance of the Recommendations class
+     */
+    static Recommendations &getInstance();
+
+    /**
+     * Recompute the neighbours of every product from the orders, cancelled ones excluded, and publish them to Redis.
+     * @param topK how many neighbours to keep per product
+     * @param threads how many worker threads count and merge the pairs
+     */
+    void rebuild(uint32_t topK = defaultTopK, unsigned threads = std::max(1u, std::thread::hardware_concurrency()));
+
+    /**
+     * Get the products most often bought together with a product, as of the last rebuild.
+     * @param productId the id of the product
+     * @return its neighbours, most frequent first, none if it was never bought with another product
+     * @throws sw::redis::Error if Redis is unreachable
+     */
+    std::vector<Neighbour> lookup(uint32_t productId);
+
+private:
+    static constexpr const char *recommendationsKey = "recommendations";
+    static constexpr uint32_t defaultTopK = 10;
+    static constexpr size_t maxBasketSize = 64; ///< Larger orders (bulk purchases) are skipped, their pairs grow quadratically and say little.
+    static constexpr size_t batchSize = 4096;   ///< Orders per batch handed to a worker.
+
+    using PairCounts = std::unordered_map<uint64_t, uint32_t>; ///< (product << 32 | neighbour) -> orders containing both.
+
+    /**
+     * Orders read from the COPY stream: the products of order i are `items[ends[i - 1]..ends[i])`.
+     */
+    struct Batch {
+        std::vector<uint32_t> items;
+        std::vector<size_t> ends;
+    };
+
+    /**
+     * Count the product pairs of a batch of orders, in both directions, in the shard of their first product.
+     * @param batch the orders, each with distinct products
+     * @param shards the pair counts of the calling worker, one map per shard
+     */
+    static void countPairs(const Batch &batch, std::vector<PairCounts> &shards);
+
+    /**
+     * Merge one shard of every worker and keep the top K neighbours of each of its products.
+     * @param shards the same shard of every worker, emptied
+     * @param topK how many neighbours to keep per product
+     * @return the fields of the Redis hash for these products
+     */
+    static std::vector<std::pair<std::string, std::string>> mergeShard(std::vector<PairCounts *> shards, uint32_t topK);
+};
@@ -0,0 +1,118 @@
+#include "RedisCartStore.h"
+#include "../Arena.h"
+#include <unordered_map>
+
+// Lua helpers for the varints of `CartCodec`, so that a line is read and rewritten by a single script
+static constexpr const char *varintFunctions = R"(
+    local function getVarint(packed)
+        local value, shift, length = 0, 1, 0
+        repeat
+            length = length + 1
+            local byte = string.byte(packed, length)
+            value = value + (byte % 128) * shift
+            shift = shift * 128
+        until byte < 128
+        return value, length
+    end
+    local function putVarint(value)
+        local packed = ''
+        while value >= 128 do
+            packed = packed .. string.char(value % 128 + 128)
+            value = math.floor(value / 128)
+        end
+        return packed .. string.char(value)
+    end
+)";
+
+void RedisCartStore::add(const std::string &customerId, uint32_t productId, const CartCodec::Item &item) {
+    // If the product is already in the cart, its amount is added. The price and supplier are refreshed to the current ones.
+    static const std::string addScript = std::string(varintFunctions) + R"(
+        local amount = tonumber(ARGV[2])
+        local line = redis.call('HGET', KEYS[1], ARGV[1])
+        if line then amount = amount + getVarint(line) end
+        redis.call('HSET', KEYS[1], ARGV[1], putVarint(amount) .. ARGV[3])
+        redis.call('EXPIRE', KEYS[1], ARGV[4])
+        return 0
+    )";
+
+    // The line without its amount: the leading varint of a line packed with a zero amount is a single byte
+    std::string rest = CartCodec::encode({0, item.price, item.supplierId}).substr(1);
+    std::vector<std::string> keys{CartCodec::keyOf(customerId)};
+    std::vector<std::string> args{std::to_string(productId), std::to_string(item.amount), std::move(rest), std::to_string(std::chrono::seconds(CartCodec::ttl).count())};
+    conn2Cart(customerId)->eval<long long>(addScript, keys.begin(), keys.end(), args.begin(), args.end());
+}
+
+CartStore::Removal RedisCartStore::remove(const std::string &customerId, uint32_t productId, std::optional<uint32_t> amount) {
+    // Returns the line before the removal, nil if the product is not in the cart, or '' if it holds less than the amount
+    static const std::string removeScript = std::string(varintFunctions) + R"(
+        local line = redis.call('HGET', KEYS[1], ARGV[1])
+        if not line then return false end
+        local current, length = getVarint(line)
+        local removed = tonumber(ARGV[2]) or current
+        if removed > current then return '' end
+        if removed < current then
+            redis.call('HSET', KEYS[1], ARGV[1], putVarint(current - removed) .. string.sub(line, length + 1))
+        else
+            redis.call('HDEL', KEYS[1], ARGV[1])
+        end
+        redis.call('EXPIRE', KEYS[1], ARGV[3])
+        return line
+    )";
+
+    std::vector<std::string> keys{CartCodec::keyOf(customerId)};
+    std::vector<std::string> args{std::to_string(productId), amount ? std::to_string(amount.value()) : "", std::to_string(std::chrono::seconds(CartCodec::ttl).count())};
+    auto line = conn2Cart(customerId)->eval<sw::redis::OptionalString>(removeScript, keys.begin(), keys.end(), args.begin(), args.end());
+    if (!line) return {Removal::Status::NOT_FOUND};
+    if (line->empty()) return {Removal::Status::NOT_ENOUGH};
+
+    CartCodec::Item item = CartCodec::decode(line.value());
+    return {Removal::Status::REMOVED, amount.value_or(item.amount), item.price};
+}
+
+Cart RedisCartStore::read(const std::string &customerId) {
+    Arena arena;
+    // The whole cart is a single hash, fetched in one round trip and parsed straight from the reply
+    auto reply = conn2Cart(customerId)->command("HGETALL", CartCodec::keyOf(customerId, arena.resource()));
+    return Cart::parse(*reply);
+}
+
+void RedisCartStore::clear(const std::string &customerId) {
+    Arena arena;
+    // The whole cart is a single key
+    conn2Cart(customerId)->del(CartCodec::keyOf(customerId, arena.resource()));
+}
+
+void RedisCartStore::migrateLegacyCarts() {
+    RedisCartStore store;
+    size_t migrated = 0;
+    for (const auto &shard: CartShardRing::getInstance().getAllConnections()) {
+        // Legacy key formats: cart:{customerId}:{productId}, a hash of decimal fields, and cart:{customerId}:total_price
+        std::vector<std::string> keys;
+        long long cursor = 0;
+        do {
+            cursor = shard->scan(cursor, "cart:*:*", 1000, std::back_inserter(keys));
+        } while (cursor != 0);
+
+        for (const auto &key: keys) {
+            size_t separator = key.find(':', 5);
+            std::string customerId = key.substr(5, separator - 5), product = key.substr(separator + 1);
+            try {
+                if (product != "total_price") {
+                    std::unordered_map<std::string, std::string> fields;
+                    shard->hgetall(key, std::inserter(fields, fields.end()));
+                    if (fields.contains("amount") && fields.contains("price") && fields.contains("supplierId")) {
+                        // Added through the store, so that the line lands on the current owner of the customer
+                        store.add(customerId, std::stoul(product),
+                                  {static_cast<uint32_t>(std::stoul(fields["amount"])), static_cast<uint32_t>(std::stoul(fields["price"])),
+                                   static_cast<uint32_t>(std::stoul(fields["supplierId"]))});
+                        ++migrated;
+                    }
+                }
+                shard->del(key);
+            } catch (const std::logic_error &e) {
+                Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to migrate the legacy cart key {}, it is left in place: {}", key, e.what()));
+            }
+        }
+    }
+    if (migrated) Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("{} legacy cart lines migrated.", migrated));
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "../models/CartStore.h"
+#include "rdutils.h"
+
+/**
+ * The Redis backend of the cart store: each cart is the hash `cart:{customerId}` (see `CartCodec`) on the shard owning
+ * the customer (see `CartShardRing`), expiring once abandoned for `CartCodec::ttl`.
+ */
+class RedisCartStore : public CartStore {
+public:
+    void add(const std::string &customerId, uint32_t productId, const CartCodec::Item &item) override;
+    Removal remove(const std::string &customerId, uint32_t productId, std::optional<uint32_t> amount) override;
+    Cart read(const std::string &customerId) override;
+    void clear(const std::string &customerId) override;
+
+    /**
+     * Convert the carts left in the legacy format (one hash `cart:{customerId}:{productId}` per line, and a
+     * `cart:{customerId}:total_price` key) into lines of the current hashes, and delete the legacy keys.
+     * Run at startup, before any cart is used.
+     */
+    static void migrateLegacyCarts();
+};
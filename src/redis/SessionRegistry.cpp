@@ -0,0 +1,100 @@
+#include "SessionRegistry.h"
+#include <random>
+
+SessionRegistry &SessionRegistry::getInstance() {
+    static SessionRegistry instance;
+    return instance;
+}
+
+std::optional<SessionRegistry::DirectoryEntry> SessionRegistry::lookupUser(const std::string &role, const std::string &username) {
+    // Entry format: {id}:{balance}
+    auto entry = conn2Redis()->hget(std::format("users:{}", role), username);
+    if (!entry) return std::nullopt;
+
+    auto separator = entry->find(':');
+    return DirectoryEntry{entry->substr(0, separator), static_cast<uint32_t>(std::stoul(entry->substr(separator + 1)))};
+}
+
+void SessionRegistry::rememberUser(const std::string &role, const std::string &username, const DirectoryEntry &entry) {
+    conn2Redis()->hset(std::format("users:{}", role), username, std::format("{}:{}", entry.userId, entry.balance));
+}
+
+bool SessionRegistry::open(const Session &session) {
+    // The random token tells this session apart from a later one of the same user, once this one has expired
+    thread_local std::mt19937_64 gen(std::random_device{}());
+    auto loginTime = std::chrono::duration_cast<std::chrono::milliseconds>(session.loginTime.time_since_epoch()).count();
+    std::string key = keyOf(session.role, session.userId);
+    std::string value = std::format("{}:{}:{}:{:016x}", session.userId, session.balance, loginTime, gen());
+
+    if (!conn2Redis()->set(key, value, sessionTtl, sw::redis::UpdateType::NOT_EXIST)) return false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    openSessions[key] = value;
+    if (!heartbeatTask) heartbeatTask.emplace("session heartbeat", heartbeatInterval, [this] { heartbeat(); });
+    return true;
+}
+
+bool SessionRegistry::close(const std::string &role, const std::string &userId) {
+    // Only delete the session if it is still ours, it may have expired and been opened again elsewhere
+    static constexpr const char *closeScript = R"(
+        if redis.call('GET', KEYS[1]) == ARGV[1] then return redis.call('DEL', KEYS[1]) end
+        return 0
+    )";
+
+    std::string key = keyOf(role, userId);
+    std::string value;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = openSessions.find(key);
+        if (it == openSessions.end()) return false;
+        value = std::move(it->second);
+        openSessions.erase(it);
+    }
+    return conn2Redis()->eval<long long>(closeScript, {key}, {value}) == 1;
+}
+
+std::optional<SessionRegistry::Session> SessionRegistry::get(const std::string &role, const std::string &userId) {
+    auto value = conn2Redis()->get(keyOf(role, userId));
+    if (!value) return std::nullopt;
+
+    // Value format: {id}:{balance}:{login time in ms}:{token}
+    auto balanceStart = value->find(':') + 1;
+    auto timeStart = value->find(':', balanceStart) + 1;
+    auto tokenStart = value->find(':', timeStart) + 1;
+    return Session{
+            userId,
+            role,
+            static_cast<uint32_t>(std::stoul(value->substr(balanceStart, timeStart - balanceStart - 1))),
+            std::chrono::system_clock::time_point(std::chrono::milliseconds(std::stoll(value->substr(timeStart, tokenStart - timeStart - 1)))),
+    };
+}
+
+void SessionRegistry::heartbeat() {
+    // Extend only the sessions still holding our value, returns how many were extended
+    static constexpr const char *heartbeatScript = R"(
+        local extended = 0
+        for i, key in ipairs(KEYS) do
+            if redis.call('GET', key) == ARGV[i] then
+                redis.call('PEXPIRE', key, ARGV[#ARGV])
+                extended = extended + 1
+            end
+        end
+        return extended
+    )";
+
+    std::vector<std::string> keys, values;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto &[key, value]: openSessions) {
+            keys.push_back(key);
+            values.push_back(value);
+        }
+    }
+    if (keys.empty()) return;
+    values.push_back(std::to_string(sessionTtl.count()));
+
+    auto extended = conn2Redis()->eval<long long>(heartbeatScript, keys.begin(), keys.end(), values.begin(), values.end());
+    if (extended < static_cast<long long>(keys.size())) {
+        Utils::log(Utils::LogLevel::ALERT, std::cerr, std::format("{} session(s) expired before their heartbeat.", keys.size() - extended));
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "../Utils.h"
+#include "../async/PeriodicTask.h"
+#include "rdutils.h"
+#include <optional>
+#include <unordered_map>
+
+/**
+ * A singleton class that keeps the user sessions in Redis instead of the `logged_in` columns
+ *
+ * @details A session is a key `session:{role}:{id}` created with SET NX, so a user can only log in once,
+ * and with a short TTL that a background heartbeat keeps extending while the session is open.
+ * If the process dies, its sessions expire on their own instead of leaving users stuck as logged in.
+ * The user directory (`users:{role}`: username -> id and balance snapshot) lets returning users log in without Postgres,
+ * which is only queried the first time a username is seen.
+ */
+class SessionRegistry {
+public:
+    /**
+     * The state of an open session.
+     */
+    struct Session {
+        std::string userId;
+        std::string role;
+        uint32_t balance; ///< Balance when the session was opened.
+        std::chrono::system_clock::time_point loginTime;
+    };
+
+    /**
+     * An entry of the user directory.
+     */
+    struct DirectoryEntry {
+        std::string userId;
+        uint32_t balance; ///< Last balance written by the user itself, may lag behind changes made by others.
+    };
+
+    SessionRegistry() = default;
+    SessionRegistry(const SessionRegistry &) = delete;
+    SessionRegistry &operator=(const SessionRegistry &) = delete;
+
+    /**
+     * Get the singleton instance of the SessionRegistry class
+     * @return The singleton instance of the SessionRegistry class
+     */
+    static SessionRegistry &getInstance();
+
+    /**
+     * Look up a user in the directory.
+     * @param role the role of the user (`customer`, `supplier` or `transporter`)
+     * @param username the name of the user
+     * @return the id and balance snapshot of the user, or std::nullopt if it was never seen
+     */
+    std::optional<DirectoryEntry> lookupUser(const std::string &role, const std::string &username);
+
+    /**
+     * Add or update a user in the directory.
+     * @param role the role of the user
+     * @param username the name of the user
+     * @param entry the id and current balance of the user
+     */
+    void rememberUser(const std::string &role, const std::string &username, const DirectoryEntry &entry);
+
+    /**
+     * Open a session, unless the user already has one.
+     * @param session the session to open
+     * @return false if the user is already logged in
+     */
+    bool open(const Session &session);
+
+    /**
+     * Close a session opened by this process.
+     * @param role the role of the user
+     * @param userId the id of the user
+     * @return false if there was no such session, or if it had expired
+     */
+    bool close(const std::string &role, const std::string &userId);
+
+    /**
+     * Get an open session, whichever process opened it.
+     * @param role the role of the user
+     * @param userId the id of the user
+     * @return the session, or std::nullopt if the user is not logged in
+     */
+    std::optional<Session> get(const std::string &role, const std::string &userId);
+
+private:
+    static constexpr std::chrono::milliseconds sessionTtl{30000};
+    static constexpr std::chrono::milliseconds heartbeatInterval{10000}; ///< A third of the TTL, so a late heartbeat is not fatal.
+
+    static std::string keyOf(const std::string &role, const std::string &userId) { return std::format("session:{}:{}", role, userId); }
+
+    /**
+     * Extend the TTL of every session opened by this process, in a single script call.
+     */
+    void heartbeat();
+
+    std::mutex mutex;
+    std::unordered_map<std::string, std::string> openSessions; ///< Key -> value of the sessions opened by this process, guarded by `mutex`.
+    std::optional<PeriodicTask> heartbeatTask;                  ///< Started with the first session.
+};
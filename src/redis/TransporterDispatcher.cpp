@@ -0,0 +1,116 @@
+#include "TransporterDispatcher.h"
+
+TransporterDispatcher &TransporterDispatcher::getInstance() {
+    static TransporterDispatcher instance;
+    return instance;
+}
+
+std::vector<std::pair<std::string, double>> TransporterDispatcher::countBacklogs(const std::vector<std::string> &transporterIds) {
+    std::vector<std::pair<std::string, double>> backlogs;
+    if (transporterIds.empty()) return backlogs;
+
+    // Connect to the 'ecommerce' database as the 'ecommerce' user, customers cannot read the transporters table
+    auto conn = conn2Postgres("ecommerce", "ecommerce", "ecommerce");
+
+    std::string ids;
+    for (const auto &transporterId: transporterIds) ids += std::format("{}{}", ids.empty() ? "" : ",", std::stoul(transporterId));
+
+    // One index lookup per transporter (`orders_shipped_transporter_idx`)
+    pqxx::work tx(*conn);
+    for (auto [transporterId, backlog]: tx.query<std::string, double>(std::format(R"(
+            SELECT t.id, (SELECT COUNT(*) FROM orders o WHERE o.transporter_id = t.id AND o.status = 'shipped')
+            FROM unnest('{{{}}}'::INT[]) AS t(id);
+    )", ids))) {
+        backlogs.emplace_back(std::move(transporterId), backlog);
+    }
+    tx.commit();
+    return backlogs;
+}
+
+void TransporterDispatcher::registerTransporter(uint32_t transporterId) {
+    try {
+        auto backlogs = countBacklogs({std::to_string(transporterId)});
+        conn2Redis()->zadd(backlogKey, backlogs.begin(), backlogs.end(), sw::redis::UpdateType::NOT_EXIST);
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to register transporter {}: {}", transporterId, e.what()));
+    }
+}
+
+void TransporterDispatcher::unregisterTransporter(uint32_t transporterId) {
+    try {
+        conn2Redis()->zrem(backlogKey, std::to_string(transporterId));
+    } catch (const sw::redis::Error &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to unregister transporter {}: {}", transporterId, e.what()));
+    }
+}
+
+std::optional<uint32_t> TransporterDispatcher::assign() {
+    // Pop-and-increment must be atomic, otherwise concurrent checkouts would all pick the same transporter
+    static constexpr const char *assignScript = R"(
+        local least = redis.call('ZRANGE', KEYS[1], 0, 0)
+        if #least == 0 then return false end
+        redis.call('ZINCRBY', KEYS[1], 1, least[1])
+        return least[1]
+    )";
+
+    try {
+        auto transporterId = conn2Redis()->eval<sw::redis::OptionalString>(assignScript, {backlogKey}, {});
+        if (transporterId) return std::stoul(transporterId.value());
+    } catch (const sw::redis::Error &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to assign a transporter: {}", e.what()));
+    }
+    return std::nullopt;
+}
+
+void TransporterDispatcher::release(uint32_t transporterId, uint32_t orders) {
+    // Never let a backlog go negative, e.g. for orders created before the last rebuild
+    static constexpr const char *releaseScript = R"(
+        local backlog = redis.call('ZSCORE', KEYS[1], ARGV[1])
+        if backlog and tonumber(backlog) > 0 then redis.call('ZINCRBY', KEYS[1], -math.min(tonumber(backlog), tonumber(ARGV[2])), ARGV[1]) end
+        return 0
+    )";
+
+    if (orders == 0) return;
+    try {
+        conn2Redis()->eval<long long>(releaseScript, {backlogKey}, {std::to_string(transporterId), std::to_string(orders)});
+    } catch (const sw::redis::Error &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to release transporter {}: {}", transporterId, e.what()));
+    }
+}
+
+void TransporterDispatcher::charge(uint32_t transporterId, uint32_t orders) {
+    if (orders == 0) return;
+    try {
+        conn2Redis()->zincrby(backlogKey, orders, std::to_string(transporterId));
+    } catch (const sw::redis::Error &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to charge transporter {}: {}", transporterId, e.what()));
+    }
+}
+
+void TransporterDispatcher::rebuild() {
+    try {
+        // Only the transporters holding a session, whichever process opened it
+        auto redis = conn2Redis();
+        std::vector<std::string> sessions;
+        long long cursor = 0;
+        do {
+            cursor = redis->scan(cursor, "session:transporter:*", 1000, std::back_inserter(sessions));
+        } while (cursor != 0);
+        std::vector<std::string> transporterIds;
+        for (const auto &session: sessions) transporterIds.push_back(session.substr(session.rfind(':') + 1));
+        auto backlogs = countBacklogs(transporterIds);
+
+        // Build the new set aside and swap it in, so that concurrent assignments never see a partial set
+        if (backlogs.empty()) redis->del(backlogKey);
+        else {
+            std::string rebuildKey = std::format("{}:rebuild", backlogKey);
+            redis->del(rebuildKey);
+            redis->zadd(rebuildKey, backlogs.begin(), backlogs.end());
+            redis->rename(rebuildKey, backlogKey);
+        }
+
+        Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("Transporter backlogs rebuilt for {} transporters.", backlogs.size()));
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to rebuild transporter backlogs: {}", e.what()));
+    }
+}
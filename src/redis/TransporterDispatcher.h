@@ -0,0 +1,93 @@
+#pragma once
+
+#include "../Utils.h"
+#include "../db/dbutils.h"
+#include "rdutils.h"
+#include <atomic>
+#include <optional>
+
+/**
+ * A singleton class that assigns new orders to the least loaded transporter
+ *
+ * @details The backlog of each transporter (its number of shipped, not yet delivered orders) is kept
+ * in a Redis sorted set, so the least loaded transporter is found and charged in O(log n) with one script call.
+ * Only logged in transporters are in the set: they are added with their backlog at login and removed at logout.
+ * The backlog is decremented when an order is delivered or cancelled, and rebuilt from Postgres at startup
+ * for the transporters holding a session.
+ * In pool mode, new orders are not assigned at all: transporters claim them with `Transporter::claimNextOrders`,
+ * and the claimed orders are charged to their backlog.
+ */
+class TransporterDispatcher {
+public:
+    TransporterDispatcher() = default;
+    TransporterDispatcher(const TransporterDispatcher &) = delete;
+    TransporterDispatcher &operator=(const TransporterDispatcher &) = delete;
+
+    /**
+     * Get the singleton instance of the TransporterDispatcher class
+     * @return The singleton instance of the TransporterDispatcher class
+     */
+    static TransporterDispatcher &getInstance();
+
+    /**
+     * Make a transporter available for new orders, with its current backlog unless it is already known.
+     * @param transporterId the id of the transporter
+     */
+    void registerTransporter(uint32_t transporterId);
+
+    /**
+     * Stop assigning new orders to a transporter.
+     * @param transporterId the id of the transporter
+     */
+    void unregisterTransporter(uint32_t transporterId);
+
+    /**
+     * Pick the transporter with the smallest backlog and increment it.
+     * @return the id of the transporter, or std::nullopt if no transporter is logged in (or Redis is unreachable)
+     */
+    std::optional<uint32_t> assign();
+
+    /**
+     * Decrement the backlog of a transporter, after some of its orders were delivered or cancelled,
+     * or after an order assigned to it could not be created.
+     * @param transporterId the id of the transporter
+     * @param orders the number of orders that left the backlog
+     */
+    void release(uint32_t transporterId, uint32_t orders = 1);
+
+    /**
+     * Increment the backlog of a transporter by the orders it claimed from the pool.
+     * @param transporterId the id of the transporter
+     * @param orders the number of orders claimed
+     */
+    void charge(uint32_t transporterId, uint32_t orders);
+
+    /**
+     * Leave new orders unassigned, for transporters to claim them, instead of assigning them at creation.
+     * @param pooled true to enable pool mode
+     */
+    void setPooled(bool pooled) { this->pooled = pooled; }
+
+    /**
+     * @return true if new orders are left for transporters to claim
+     */
+    [[nodiscard]] bool isPooled() const { return pooled; }
+
+    /**
+     * Recompute the backlog of every logged in transporter from the `orders` table.
+     */
+    void rebuild();
+
+private:
+    static constexpr const char *backlogKey = "transporters:backlog";
+
+    /**
+     * Count the shipped, not yet delivered orders of transporters.
+     * @param transporterIds the ids of the transporters
+     * @return the id and backlog of each transporter
+     * @throws std::exception if Postgres is unreachable
+     */
+    static std::vector<std::pair<std::string, double>> countBacklogs(const std::vector<std::string> &transporterIds);
+
+    std::atomic<bool> pooled{false}; ///< Set by `--transporter-pool`.
+};
@@ -1,8 +1,116 @@
 #include "rdutils.h"
+#include <algorithm>
+#include <unordered_map>
 
 std::shared_ptr<sw::redis::Redis> conn2Redis() { return RedisConnectionPool::getInstance().getConnection("tcp://127.0.0.1:6379"); }
 
+std::shared_ptr<sw::redis::Redis> conn2Cart(const std::string &customerId) { return CartShardRing::getInstance().getConnection(customerId); }
+
+sw::redis::Subscriber redisSubscriber(std::chrono::milliseconds timeout) {
+    return RedisConnectionPool::getInstance().getConnection(std::format("tcp://127.0.0.1:6379?socket_timeout={}ms", timeout.count()))->subscriber();
+}
+
 void dropRedis() {
     auto redis = conn2Redis();
     redis->flushdb();
+    for (const auto &shard: CartShardRing::getInstance().getAllConnections()) shard->flushdb();
+}
+
+/**
+ * Get the keys of a server, snapshots excluded
+ * @param redis the server
+ * @return the keys
+ */
+static std::vector<std::string> scanKeys(sw::redis::Redis &redis) {
+    std::vector<std::string> keys;
+    long long cursor = 0;
+    do {
+        cursor = redis.scan(cursor, "*", 1000, std::back_inserter(keys));
+    } while (cursor != 0);
+    std::erase_if(keys, [](const std::string &key) { return key.starts_with("snapshot:"); });
+    return keys;
+}
+
+/**
+ * Save the keys of a server to its own snapshot hashes: `snapshot:{name}` holds the DUMP of each key and `snapshot:{name}:ttl` its PTTL
+ * @return the number of keys saved
+ */
+static size_t snapshotServer(sw::redis::Redis &redis, const std::string &name) {
+    std::string dumpsKey = std::format("snapshot:{}", name), ttlsKey = std::format("snapshot:{}:ttl", name);
+    std::vector<std::string> previous{dumpsKey, ttlsKey};
+    redis.del(previous.begin(), previous.end());
+
+    auto keys = scanKeys(redis);
+    for (size_t i = 0; i < keys.size(); i += 1000) {
+        size_t last = std::min(i + 1000, keys.size());
+        auto pipe = redis.pipeline(false);
+        for (size_t j = i; j < last; ++j) pipe.dump(keys[j]).pttl(keys[j]);
+        auto replies = pipe.exec();
+
+        std::vector<std::pair<std::string, std::string>> dumps, ttls;
+        for (size_t j = i; j < last; ++j) {
+            auto dump = replies.get<sw::redis::OptionalString>(2 * (j - i));
+            if (!dump) continue; // Expired meanwhile
+            dumps.emplace_back(keys[j], std::move(*dump));
+            ttls.emplace_back(keys[j], std::to_string(replies.get<long long>(2 * (j - i) + 1)));
+        }
+        if (dumps.empty()) continue;
+        redis.hset(dumpsKey, dumps.begin(), dumps.end());
+        redis.hset(ttlsKey, ttls.begin(), ttls.end());
+    }
+    return keys.size();
+}
+
+/**
+ * Replace the keys of a server with those of its snapshot
+ * @return the number of keys restored
+ */
+static size_t restoreServer(sw::redis::Redis &redis, const std::string &name) {
+    std::unordered_map<std::string, std::string> dumps, ttls;
+    redis.hgetall(std::format("snapshot:{}", name), std::inserter(dumps, dumps.end()));
+    redis.hgetall(std::format("snapshot:{}:ttl", name), std::inserter(ttls, ttls.end()));
+
+    auto keys = scanKeys(redis);
+    for (size_t i = 0; i < keys.size(); i += 1000) {
+        auto first = keys.begin() + static_cast<std::ptrdiff_t>(i);
+        redis.del(first, first + static_cast<std::ptrdiff_t>(std::min<size_t>(1000, keys.size() - i)));
+    }
+
+    auto pipe = redis.pipeline(false);
+    size_t queued = 0;
+    for (const auto &[key, dump]: dumps) {
+        auto ttl = ttls.contains(key) ? std::stoll(ttls[key]) : -1;
+        pipe.restore(key, dump, std::max(ttl, 0LL), true); // A TTL of 0 restores a key without expiry
+        if (++queued % 1000 == 0) pipe.exec();
+    }
+    pipe.exec();
+    return dumps.size();
+}
+
+bool snapshotRedis(const std::string &name) {
+    try {
+        auto redis = conn2Redis();
+        size_t keys = snapshotServer(*redis, name);
+        for (const auto &shard: CartShardRing::getInstance().getAllConnections()) keys += snapshotServer(*shard, name);
+        redis->set(std::format("snapshot:{}:taken", name), std::format("{:%FT%TZ}", std::chrono::system_clock::now())); // A server with no keys has no hashes
+        Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("Redis snapshot `{}` taken with {} keys.", name, keys));
+        return true;
+    } catch (const sw::redis::Error &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to take Redis snapshot `{}`: {}", name, e.what()));
+        return false;
+    }
+}
+
+bool restoreRedis(const std::string &name) {
+    try {
+        auto redis = conn2Redis();
+        if (!redis->exists(std::format("snapshot:{}:taken", name))) throw std::runtime_error("No such snapshot");
+        size_t keys = restoreServer(*redis, name);
+        for (const auto &shard: CartShardRing::getInstance().getAllConnections()) keys += restoreServer(*shard, name);
+        Utils::log(Utils::LogLevel::DEBUG, std::cout, std::format("Redis restored from snapshot `{}` with {} keys.", name, keys));
+        return true;
+    } catch (const std::exception &e) {
+        Utils::log(Utils::LogLevel::ERROR, std::cerr, std::format("Failed to restore Redis snapshot `{}`: {}", name, e.what()));
+        return false;
+    }
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../Utils.h"
+#include "CartShardRing.h"
 #include "RedisConnectionPool.h"
 #include <sw/redis++/redis++.h>
 
@@ -11,7 +12,37 @@
 std::shared_ptr<sw::redis::Redis> conn2Redis();
 
 /**
- * Drop the Redis database
+ * Connect to the Redis shard holding the cart of a customer
+ * @param customerId the id of the customer
+ * @return a pointer to the Redis connection object
+ */
+std::shared_ptr<sw::redis::Redis> conn2Cart(const std::string &customerId);
+
+/**
+ * Create a subscriber for Redis pub/sub channels
+ * @param timeout how long `consume` waits for a message before throwing sw::redis::TimeoutError
+ * @return the subscriber, on its own connection
+ */
+sw::redis::Subscriber redisSubscriber(std::chrono::milliseconds timeout);
+
+/**
+ * Drop the Redis database, and the cart shards
  * Used for testing purposes
  */
 void dropRedis();
+
+/**
+ * Save every key of the Redis database and of the cart shards, with its TTL, to the hash `snapshot:{name}` of each server
+ * Used for testing purposes, alongside `snapshotDatabase`. A snapshot lives on the server it was taken from,
+ * so each one takes about as much memory as the keys it saved.
+ * @param name the name of the snapshot
+ * @return true if the snapshot was taken
+ */
+bool snapshotRedis(const std::string &name);
+
+/**
+ * Replace the keys of the Redis database and of the cart shards with those saved by `snapshotRedis`, snapshots excluded
+ * @param name the name of the snapshot
+ * @return true if the keys were restored
+ */
+bool restoreRedis(const std::string &name);